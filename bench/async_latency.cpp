@@ -0,0 +1,174 @@
+// async_latency: what the runtime thread pays per event, and how long an
+// event takes to be answered, with the plugin answering synchronously
+// (LR_WORKERS=0) and through worker threads.
+//
+// Each worker count runs in its own forked process, as the plugin reads
+// LR_WORKERS once at load.  Every payload starts with the TSC read just
+// before event_handler was called; the notify hook, on whichever thread
+// notifies, records the cycles since then as end-to-end latency.  The
+// call itself is timed as the enqueue cost.  --rate paces the calls so
+// the workers are measured below saturation.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <exception>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "cli.h"
+#include "ens_runtime.h"
+#include "histogram.h"
+#include "per_thread.h"
+#include "plugin.h"
+#include "report.h"
+#include "tsc.h"
+
+namespace {
+
+struct Options {
+    std::vector<unsigned> workers = std::vector<unsigned>{0, 1};
+    uint64_t events = 1000000;
+    uint32_t sessions = 1024;
+    uint32_t payload = 64;
+    double rate = 0;
+    std::string path;
+};
+
+struct EndToEnd {
+    lr::Histogram cycles;
+};
+
+void record_end_to_end(uint32_t, uint32_t, ENSUserData* data)
+{
+    uint64_t now = lr::rdtscp();
+    uint64_t sent;
+    memcpy(&sent, data->p, sizeof(sent));
+    lr::PerThread<EndToEnd>::local().cycles.record(now > sent ? now - sent : 0);
+}
+
+std::vector<unsigned> parse_workers(const std::string& spec)
+{
+    std::vector<unsigned> out;
+    std::istringstream in(spec);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        char* end = nullptr;
+        unsigned long n = strtoul(item.c_str(), &end, 10);
+        if (item.empty() || *end != '\0' || n > 64)
+            throw std::invalid_argument("bad worker count '" + item + "'");
+        out.push_back(unsigned(n));
+    }
+    if (out.empty())
+        throw std::invalid_argument("no worker counts in '" + spec + "'");
+    return out;
+}
+
+typedef void (*DrainFn)();
+
+void run(const Options& o, unsigned workers)
+{
+    char n[16];
+    snprintf(n, sizeof(n), "%u", workers);
+    setenv("LR_WORKERS", n, 1);
+    enshost::set_notify_hook(record_end_to_end);
+    enshost::Plugin plugin(o.path);
+    enshost::EventHandler handler = plugin.event_handler();
+    DrainFn drain = reinterpret_cast<DrainFn>(plugin.symbol("lr_async_drain"));
+    if (workers && !drain)
+        throw std::runtime_error(o.path + ": no lr_async_drain, cannot run asynchronously");
+
+    double hz = lr::calibrate_tsc_hz();
+    uint64_t interval = o.rate > 0 ? uint64_t(hz / o.rate) : 0;
+    std::vector<uint8_t> payload(o.payload);
+    ENSUserData data = {o.payload, payload.data()};
+    std::vector<uint32_t> sqns(o.sessions, 0);
+    lr::Histogram enqueue;
+
+    uint64_t next = lr::rdtsc();
+    uint64_t start = next;
+    for (uint64_t i = 0; i < o.events; ++i) {
+        if (interval) {
+            next += interval;
+            while (lr::rdtsc() < next)
+                ;
+        }
+        uint32_t s = uint32_t(i % o.sessions);
+        uint64_t t0 = lr::rdtsc();
+        memcpy(payload.data(), &t0, sizeof(t0));
+        handler(s + 1, 1, ++sqns[s], &data);
+        enqueue.record(lr::rdtscp() - t0);
+    }
+    if (drain)
+        drain();
+    double secs = double(lr::rdtsc() - start) / hz;
+
+    lr::Histogram e2e;
+    lr::PerThread<EndToEnd>::for_each([&](const EndToEnd& e) { e2e.merge(e.cycles); });
+    printf("LR_WORKERS=%u: %.2f Mevents/s\n", workers, double(o.events) / secs / 1e6);
+    enshost::print_latency(stdout, "  enqueue", enqueue, hz);
+    enshost::print_latency(stdout, "  end to end", e2e, hz);
+    fflush(stdout);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    Options o;
+    try {
+        enshost::ArgReader args(argc, argv);
+        while (!args.done()) {
+            std::string a = args.next();
+            if (a == "--workers")
+                o.workers = parse_workers(args.value(a));
+            else if (a == "--events")
+                o.events = args.u64(a);
+            else if (a == "--sessions")
+                o.sessions = uint32_t(args.u64(a));
+            else if (a == "--payload")
+                o.payload = uint32_t(args.u64(a));
+            else if (a == "--rate")
+                o.rate = args.real(a);
+            else if (!a.empty() && a[0] == '-')
+                throw std::invalid_argument("unknown option " + a);
+            else
+                o.path = a;
+        }
+        if (o.path.empty() || o.events == 0 || o.sessions == 0 || o.payload < 8)
+            throw std::invalid_argument("need a plugin, --events and --sessions > 0, --payload >= 8");
+    } catch (const std::exception& e) {
+        fprintf(stderr, "async_latency: %s\n"
+                        "usage: async_latency [--workers N,N,...] [--events N] [--sessions N] [--payload BYTES] "
+                        "[--rate EVENTS/S] PLUGIN.so\n", e.what());
+        return 2;
+    }
+
+    int status = 0;
+    for (unsigned workers : o.workers) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("async_latency: fork");
+            return 1;
+        }
+        if (pid == 0) {
+            try {
+                run(o, workers);
+            } catch (const std::exception& e) {
+                fprintf(stderr, "async_latency: %s\n", e.what());
+                _exit(1);
+            }
+            _exit(0);
+        }
+        int child = 0;
+        waitpid(pid, &child, 0);
+        if (!WIFEXITED(child) || WEXITSTATUS(child) != 0)
+            status = 1;
+    }
+    return status;
+}
@@ -0,0 +1,120 @@
+// batch_sizes: per-event cost of event_handler_batch at batch sizes 1-256
+// against one event_handler call per event.
+//
+// Events are generated a block at a time outside the timed region, so
+// only the hand-over to the plugin and its notifications are measured.
+// Run once as is and once with --no-batch-notify to separate the saving
+// on the call into the plugin from the saving on the notify side.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "cli.h"
+#include "ens_runtime.h"
+#include "event_stream.h"
+#include "plugin.h"
+#include "tsc.h"
+
+namespace {
+
+const uint32_t kBlock = 4096;
+
+// Cycles per event handing `events` events to the plugin in batches of
+// `size`, or one event_handler call each when size is 0.
+double cycles_per_event(const enshost::Plugin& plugin, enshost::BatchHandler batch, enshost::EventStream& stream,
+                        uint64_t events, uint32_t size)
+{
+    enshost::EventHandler handler = plugin.event_handler();
+    std::vector<LREvent> block(kBlock);
+    uint64_t cycles = 0;
+    for (uint64_t done = 0; done < events; done += kBlock) {
+        stream.next_batch(block.data(), kBlock);
+        uint64_t t0 = lr::rdtsc();
+        if (size == 0) {
+            for (const LREvent& e : block)
+                handler(e.session_id, e.event_type, e.sqn, e.data);
+        } else {
+            for (uint32_t i = 0; i < kBlock; i += size)
+                batch(&block[i], size);
+        }
+        cycles += lr::rdtsc() - t0;
+    }
+    return double(cycles) / double((events + kBlock - 1) / kBlock * kBlock);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t events = 4000000;
+    unsigned rounds = 5;
+    std::string path;
+    enshost::StreamSpec spec;
+    try {
+        enshost::ArgReader args(argc, argv);
+        while (!args.done()) {
+            std::string a = args.next();
+            if (a == "--events")
+                events = args.u64(a);
+            else if (a == "--rounds")
+                rounds = unsigned(args.u64(a));
+            else if (a == "--payload")
+                enshost::parse_payload_sizes(args.value(a), spec);
+            else if (a == "--no-batch-notify")
+                setenv("LR_BATCH_NOTIFY", "0", 1);
+            else if (!a.empty() && a[0] == '-')
+                throw std::invalid_argument("unknown option " + a);
+            else
+                path = a;
+        }
+        if (path.empty() || rounds == 0 || events == 0)
+            throw std::invalid_argument("need a plugin, --rounds and --events > 0");
+    } catch (const std::exception& e) {
+        fprintf(stderr, "batch_sizes: %s\n"
+                        "usage: batch_sizes [--events N] [--rounds N] [--payload SPEC] [--no-batch-notify] "
+                        "PLUGIN.so\n", e.what());
+        return 2;
+    }
+
+    try {
+        enshost::Plugin plugin(path);
+        enshost::BatchHandler batch = plugin.batch_handler();
+        if (!batch)
+            throw std::runtime_error(path + ": no event_handler_batch");
+        double ns = 1e9 / lr::calibrate_tsc_hz();
+        enshost::EventStream stream(spec);
+
+        std::vector<uint32_t> sizes;
+        for (uint32_t s = 1; s <= 256; s *= 2)
+            sizes.push_back(s);
+
+        cycles_per_event(plugin, batch, stream, events, 0);
+        double single = 1e300;
+        std::vector<double> batched(sizes.size(), 1e300);
+        for (unsigned r = 0; r < rounds; ++r) {
+            single = std::min(single, cycles_per_event(plugin, batch, stream, events, 0) * ns);
+            for (size_t i = 0; i < sizes.size(); ++i)
+                batched[i] = std::min(batched[i], cycles_per_event(plugin, batch, stream, events, sizes[i]) * ns);
+        }
+
+        enshost::NotifyCounters notify = enshost::notify_totals();
+        printf("plugin: %s  batched notify: %s\n", path.c_str(), notify.batches ? "yes" : "no");
+        printf("%-22s %10s %10s\n", "best of rounds", "ns/event", "vs single");
+        printf("%-22s %10.2f %9.1f%%\n", "event_handler", single, 0.0);
+        for (size_t i = 0; i < sizes.size(); ++i) {
+            char label[32];
+            snprintf(label, sizeof(label), "batch %u", sizes[i]);
+            printf("%-22s %10.2f %9.1f%%\n", label, batched[i], (batched[i] - single) / single * 100.0);
+        }
+    } catch (const std::exception& e) {
+        fprintf(stderr, "batch_sizes: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,118 @@
+// buffer_pool: cost of getting a response buffer from lr::BufferPool
+// against malloc/free, at payload sizes from 64 B to 64 KiB.
+//
+// Each operation frees the oldest of --live outstanding buffers, takes a
+// new one and writes to every page of it, as building a response would.
+// Operations are timed one by one, TSC reads included, so the tails show
+// the allocator's slow paths: heap growth and trimming, and page faults
+// on memory it has just handed back to the kernel.
+
+#include <stdio.h>
+#include <string.h>
+
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "buffer_pool.h"
+#include "cli.h"
+#include "histogram.h"
+#include "tsc.h"
+
+namespace {
+
+struct Options {
+    uint64_t ops = 200000;
+    uint32_t live = 32;
+    uint32_t pool_buffers = 64;
+    bool fill = false;
+};
+
+void touch(void* p, uint32_t size, bool fill)
+{
+    uint8_t* b = static_cast<uint8_t*>(p);
+    if (fill) {
+        memset(b, 0xa5, size);
+        return;
+    }
+    for (uint8_t* page = b; page < b + size; page += 4096)
+        *page = 1;
+}
+
+template <typename Alloc, typename Release>
+lr::Histogram measure(const Options& o, uint32_t size, Alloc alloc, Release release)
+{
+    std::vector<void*> window(o.live);
+    for (void*& p : window) {
+        p = alloc(size);
+        touch(p, size, o.fill);
+    }
+    lr::Histogram h;
+    for (uint64_t i = 0; i < o.ops; ++i) {
+        void*& slot = window[i % o.live];
+        uint64_t t0 = lr::rdtsc();
+        release(slot);
+        slot = alloc(size);
+        touch(slot, size, o.fill);
+        h.record(lr::rdtscp() - t0);
+    }
+    for (void* p : window)
+        release(p);
+    return h;
+}
+
+void print_row(const char* label, uint32_t size, const lr::Histogram& h, double ns)
+{
+    printf("%-8s %8u %9.1f %9.1f %9.1f %10.1f %11.1f\n", label, size, h.mean() * ns, double(h.percentile(50)) * ns,
+           double(h.percentile(99)) * ns, double(h.percentile(99.9)) * ns, double(h.max()) * ns);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    Options o;
+    try {
+        enshost::ArgReader args(argc, argv);
+        while (!args.done()) {
+            std::string a = args.next();
+            if (a == "--ops")
+                o.ops = args.u64(a);
+            else if (a == "--live")
+                o.live = uint32_t(args.u64(a));
+            else if (a == "--pool-buffers")
+                o.pool_buffers = uint32_t(args.u64(a));
+            else if (a == "--fill")
+                o.fill = true;
+            else
+                throw std::invalid_argument("unknown option " + a);
+        }
+        if (o.ops == 0 || o.live == 0)
+            throw std::invalid_argument("--ops and --live must be > 0");
+    } catch (const std::exception& e) {
+        fprintf(stderr, "buffer_pool: %s\n"
+                        "usage: buffer_pool [--ops N] [--live N] [--pool-buffers N] [--fill]\n", e.what());
+        return 2;
+    }
+
+    double ns = 1e9 / lr::calibrate_tsc_hz();
+    lr::BufferPool pool(o.pool_buffers);
+    printf("%u outstanding buffers, %s, %u pool buffers per class (%llu KiB)\n", o.live,
+           o.fill ? "filled" : "one write per page", o.pool_buffers,
+           (unsigned long long)(pool.reserved_bytes() >> 10));
+    printf("%-8s %8s %9s %9s %9s %10s %11s\n", "", "bytes", "mean ns", "p50 ns", "p99 ns", "p99.9 ns", "max ns");
+    for (uint32_t size = 64; size <= lr::BufferPool::kMaxSize; size *= 4) {
+        lr::Histogram m = measure(o, size, [](uint32_t n) { return malloc(n); }, [](void* p) { free(p); });
+        lr::Histogram p = measure(o, size, [&](uint32_t n) { return pool.alloc(n); },
+                                  [&](void* b) { pool.release(b); });
+        print_row("malloc", size, m, ns);
+        print_row("pool", size, p, ns);
+    }
+    lr::BufferPool::Stats s = pool.stats();
+    uint64_t overflows = 0;
+    for (unsigned i = 0; i < lr::BufferPool::kClasses; ++i)
+        overflows += s.overflows[i];
+    printf("pool overflows: %llu\n", (unsigned long long)overflows);
+    return 0;
+}
@@ -0,0 +1,132 @@
+// clock_probe: how closely the plugin's clock probe answers track
+// CLOCK_REALTIME, second by second.
+//
+// Sends LR_EVENT_CLOCK_PROBE events every --interval-us for --seconds,
+// with t1 read just before event_handler and t4 in the notify hook, both
+// from CLOCK_REALTIME.  Host and plugin share that clock, so the true
+// offset is zero and the offset a client would compute is the plugin's
+// error, half the asymmetry of the call included.  The first second
+// runs on the rate measured at load alone; after it the plugin resyncs
+// once a second, which the syncs column and the last resync's offset
+// show.
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "cli.h"
+#include "ens_runtime.h"
+#include "latencyresponder.h"
+#include "plugin.h"
+#include "tsc.h"
+
+namespace {
+
+typedef int (*ClockStatsFn)(LRClockStats*);
+
+uint64_t g_t4 = 0;
+LRClockProbe g_answer;
+
+void on_notify(uint32_t, uint32_t, ENSUserData* data)
+{
+    g_t4 = lr::realtime_ns();
+    if (data && data->length >= sizeof(g_answer))
+        memcpy(&g_answer, data->p, sizeof(g_answer));
+}
+
+void sleep_until(uint64_t deadline)
+{
+    timespec ts;
+    ts.tv_sec = time_t(deadline / 1000000000);
+    ts.tv_nsec = long(deadline % 1000000000);
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    unsigned seconds = 10;
+    uint64_t interval_us = 1000;
+    std::string path;
+    try {
+        enshost::ArgReader args(argc, argv);
+        while (!args.done()) {
+            std::string a = args.next();
+            if (a == "--seconds")
+                seconds = unsigned(args.u64(a));
+            else if (a == "--interval-us")
+                interval_us = args.u64(a);
+            else if (!a.empty() && a[0] == '-')
+                throw std::invalid_argument("unknown option " + a);
+            else
+                path = a;
+        }
+        if (path.empty() || seconds == 0 || interval_us == 0)
+            throw std::invalid_argument("need a plugin, --seconds and --interval-us > 0");
+    } catch (const std::exception& e) {
+        fprintf(stderr, "clock_probe: %s\n"
+                        "usage: clock_probe [--seconds N] [--interval-us N] PLUGIN.so\n", e.what());
+        return 2;
+    }
+
+    try {
+        enshost::set_notify_hook(on_notify);
+        enshost::Plugin plugin(path);
+        ClockStatsFn clock_stats = reinterpret_cast<ClockStatsFn>(plugin.symbol("lr_clock_stats"));
+        if (!clock_stats)
+            throw std::runtime_error(path + ": no lr_clock_stats");
+        LRClockStats cs;
+        if (clock_stats(&cs) != 0)
+            throw std::runtime_error(path + ": clock probes are off");
+
+        printf("probe every %llu us; offset = plugin minus CLOCK_REALTIME\n", (unsigned long long)interval_us);
+        printf("%4s %7s %10s %10s %10s %10s %6s %12s\n", "sec", "probes", "offset ns", "min", "max", "delay p50",
+               "syncs", "resync ns");
+        std::vector<int64_t> offsets;
+        std::vector<int64_t> delays;
+        uint64_t next = lr::monotonic_ns();
+        for (unsigned sec = 1; sec <= seconds; ++sec) {
+            offsets.clear();
+            delays.clear();
+            uint64_t end = next + 1000000000;
+            for (uint32_t sqn = 0; next < end; ++sqn, next += interval_us * 1000) {
+                sleep_until(next);
+                LRClockProbe probe = {LR_CLOCK_PROBE_MAGIC, 0, 0, 0, 0};
+                probe.t1_ns = lr::realtime_ns();
+                ENSUserData data = {sizeof(probe), reinterpret_cast<uint8_t*>(&probe)};
+                g_t4 = 0;
+                plugin.event_handler()(1, LR_EVENT_CLOCK_PROBE, sqn, &data);
+                if (!g_t4)
+                    throw std::runtime_error(path + ": probe not answered");
+                int64_t t1 = int64_t(probe.t1_ns), t2 = int64_t(g_answer.t2_ns);
+                int64_t t3 = int64_t(g_answer.t3_ns), t4 = int64_t(g_t4);
+                offsets.push_back(((t2 - t1) + (t3 - t4)) / 2);
+                delays.push_back((t4 - t1) - (t3 - t2));
+            }
+            clock_stats(&cs);
+            double mean = 0;
+            for (int64_t o : offsets)
+                mean += double(o);
+            mean /= double(offsets.size());
+            std::sort(offsets.begin(), offsets.end());
+            std::sort(delays.begin(), delays.end());
+            printf("%4u %7zu %10.1f %10lld %10lld %10lld %6llu %12lld\n", sec, offsets.size(), mean,
+                   (long long)offsets.front(), (long long)offsets.back(), (long long)delays[delays.size() / 2],
+                   (unsigned long long)cs.syncs, (long long)cs.last_offset_ns);
+            fflush(stdout);
+        }
+        printf("tsc %.6f GHz, %llu steps, %llu bad probes\n", cs.tsc_hz / 1e9, (unsigned long long)cs.steps,
+               (unsigned long long)cs.bad);
+    } catch (const std::exception& e) {
+        fprintf(stderr, "clock_probe: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,105 @@
+// gather_notify: per-event cost of stamped responses by payload size,
+// sent as two segments through ENSSessionNotifyVec or copied into one
+// buffer.
+//
+// The plugin is loaded with LR_STAMP=1 and fed data events whose
+// payloads leave no room for the trailer, so every response is extended.
+// Run once as is and once with --no-gather, which sets
+// LR_GATHER_NOTIFY=0, to see what the copy costs at each size.  This
+// host's notify only counts bytes, so the difference is all plugin side.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "cli.h"
+#include "ens_runtime.h"
+#include "latencyresponder.h"
+#include "plugin.h"
+#include "tsc.h"
+
+namespace {
+
+typedef int (*StampStatsFn)(LRStampStats*);
+
+// Cycles per data event with `size`-byte payloads, spread over 1024
+// sessions.
+double cycles_per_event(enshost::EventHandler handler, std::vector<uint8_t>& payload, uint32_t size, uint64_t events)
+{
+    ENSUserData data = {size, payload.data()};
+    uint64_t t0 = lr::rdtsc();
+    for (uint64_t i = 0; i < events; ++i)
+        handler(uint32_t(i & 1023) + 1, LR_EVENT_DATA, uint32_t(i >> 10), &data);
+    return double(lr::rdtsc() - t0) / double(events);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t events = 200000;
+    unsigned rounds = 5;
+    std::string path;
+    try {
+        enshost::ArgReader args(argc, argv);
+        while (!args.done()) {
+            std::string a = args.next();
+            if (a == "--events")
+                events = args.u64(a);
+            else if (a == "--rounds")
+                rounds = unsigned(args.u64(a));
+            else if (a == "--no-gather")
+                setenv("LR_GATHER_NOTIFY", "0", 1);
+            else if (!a.empty() && a[0] == '-')
+                throw std::invalid_argument("unknown option " + a);
+            else
+                path = a;
+        }
+        if (path.empty() || rounds == 0 || events == 0)
+            throw std::invalid_argument("need a plugin, --rounds and --events > 0");
+    } catch (const std::exception& e) {
+        fprintf(stderr, "gather_notify: %s\n"
+                        "usage: gather_notify [--events N] [--rounds N] [--no-gather] PLUGIN.so\n", e.what());
+        return 2;
+    }
+
+    try {
+        setenv("LR_STAMP", "1", 1);
+        enshost::Plugin plugin(path);
+        StampStatsFn stamp_stats = reinterpret_cast<StampStatsFn>(plugin.symbol("lr_stamp_stats"));
+        if (!stamp_stats)
+            throw std::runtime_error(path + ": no lr_stamp_stats");
+        double ns = 1e9 / lr::calibrate_tsc_hz();
+
+        // Up to the largest payload the copying path still stamps.
+        std::vector<uint32_t> sizes = {64, 256, 1024, 4096, 16384, 65536 - uint32_t(sizeof(LRStampTrailer))};
+        std::vector<uint8_t> payload(sizes.back());
+        for (size_t i = 0; i < payload.size(); ++i)
+            payload[i] = uint8_t(i);
+
+        std::vector<double> best(sizes.size(), 1e300);
+        for (size_t i = 0; i < sizes.size(); ++i)
+            cycles_per_event(plugin.event_handler(), payload, sizes[i], events / 4 + 1);
+        for (unsigned r = 0; r < rounds; ++r)
+            for (size_t i = 0; i < sizes.size(); ++i)
+                best[i] = std::min(best[i], cycles_per_event(plugin.event_handler(), payload, sizes[i], events) * ns);
+
+        LRStampStats st;
+        if (stamp_stats(&st) != 0)
+            throw std::runtime_error(path + ": stamping is off");
+        printf("plugin: %s  stamped: gathered=%llu copied=%llu skipped=%llu\n", path.c_str(),
+               (unsigned long long)st.gathered, (unsigned long long)st.copied, (unsigned long long)st.skipped);
+        printf("%-10s %12s %12s\n", "payload", "ns/event", "GB/s");
+        for (size_t i = 0; i < sizes.size(); ++i)
+            printf("%-10u %12.1f %12.2f\n", sizes[i], best[i], double(sizes[i]) / best[i]);
+    } catch (const std::exception& e) {
+        fprintf(stderr, "gather_notify: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
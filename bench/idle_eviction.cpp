@@ -0,0 +1,167 @@
+// idle_eviction: per-event cost of session tracking with idle expiry
+// while sessions keep coming and going.
+//
+// A fixed number of live sessions gets events in random order; with
+// probability --churn an event instead goes to a brand new session that
+// replaces a random live one, which falls silent and has to be expired.
+// Time is simulated: every event moves a TSC-based clock on by one
+// interval at --rate events per second, so a run covers --seconds of
+// traffic whatever the machine's speed, and eviction runs from the event
+// path exactly as in the plugin.  Each event is timed with the real TSC
+// around the table lookup, the stamp and the wheel poll.
+//
+// Every window of simulated time prints the cost per event, the live
+// sessions and the slots in use, tombstones and retired slots included;
+// the last line sums up the whole run.  With eviction all of them should
+// stay flat, tails too; with --no-evict the table fills with dead
+// sessions until inserts fail.
+
+#include <stdio.h>
+
+#include <exception>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "cli.h"
+#include "histogram.h"
+#include "idle_evictor.h"
+#include "session.h"
+#include "session_table.h"
+#include "tsc.h"
+
+namespace {
+
+typedef lr::SessionTable<lr::SessionState> Sessions;
+
+struct Options {
+    uint32_t live = 1u << 20;
+    uint32_t table = 1u << 21;
+    uint64_t rate = 10000000;
+    double churn = 0.01;
+    uint64_t timeout_ms = 1000;
+    double seconds = 30;
+    double window = 0.5;
+    bool evict = true;
+};
+
+uint64_t xorshift(uint64_t& s)
+{
+    s ^= s << 13;
+    s ^= s >> 7;
+    s ^= s << 17;
+    return s;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    Options o;
+    try {
+        enshost::ArgReader args(argc, argv);
+        while (!args.done()) {
+            std::string a = args.next();
+            if (a == "--live")
+                o.live = uint32_t(args.u64(a));
+            else if (a == "--table")
+                o.table = uint32_t(args.u64(a));
+            else if (a == "--rate")
+                o.rate = args.u64(a);
+            else if (a == "--churn")
+                o.churn = args.real(a);
+            else if (a == "--timeout-ms")
+                o.timeout_ms = args.u64(a);
+            else if (a == "--seconds")
+                o.seconds = args.real(a);
+            else if (a == "--window")
+                o.window = args.real(a);
+            else if (a == "--no-evict")
+                o.evict = false;
+            else
+                throw std::invalid_argument("unknown option " + a);
+        }
+        if (o.live == 0 || o.table < o.live || o.rate == 0 || o.churn < 0 || o.churn > 1 || o.timeout_ms == 0 ||
+            o.seconds <= 0 || o.window <= 0)
+            throw std::invalid_argument("need --live > 0, --table >= --live, --rate > 0, --churn in [0, 1], "
+                                        "--timeout-ms > 0, --seconds and --window > 0");
+    } catch (const std::exception& e) {
+        fprintf(stderr, "idle_eviction: %s\n"
+                        "usage: idle_eviction [--live N] [--table N] [--rate EVENTS/S] [--churn P] "
+                        "[--timeout-ms MS] [--seconds S] [--window S] [--no-evict]\n", e.what());
+        return 2;
+    }
+
+    double hz = lr::calibrate_tsc_hz();
+    double ns = 1e9 / hz;
+    Sessions table(o.table);
+    if (!table.ok()) {
+        fprintf(stderr, "idle_eviction: cannot map a table for %u sessions\n", o.table);
+        return 1;
+    }
+    std::unique_ptr<lr::IdleEvictor> idle;
+    if (o.evict) {
+        idle.reset(new lr::IdleEvictor(table, o.timeout_ms, hz, false, true));
+        if (!idle->ok()) {
+            fprintf(stderr, "idle_eviction: cannot map the timing wheel\n");
+            return 1;
+        }
+    }
+
+    std::vector<uint32_t> live(o.live);
+    uint32_t next_id = 1;
+    for (uint32_t& id : live)
+        id = next_id++;
+    uint64_t step = uint64_t(hz / double(o.rate));
+    if (step == 0)
+        step = 1;
+    uint64_t churn = uint64_t(o.churn * 18446744073709551615.0);
+    uint64_t per_window = uint64_t(o.window * double(o.rate));
+    uint64_t windows = uint64_t(o.seconds / o.window + 0.5);
+    uint64_t rng = 88172645463325252ull;
+    uint64_t clock = lr::rdtsc();
+    uint64_t full = 0;
+
+    printf("%u live sessions, table for %u, %.0f events/s simulated, churn %g, timeout %llu ms%s\n", o.live,
+           o.table, double(o.rate), o.churn, (unsigned long long)o.timeout_ms, o.evict ? "" : ", no eviction");
+    printf("%8s %10s %10s %10s %10s %9s %9s %9s %9s %10s\n", "time s", "in table", "slots", "evicted", "full",
+           "mean ns", "p50", "p99", "p99.9", "max");
+    lr::Histogram total;
+    for (uint64_t w = 0; w < windows; ++w) {
+        lr::Histogram cost;
+        for (uint64_t i = 0; i < per_window; ++i) {
+            clock += step;
+            uint32_t pick = uint32_t(xorshift(rng) % o.live);
+            if (xorshift(rng) < churn)
+                live[pick] = next_id++;
+            uint32_t id = live[pick];
+            uint64_t t0 = lr::rdtsc();
+            bool inserted = false;
+            lr::SessionState* s = table.find_or_insert(id, &inserted);
+            if (s) {
+                ++s->events;
+                if (idle) {
+                    s->last_seen = idle->now();
+                    if (inserted)
+                        idle->arm(s);
+                }
+            } else {
+                ++full;
+            }
+            if (idle)
+                idle->poll(clock);
+            cost.record(lr::rdtscp() - t0);
+        }
+        uint64_t evicted = idle ? idle->stats().evicted : 0;
+        printf("%8.1f %10llu %10llu %10llu %10llu %9.1f %9.1f %9.1f %9.1f %10.1f\n", double(w + 1) * o.window,
+               (unsigned long long)table.size(), (unsigned long long)table.occupied(), (unsigned long long)evicted,
+               (unsigned long long)full, cost.mean() * ns, double(cost.percentile(50)) * ns,
+               double(cost.percentile(99)) * ns, double(cost.percentile(99.9)) * ns, double(cost.max()) * ns);
+        fflush(stdout);
+        total.merge(cost);
+    }
+    printf("%8s %54.1f %9.1f %9.1f %9.1f %10.1f\n", "all", total.mean() * ns, double(total.percentile(50)) * ns,
+           double(total.percentile(99)) * ns, double(total.percentile(99.9)) * ns, double(total.max()) * ns);
+    return 0;
+}
@@ -0,0 +1,111 @@
+// jitter: accuracy and cost of the LR_JITTER estimate.
+//
+// Feeds lr::JitterTracker synthetic arrivals: a sender on a steady
+// --interval-us clock whose events each pick up uniform delay noise of
+// up to +-U, with --loss of them lost.  For that noise the difference of
+// two arrivals' noise is triangular on [-2U, 2U], so RFC 3550's J should
+// settle at E|D| = 2U/3 whatever the loss.  Each U is averaged over
+// --sessions sessions updated round robin, which also gives the cost of
+// an update once the sessions outgrow the caches.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "cli.h"
+#include "jitter_tracker.h"
+#include "tsc.h"
+
+namespace {
+
+uint64_t xorshift(uint64_t& s)
+{
+    s ^= s << 13;
+    s ^= s >> 7;
+    s ^= s << 17;
+    return s;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t sessions = 100000;
+    uint64_t events = 200;
+    double interval_us = 1000;
+    double loss = 0.01;
+    try {
+        enshost::ArgReader args(argc, argv);
+        while (!args.done()) {
+            std::string a = args.next();
+            if (a == "--sessions")
+                sessions = args.u64(a);
+            else if (a == "--events")
+                events = args.u64(a);
+            else if (a == "--interval-us")
+                interval_us = args.real(a);
+            else if (a == "--loss")
+                loss = args.real(a);
+            else
+                throw std::invalid_argument("unknown option " + a);
+        }
+        if (sessions == 0 || events < 2 || interval_us <= 0 || loss < 0 || loss >= 1)
+            throw std::invalid_argument("need --sessions > 0, --events > 1, --interval-us > 0, --loss in [0, 1)");
+    } catch (const std::exception& e) {
+        fprintf(stderr, "jitter: %s\n"
+                        "usage: jitter [--sessions N] [--events N] [--interval-us US] [--loss P]\n", e.what());
+        return 2;
+    }
+
+    double hz = lr::calibrate_tsc_hz();
+    double ns = 1e9 / hz;
+    uint64_t interval = uint64_t(interval_us * hz / 1e6);
+    uint64_t lose_below = uint64_t(loss * 18446744073709551615.0);
+    lr::JitterTracker tracker(sessions, true);
+    if (!tracker.ok()) {
+        fprintf(stderr, "jitter: cannot map %llu sessions\n", (unsigned long long)sessions);
+        return 1;
+    }
+    std::vector<uint32_t> last_sqn(sessions);
+
+    printf("%llu sessions, %llu events each, %.0f us spacing, %.1f%% lost\n", (unsigned long long)sessions,
+           (unsigned long long)events, interval_us, loss * 100.0);
+    printf("%10s %12s %12s %8s %12s\n", "noise us", "expected ns", "mean J ns", "error", "update ns");
+    const double noise_us[] = {0, 1, 10, 100, 250};
+    for (double u : noise_us) {
+        uint64_t noise = uint64_t(u * hz / 1e6);
+        uint64_t rng = 88172645463325252ull;
+        uint64_t base = lr::rdtsc();
+        uint64_t cycles = 0;
+        uint64_t updates = 0;
+        for (uint64_t e = 0; e < events; ++e) {
+            uint64_t sent = base + e * interval;
+            uint64_t t0 = lr::rdtsc();
+            for (uint64_t s = 0; s < sessions; ++s) {
+                if (e > 0 && xorshift(rng) < lose_below)
+                    continue;
+                uint64_t now = sent + (noise ? xorshift(rng) % (2 * noise + 1) : 0);
+                if (e == 0)
+                    tracker.start(s, now);
+                else
+                    tracker.update(s, now, uint32_t(e) - last_sqn[s]);
+                last_sqn[s] = uint32_t(e);
+                ++updates;
+            }
+            cycles += lr::rdtsc() - t0;
+        }
+        double sum = 0;
+        for (uint64_t s = 0; s < sessions; ++s)
+            sum += double(lr::JitterTracker::jitter(tracker.entry(s)));
+        double expected = 2.0 * u * 1000.0 / 3.0;
+        double mean = sum / double(sessions) * ns;
+        printf("%10.0f %12.0f %12.0f %7.1f%% %12.1f\n", u, expected, mean,
+               expected > 0 ? 100.0 * (mean - expected) / expected : 0.0, double(cycles) * ns / double(updates));
+        fflush(stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,195 @@
+// kv_store: memory and lookup latency of the LR_KV store by key count.
+//
+// For each key count the store is sized for exactly that many keys and
+// filled with 16-byte keys and --value byte values.  Then --lookups GETs
+// of random present keys are timed one by one, each including the hash,
+// the epoch guard and the copy of the value out.  With --put P that
+// share of the timed operations are PUTs that replace a value, which
+// retires the old node through the epoch.  With --writers N, N more
+// threads keep replacing values while the lookups run.
+//
+// Memory is what the store accounts for (bucket array, nodes at their
+// malloc usable size, retired nodes not yet freed) next to the growth of
+// the process's resident set while filling.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <exception>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cli.h"
+#include "epoch.h"
+#include "histogram.h"
+#include "kv_store.h"
+#include "tsc.h"
+
+namespace {
+
+const uint32_t kKeyLength = 16;
+
+struct Options {
+    std::vector<uint64_t> keys = {1000, 10000, 100000, 1000000, 10000000};
+    uint32_t value = 64;
+    uint64_t lookups = 2000000;
+    double put = 0;
+    unsigned writers = 0;
+};
+
+uint64_t xorshift(uint64_t& s)
+{
+    s ^= s << 13;
+    s ^= s >> 7;
+    s ^= s << 17;
+    return s;
+}
+
+// "key:" and 12 hex digits, as enshost --kv sends them.
+void make_key(uint64_t i, uint8_t* key)
+{
+    static const char kHex[] = "0123456789abcdef";
+    memcpy(key, "key:", 4);
+    for (uint32_t j = kKeyLength; j > 4; --j, i >>= 4)
+        key[j - 1] = uint8_t(kHex[i & 15]);
+}
+
+uint64_t resident_bytes()
+{
+    FILE* f = fopen("/proc/self/statm", "r");
+    unsigned long size = 0, resident = 0;
+    if (f) {
+        if (fscanf(f, "%lu %lu", &size, &resident) != 2)
+            resident = 0;
+        fclose(f);
+    }
+    return uint64_t(resident) * uint64_t(sysconf(_SC_PAGESIZE));
+}
+
+std::vector<uint64_t> parse_list(const std::string& s)
+{
+    std::vector<uint64_t> v;
+    std::istringstream in(s);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        char* end = nullptr;
+        unsigned long long n = strtoull(item.c_str(), &end, 10);
+        if (item.empty() || *end != '\0' || n == 0)
+            throw std::invalid_argument("bad key count '" + item + "'");
+        v.push_back(n);
+    }
+    if (v.empty())
+        throw std::invalid_argument("no key counts");
+    return v;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    Options o;
+    try {
+        enshost::ArgReader args(argc, argv);
+        while (!args.done()) {
+            std::string a = args.next();
+            if (a == "--keys")
+                o.keys = parse_list(args.value(a));
+            else if (a == "--value")
+                o.value = uint32_t(args.u64(a));
+            else if (a == "--lookups")
+                o.lookups = args.u64(a);
+            else if (a == "--put")
+                o.put = args.real(a);
+            else if (a == "--writers")
+                o.writers = unsigned(args.u64(a));
+            else
+                throw std::invalid_argument("unknown option " + a);
+        }
+        if (o.lookups == 0 || o.put < 0 || o.put > 1)
+            throw std::invalid_argument("need --lookups > 0 and --put in [0, 1]");
+    } catch (const std::exception& e) {
+        fprintf(stderr, "kv_store: %s\n"
+                        "usage: kv_store [--keys N,N,...] [--value BYTES] [--lookups N] [--put P] "
+                        "[--writers N]\n", e.what());
+        return 2;
+    }
+
+    double ns = 1e9 / lr::calibrate_tsc_hz();
+    std::vector<uint8_t> value(o.value, 0x5a);
+    uint64_t put_below = uint64_t(o.put * 18446744073709551615.0);
+    printf("%u-byte keys, %u-byte values, %llu timed operations, %.0f%% puts, %u writer threads\n", kKeyLength,
+           o.value, (unsigned long long)o.lookups, o.put * 100.0, o.writers);
+    printf("%10s %9s %9s %9s %8s %9s %8s %8s %8s %8s %9s\n", "keys", "table MiB", "nodes MiB", "RSS MiB", "B/key",
+           "fill ns", "op ns", "p50", "p99", "p99.9", "pend KiB");
+    for (uint64_t keys : o.keys) {
+        uint64_t rss0 = resident_bytes();
+        std::unique_ptr<lr::KvStore> store(new lr::KvStore(keys, true));
+        if (!store->ok()) {
+            fprintf(stderr, "kv_store: cannot map a store for %llu keys\n", (unsigned long long)keys);
+            return 1;
+        }
+        uint8_t key[kKeyLength];
+        uint64_t t0 = lr::rdtsc();
+        for (uint64_t i = 0; i < keys; ++i) {
+            make_key(i, key);
+            if (store->put(key, kKeyLength, value.data(), o.value) != lr::KvStore::kOk) {
+                fprintf(stderr, "kv_store: cannot fill %llu keys\n", (unsigned long long)keys);
+                return 1;
+            }
+        }
+        double fill = double(lr::rdtsc() - t0) * ns / double(keys);
+        uint64_t rss = resident_bytes() - rss0;
+
+        std::atomic<bool> stop(false);
+        std::vector<std::thread> writers;
+        for (unsigned w = 0; w < o.writers; ++w) {
+            writers.emplace_back([&, w] {
+                uint64_t rng = 0x2545f4914f6cdd1dull + w;
+                uint8_t k[kKeyLength];
+                while (!stop.load(std::memory_order_relaxed)) {
+                    make_key(xorshift(rng) % keys, k);
+                    store->put(k, kKeyLength, value.data(), o.value);
+                }
+            });
+        }
+
+        lr::Histogram cost;
+        std::vector<uint8_t> out(o.value);
+        uint64_t rng = 88172645463325252ull;
+        uint64_t missing = 0;
+        for (uint64_t i = 0; i < o.lookups; ++i) {
+            make_key(xorshift(rng) % keys, key);
+            bool put = xorshift(rng) < put_below;
+            uint64_t t = lr::rdtsc();
+            if (put) {
+                store->put(key, kKeyLength, value.data(), o.value);
+            } else if (!store->get(key, kKeyLength,
+                                   [&](const uint8_t* v, uint32_t n) { memcpy(out.data(), v, n); })) {
+                ++missing;
+            }
+            cost.record(lr::rdtscp() - t);
+        }
+        stop.store(true);
+        for (std::thread& t : writers)
+            t.join();
+        if (missing) {
+            fprintf(stderr, "kv_store: %llu lookups missed\n", (unsigned long long)missing);
+            return 1;
+        }
+
+        printf("%10llu %9.1f %9.1f %9.1f %8.1f %9.1f %8.1f %8.1f %8.1f %8.1f %9.1f\n", (unsigned long long)keys,
+               double(store->table_bytes()) / 1048576.0, double(store->node_bytes()) / 1048576.0,
+               double(rss) / 1048576.0, double(store->table_bytes() + store->node_bytes()) / double(keys), fill,
+               cost.mean() * ns, double(cost.percentile(50)) * ns, double(cost.percentile(99)) * ns,
+               double(cost.percentile(99.9)) * ns, double(lr::Epoch::stats().pending_bytes) / 1024.0);
+        fflush(stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,192 @@
+// microbench: Google Benchmark suite for the cost of the plugin call path.
+//
+//   Call/direct       event_handler linked into this binary, called
+//                     directly
+//   Call/dlsym        the plugin dlopen()ed, called through its dlsym
+//                     pointer
+//   Binding/now:0|1   the plugin loaded RTLD_LAZY or RTLD_NOW, steady state
+//   FirstCall/now:0|1 dlopen, first event_handler call, dlclose: what lazy
+//                     binding of ENSSessionNotify moves into the first call
+//   EventType/type:N  a data event (notified) against an ignored type and
+//                     an unknown one
+//   Payload/stamp:0|1/bytes:N
+//                     payload sizes echoed as they are, and stamped, which
+//                     copies every payload without a trailer
+//
+// Every variant loads its own copy of the plugin file, so each has its
+// own globals and its own LR_* configuration.  The plugin defaults to the
+// release build; pass another one after the benchmark flags.  JSON for
+// diffing builds: --benchmark_out=FILE --benchmark_out_format=json, or
+// the bench-micro target.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "ens_runtime.h"
+#include "plugin.h"
+
+namespace {
+
+std::string g_plugin = LR_MICROBENCH_PLUGIN;
+
+struct Setting {
+    const char* name;
+    const char* value;
+};
+
+// dlopen() returns the already loaded object for a path it has seen, so
+// every separately loaded plugin needs a file of its own.
+std::string copy_plugin(const char* tag)
+{
+    char path[128];
+    snprintf(path, sizeof(path), "/tmp/lr-microbench.%d.%s.so", int(getpid()), tag);
+    std::ifstream in(g_plugin, std::ios::binary);
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out << in.rdbuf();
+    if (!in || !out)
+        throw std::runtime_error("cannot copy " + g_plugin + " to " + path);
+    return path;
+}
+
+// The stats segment is off so the copies do not fight over its name.
+void set_env(std::vector<Setting> settings, bool set)
+{
+    settings.push_back(Setting{"LR_SHM_INTERVAL_MS", "0"});
+    for (const Setting& s : settings) {
+        if (set)
+            setenv(s.name, s.value, 1);
+        else
+            unsetenv(s.name);
+    }
+}
+
+// Loads a private copy of the plugin with the given LR_* settings.
+std::unique_ptr<enshost::Plugin> load_copy(const char* tag, enshost::Plugin::Binding binding,
+                                           const std::vector<Setting>& settings)
+{
+    std::string path = copy_plugin(tag);
+    set_env(settings, true);
+    std::unique_ptr<enshost::Plugin> p;
+    try {
+        p.reset(new enshost::Plugin(path, binding));
+    } catch (...) {
+        unlink(path.c_str());
+        throw;
+    }
+    set_env(settings, false);
+    unlink(path.c_str());
+    return p;
+}
+
+enshost::Plugin& plugin(const char* tag, enshost::Plugin::Binding binding = enshost::Plugin::kNow,
+                        std::vector<Setting> settings = std::vector<Setting>())
+{
+    // Loaded on first use and kept for the whole run.
+    static std::vector<std::pair<std::string, std::unique_ptr<enshost::Plugin>>> loaded;
+    for (auto& p : loaded)
+        if (p.first == tag)
+            return *p.second;
+    loaded.emplace_back(tag, load_copy(tag, binding, settings));
+    return *loaded.back().second;
+}
+
+// Sessions cycle through 1024 ids, as a runtime with many clients would.
+void drive(benchmark::State& state, enshost::EventHandler handler, uint32_t event_type, uint32_t bytes)
+{
+    std::vector<uint8_t> payload(bytes ? bytes : 1);
+    ENSUserData data = {bytes, payload.data()};
+    uint32_t i = 0;
+    for (auto _ : state) {
+        handler((i & 1023) + 1, event_type, i >> 10, &data);
+        ++i;
+    }
+    state.SetItemsProcessed(int64_t(state.iterations()));
+    state.SetBytesProcessed(int64_t(state.iterations()) * bytes);
+}
+
+void BM_CallDirect(benchmark::State& state)
+{
+    drive(state, event_handler, LR_EVENT_DATA, 64);
+}
+BENCHMARK(BM_CallDirect)->Name("Call/direct");
+
+void BM_CallDlsym(benchmark::State& state)
+{
+    drive(state, plugin("now").event_handler(), LR_EVENT_DATA, 64);
+}
+BENCHMARK(BM_CallDlsym)->Name("Call/dlsym");
+
+void BM_Binding(benchmark::State& state)
+{
+    bool lazy = state.range(0) == 0;
+    enshost::Plugin& p = lazy ? plugin("lazy", enshost::Plugin::kLazy) : plugin("now");
+    drive(state, p.event_handler(), LR_EVENT_DATA, 64);
+}
+BENCHMARK(BM_Binding)->Name("Binding")->ArgName("now")->Arg(0)->Arg(1);
+
+void BM_FirstCall(benchmark::State& state)
+{
+    enshost::Plugin::Binding binding = state.range(0) ? enshost::Plugin::kNow : enshost::Plugin::kLazy;
+    // Nothing big to set up at load, so the load is mostly relocation.
+    std::vector<Setting> light = {{"LR_SESSIONS", "0"}, {"LR_POOL_BUFFERS", "0"}};
+    uint8_t payload[64] = {};
+    ENSUserData data = {sizeof(payload), payload};
+    std::string path = copy_plugin("first");
+    set_env(light, true);
+    for (auto _ : state) {
+        enshost::Plugin p(path, binding);
+        p.event_handler()(1, LR_EVENT_DATA, 1, &data);
+    }
+    set_env(light, false);
+    unlink(path.c_str());
+    state.SetItemsProcessed(int64_t(state.iterations()));
+}
+BENCHMARK(BM_FirstCall)->Name("FirstCall")->ArgName("now")->Arg(0)->Arg(1)->Unit(benchmark::kMicrosecond);
+
+void BM_EventType(benchmark::State& state)
+{
+    drive(state, plugin("now").event_handler(), uint32_t(state.range(0)), 64);
+}
+// Data, keepalive (ignored), unknown.
+BENCHMARK(BM_EventType)->Name("EventType")->ArgName("type")->Arg(LR_EVENT_DATA)->Arg(LR_EVENT_KEEPALIVE)->Arg(99);
+
+void BM_Payload(benchmark::State& state)
+{
+    bool stamp = state.range(0) != 0;
+    enshost::Plugin& p = stamp ? plugin("stamp", enshost::Plugin::kNow, {{"LR_STAMP", "1"}}) : plugin("now");
+    drive(state, p.event_handler(), LR_EVENT_DATA, uint32_t(state.range(1)));
+}
+BENCHMARK(BM_Payload)
+    ->Name("Payload")
+    ->ArgNames({"stamp", "bytes"})
+    ->ArgsProduct({{0, 1}, {0, 64, 512, 1500, 9000, 65536}});
+
+}
+
+int main(int argc, char** argv)
+{
+    benchmark::Initialize(&argc, argv);
+    if (argc > 2) {
+        fprintf(stderr, "usage: microbench [benchmark flags] [PLUGIN.so]\n");
+        return 2;
+    }
+    if (argc == 2)
+        g_plugin = argv[1];
+    try {
+        benchmark::RunSpecifiedBenchmarks();
+    } catch (const std::exception& e) {
+        fprintf(stderr, "microbench: %s\n", e.what());
+        return 1;
+    }
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,112 @@
+// plugin_compare: per-event cost of several latencyresponder.so builds.
+//
+// All plugins are loaded side by side and measured in interleaved rounds
+// so frequency changes and noise hit every build alike.  Each round times
+// a tight loop of event_handler calls for a data event (notify taken) and
+// for an event type the responder ignores; the best and median round are
+// reported, relative to the first plugin on the command line.
+
+#include <stdio.h>
+
+#include <algorithm>
+#include <exception>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "cli.h"
+#include "ens_runtime.h"
+#include "plugin.h"
+#include "tsc.h"
+
+namespace {
+
+struct Samples {
+    std::vector<double> hit;
+    std::vector<double> miss;
+};
+
+double cycles_per_event(enshost::EventHandler handler, uint32_t event_type, uint64_t events)
+{
+    uint8_t payload[64] = {};
+    ENSUserData data = {sizeof(payload), payload};
+    uint64_t t0 = lr::rdtsc();
+    for (uint64_t i = 0; i < events; ++i)
+        handler(uint32_t(i & 1023) + 1, event_type, uint32_t(i), &data);
+    return double(lr::rdtsc() - t0) / double(events);
+}
+
+double median(std::vector<double> v)
+{
+    std::sort(v.begin(), v.end());
+    return v[v.size() / 2];
+}
+
+double best(const std::vector<double>& v)
+{
+    return *std::min_element(v.begin(), v.end());
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    uint64_t events = 20000000;
+    unsigned rounds = 7;
+    std::vector<std::string> paths;
+    try {
+        enshost::ArgReader args(argc, argv);
+        while (!args.done()) {
+            std::string a = args.next();
+            if (a == "--events")
+                events = args.u64(a);
+            else if (a == "--rounds")
+                rounds = unsigned(args.u64(a));
+            else if (!a.empty() && a[0] == '-')
+                throw std::invalid_argument("unknown option " + a);
+            else
+                paths.push_back(a);
+        }
+        if (paths.empty() || rounds == 0 || events == 0)
+            throw std::invalid_argument("need at least one plugin, --rounds and --events > 0");
+    } catch (const std::exception& e) {
+        fprintf(stderr, "plugin_compare: %s\n"
+                        "usage: plugin_compare [--events N] [--rounds N] PLUGIN.so...\n", e.what());
+        return 2;
+    }
+
+    try {
+        std::vector<std::unique_ptr<enshost::Plugin>> plugins;
+        for (const std::string& p : paths)
+            plugins.emplace_back(new enshost::Plugin(p));
+        double ns = 1e9 / lr::calibrate_tsc_hz();
+
+        std::vector<Samples> samples(plugins.size());
+        for (unsigned r = 0; r <= rounds; ++r) {
+            for (size_t i = 0; i < plugins.size(); ++i) {
+                double hit = cycles_per_event(plugins[i]->event_handler(), 1, events);
+                double miss = cycles_per_event(plugins[i]->event_handler(), 2, events);
+                // Round 0 only warms up caches, branch predictors and the PLT.
+                if (r > 0) {
+                    samples[i].hit.push_back(hit * ns);
+                    samples[i].miss.push_back(miss * ns);
+                }
+            }
+        }
+
+        printf("%-60s %10s %10s %10s %10s %9s\n", "ns/event", "hit best", "hit med", "miss best", "miss med",
+               "hit vs #1");
+        double base = median(samples[0].hit);
+        for (size_t i = 0; i < plugins.size(); ++i) {
+            const Samples& s = samples[i];
+            double hit = median(s.hit);
+            printf("%-60s %10.2f %10.2f %10.2f %10.2f %8.1f%%\n", plugins[i]->path().c_str(), best(s.hit), hit,
+                   best(s.miss), median(s.miss), (hit - base) / base * 100.0);
+        }
+        printf("notifies: %llu\n", (unsigned long long)enshost::notify_totals().calls);
+    } catch (const std::exception& e) {
+        fprintf(stderr, "plugin_compare: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,126 @@
+// session_lookup: SessionTable lookup cost as the session count grows.
+//
+// The table is sized the way the plugin sizes it for LR_SESSIONS
+// (--max-sessions, 1M by default) and filled with random session ids;
+// lookups then hit those sessions in random order, so once the live slots
+// outgrow the caches every lookup is a cache (and TLB) miss.  Misses probe for ids that were
+// never inserted.  Insert cost includes first-touch page faults when the
+// table is not prefaulted.
+
+#include <stdio.h>
+
+#include <exception>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "cli.h"
+#include "session.h"
+#include "session_table.h"
+#include "tsc.h"
+
+namespace {
+
+typedef lr::SessionTable<lr::SessionState> Sessions;
+
+double lookup_ns(Sessions& table, const std::vector<uint32_t>& ids, const std::vector<uint32_t>& order, double ns)
+{
+    uint64_t sink = 0;
+    uint64_t t0 = lr::rdtsc();
+    for (uint32_t i : order) {
+        lr::SessionState* s = table.find_or_insert(ids[i]);
+        sink += ++s->events;
+    }
+    uint64_t cycles = lr::rdtsc() - t0;
+    if (sink == 0)
+        puts("");
+    return double(cycles) * ns / double(order.size());
+}
+
+double miss_ns(Sessions& table, const std::vector<uint32_t>& absent, double ns)
+{
+    uint64_t found = 0;
+    uint64_t t0 = lr::rdtsc();
+    for (uint32_t id : absent)
+        found += table.find(id) != nullptr;
+    uint64_t cycles = lr::rdtsc() - t0;
+    if (found)
+        puts("");
+    return double(cycles) * ns / double(absent.size());
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t max_sessions = 1u << 20;
+    uint64_t lookups = 4000000;
+    bool prefault = true;
+    try {
+        enshost::ArgReader args(argc, argv);
+        while (!args.done()) {
+            std::string a = args.next();
+            if (a == "--max-sessions")
+                max_sessions = uint32_t(args.u64(a));
+            else if (a == "--no-prefault")
+                prefault = false;
+            else if (a == "--lookups")
+                lookups = args.u64(a);
+            else
+                throw std::invalid_argument("unknown option " + a);
+        }
+        if (max_sessions == 0 || lookups == 0)
+            throw std::invalid_argument("--max-sessions and --lookups must be > 0");
+    } catch (const std::exception& e) {
+        fprintf(stderr, "session_lookup: %s\nusage: session_lookup [--max-sessions N] [--lookups N] [--no-prefault]\n", e.what());
+        return 2;
+    }
+
+    double ns = 1e9 / lr::calibrate_tsc_hz();
+    std::mt19937 rng(42);
+    std::unordered_set<uint32_t> seen;
+    std::vector<uint32_t> ids;
+    while (ids.size() < 2 * size_t(max_sessions)) {
+        uint32_t id = rng();
+        if (seen.insert(id).second)
+            ids.push_back(id);
+    }
+    // The second half is never inserted and serves as the miss set.
+    std::vector<uint32_t> absent(ids.begin() + max_sessions, ids.end());
+    ids.resize(max_sessions);
+    if (absent.size() > lookups)
+        absent.resize(lookups);
+
+    Sessions table(max_sessions, prefault);
+    if (!table.ok()) {
+        fprintf(stderr, "session_lookup: cannot map a table for %u sessions\n", max_sessions);
+        return 1;
+    }
+    printf("capacity %llu slots, %zu bytes each\n", (unsigned long long)table.capacity(), sizeof(Sessions::Slot));
+    printf("%10s %12s %12s %12s\n", "sessions", "insert ns", "hit ns", "miss ns");
+
+    std::vector<uint32_t> steps;
+    for (uint32_t n = 1024; n < max_sessions; n *= 4)
+        steps.push_back(n);
+    steps.push_back(max_sessions);
+
+    uint32_t inserted = 0;
+    for (uint32_t sessions : steps) {
+        uint32_t before = inserted;
+        uint64_t t0 = lr::rdtsc();
+        for (; inserted < sessions; ++inserted)
+            table.find_or_insert(ids[inserted]);
+        double insert = double(lr::rdtsc() - t0) * ns / double(sessions - before);
+
+        std::uniform_int_distribution<uint32_t> pick(0, sessions - 1);
+        std::vector<uint32_t> order(lookups);
+        for (uint32_t& o : order)
+            o = pick(rng);
+        lookup_ns(table, ids, order, ns);
+        printf("%10u %12.1f %12.1f %12.1f\n", sessions, insert, lookup_ns(table, ids, order, ns),
+               miss_ns(table, absent, ns));
+    }
+    return 0;
+}
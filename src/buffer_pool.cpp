@@ -0,0 +1,154 @@
+#include "buffer_pool.h"
+
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "per_thread.h"
+
+namespace lr {
+
+BufferPool::BufferPool(uint32_t per_class)
+    : base_(nullptr)
+    , bytes_(0)
+{
+    uint64_t bytes = 0;
+    for (unsigned c = 0; c < kClasses; ++c)
+        bytes += uint64_t(per_class) * class_size(c);
+    void* p = bytes ? mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) : MAP_FAILED;
+    if (p != MAP_FAILED) {
+        madvise(p, bytes, MADV_HUGEPAGE);
+        base_ = static_cast<uint8_t*>(p);
+        bytes_ = bytes;
+        // Fault everything in now rather than on the event path.
+        for (uint64_t i = 0; i < bytes; i += 4096)
+            base_[i] = 0;
+    }
+    uint8_t* at = base_;
+    for (unsigned c = 0; c < kClasses; ++c) {
+        begin_[c] = at;
+        if (!base_)
+            continue;
+        depot_[c].free.reserve(per_class);
+        // Hand out low addresses first.
+        for (uint32_t i = per_class; i-- > 0;)
+            depot_[c].free.push_back(at + uint64_t(i) * class_size(c));
+        at += uint64_t(per_class) * class_size(c);
+    }
+    begin_[kClasses] = at;
+}
+
+BufferPool::~BufferPool()
+{
+    if (base_)
+        munmap(base_, bytes_);
+}
+
+BufferPool::Cache& BufferPool::cache()
+{
+    Cache& c = PerThread<Cache>::local();
+    if (__builtin_expect(c.pool != this, 0)) {
+        for (unsigned i = 0; i < kClasses; ++i) {
+            c.head[i] = nullptr;
+            c.count[i] = 0;
+        }
+        c.pool = this;
+    }
+    return c;
+}
+
+void* BufferPool::alloc(uint32_t size)
+{
+    Cache& c = cache();
+    if (size > kMaxSize) {
+        c.oversize.add();
+        return malloc(size);
+    }
+    unsigned cls = size_class(size);
+    c.allocs[cls].add();
+    FreeBuffer* b = c.head[cls];
+    if (__builtin_expect(b != nullptr, 1)) {
+        c.head[cls] = b->next;
+        --c.count[cls];
+        return b;
+    }
+    void* p = refill(c, cls);
+    if (p)
+        return p;
+    c.overflows[cls].add();
+    return malloc(class_size(cls));
+}
+
+void BufferPool::release(void* p)
+{
+    unsigned cls = owner_class(p);
+    if (cls == kClasses) {
+        free(p);
+        return;
+    }
+    Cache& c = cache();
+    FreeBuffer* b = static_cast<FreeBuffer*>(p);
+    b->next = c.head[cls];
+    c.head[cls] = b;
+    if (++c.count[cls] > 2 * kBatch)
+        spill(c, cls);
+}
+
+// Takes up to kBatch buffers from the depot, returns one and keeps the
+// rest on the thread's list, or returns nullptr if the depot is empty.
+void* BufferPool::refill(Cache& c, unsigned cls)
+{
+    Depot& d = depot_[cls];
+    std::lock_guard<std::mutex> guard(d.lock);
+    if (d.free.empty())
+        return nullptr;
+    void* first = d.free.back();
+    d.free.pop_back();
+    for (uint32_t i = 1; i < kBatch && !d.free.empty(); ++i) {
+        FreeBuffer* b = static_cast<FreeBuffer*>(d.free.back());
+        d.free.pop_back();
+        b->next = c.head[cls];
+        c.head[cls] = b;
+        ++c.count[cls];
+    }
+    return first;
+}
+
+void BufferPool::spill(Cache& c, unsigned cls)
+{
+    Depot& d = depot_[cls];
+    std::lock_guard<std::mutex> guard(d.lock);
+    for (uint32_t i = 0; i < kBatch; ++i) {
+        FreeBuffer* b = c.head[cls];
+        c.head[cls] = b->next;
+        d.free.push_back(b);
+    }
+    c.count[cls] -= kBatch;
+}
+
+unsigned BufferPool::owner_class(const void* p) const
+{
+    const uint8_t* b = static_cast<const uint8_t*>(p);
+    if (b < begin_[0] || b >= begin_[kClasses])
+        return kClasses;
+    unsigned c = 0;
+    while (b >= begin_[c + 1])
+        ++c;
+    return c;
+}
+
+BufferPool::Stats BufferPool::stats() const
+{
+    Stats s;
+    PerThread<Cache>::for_each([&](const Cache& c) {
+        if (c.pool != this)
+            return;
+        for (unsigned i = 0; i < kClasses; ++i) {
+            s.allocs[i] += c.allocs[i].get();
+            s.overflows[i] += c.overflows[i].get();
+        }
+        s.oversize += c.oversize.get();
+    });
+    return s;
+}
+
+}
@@ -0,0 +1,99 @@
+// Size-classed pool of response payload buffers.
+//
+// Responses the plugin builds itself, rather than passing the runtime's
+// ENSUserData through, need memory for exactly as long as the notify
+// call.  Taking it from malloc would put the allocator, and now and then
+// a heap trim or a page fault, on the event path.  The pool instead
+// carves one prefaulted mapping, made when the plugin loads, into
+// buffers of 64 B to 64 KiB in powers of two.
+//
+// Each thread keeps a free list per size class and allocates and frees
+// without locks or atomics.  Lists refill from, and spill back to, a
+// shared depot in batches under a mutex, so a buffer freed on another
+// thread than it came from finds its way back.  When the depot of a
+// class runs dry, or a request exceeds 64 KiB, the pool falls back to
+// malloc and counts an overflow or an oversize allocation.
+
+#ifndef LR_BUFFER_POOL_H
+#define LR_BUFFER_POOL_H
+
+#include <stdint.h>
+
+#include <mutex>
+#include <vector>
+
+#include "counter.h"
+
+namespace lr {
+
+class BufferPool {
+public:
+    static const unsigned kMinShift = 6;
+    static const unsigned kClasses = 11;
+    static const uint32_t kMaxSize = 1u << (kMinShift + kClasses - 1);
+
+    struct Stats {
+        uint64_t allocs[kClasses] = {};
+        uint64_t overflows[kClasses] = {};
+        uint64_t oversize = 0;
+    };
+
+    // Maps and prefaults `per_class` buffers of every size class.  With
+    // per_class 0, or if the mapping fails, every allocation overflows.
+    explicit BufferPool(uint32_t per_class);
+    ~BufferPool();
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    // At least `size` bytes, never nullptr unless malloc fails.
+    void* alloc(uint32_t size);
+    // Takes buffers from alloc(), on any thread.
+    void release(void* p);
+
+    static unsigned size_class(uint32_t size)
+    {
+        return size <= (1u << kMinShift) ? 0 : 32 - __builtin_clz(size - 1) - kMinShift;
+    }
+    static uint32_t class_size(unsigned c) { return 1u << (kMinShift + c); }
+
+    uint64_t reserved_bytes() const { return bytes_; }
+    Stats stats() const;
+
+private:
+    // Buffers moved between a thread's list and the depot at a time.
+    static const uint32_t kBatch = 16;
+
+    struct FreeBuffer {
+        FreeBuffer* next;
+    };
+
+    struct Cache {
+        const BufferPool* pool = nullptr;
+        FreeBuffer* head[kClasses];
+        uint32_t count[kClasses];
+        Counter allocs[kClasses];
+        Counter overflows[kClasses];
+        Counter oversize;
+    };
+
+    struct Depot {
+        std::mutex lock;
+        std::vector<void*> free;
+    };
+
+    Cache& cache();
+    void* refill(Cache& c, unsigned cls);
+    void spill(Cache& c, unsigned cls);
+    // Class of a buffer inside the mapping, or kClasses for one from malloc.
+    unsigned owner_class(const void* p) const;
+
+    uint8_t* base_;
+    uint64_t bytes_;
+    uint8_t* begin_[kClasses + 1];
+    Depot depot_[kClasses];
+};
+
+}
+
+#endif
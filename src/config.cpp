@@ -0,0 +1,150 @@
+#include "config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dedup_cache.h"
+#include "shaper.h"
+
+namespace lr {
+
+Config g_config;
+
+namespace {
+
+// LR_SESSIONS when a feature needs the table and it was not given.
+const uint32_t kStatefulSessions = 1u << 20;
+
+uint64_t env_u64(const char* name, uint64_t fallback)
+{
+    const char* v = getenv(name);
+    if (!v || !*v)
+        return fallback;
+    char* end = nullptr;
+    unsigned long long n = strtoull(v, &end, 0);
+    if (*end != '\0') {
+        fprintf(stderr, "latencyresponder: ignoring %s=%s, not a number\n", name, v);
+        return fallback;
+    }
+    return n;
+}
+
+bool env_bool(const char* name, bool fallback)
+{
+    return env_u64(name, fallback ? 1 : 0) != 0;
+}
+
+// "mode" or "mode:arg".  Leaves the config alone if the value is bad.
+void parse_shape(const char* name)
+{
+    const char* v = getenv(name);
+    if (!v || !*v)
+        return;
+    const char* colon = strchr(v, ':');
+    size_t mode_len = colon ? size_t(colon - v) : strlen(v);
+    char* end = nullptr;
+    double arg = colon ? strtod(colon + 1, &end) : 0;
+    bool arg_ok = colon && end != colon + 1 && *end == '\0';
+    if (mode_len == 4 && strncmp(v, "echo", 4) == 0 && !colon) {
+        g_config.shape_mode = Shaper::kEcho;
+        return;
+    }
+    if (arg_ok && arg >= 0 && arg <= UINT32_MAX && arg == double(uint32_t(arg))) {
+        if (mode_len == 8 && strncmp(v, "truncate", 8) == 0) {
+            g_config.shape_mode = Shaper::kTruncate;
+            g_config.shape_bytes = uint32_t(arg);
+            return;
+        }
+        if (mode_len == 3 && strncmp(v, "pad", 3) == 0 && arg > 0) {
+            g_config.shape_mode = Shaper::kPad;
+            g_config.shape_bytes = uint32_t(arg);
+            return;
+        }
+    }
+    if (arg_ok && arg > 0 && arg <= 65536 && mode_len == 7 && strncmp(v, "amplify", 7) == 0) {
+        g_config.shape_mode = Shaper::kAmplify;
+        g_config.shape_ratio = arg;
+        return;
+    }
+    fprintf(stderr, "latencyresponder: ignoring %s=%s, expected echo, truncate:N, pad:N with N > 0 "
+                    "or amplify:R with 0 < R <= 65536\n", name, v);
+}
+
+void parse_dedup(const char* name)
+{
+    const char* v = getenv(name);
+    if (!v || !*v)
+        return;
+    if (strcmp(v, "off") == 0)
+        g_config.dedup_mode = DedupCache::kOff;
+    else if (strcmp(v, "replay") == 0)
+        g_config.dedup_mode = DedupCache::kReplay;
+    else if (strcmp(v, "suppress") == 0)
+        g_config.dedup_mode = DedupCache::kSuppress;
+    else
+        fprintf(stderr, "latencyresponder: ignoring %s=%s, expected off, replay or suppress\n", name, v);
+}
+
+uint32_t round_up_pow2(uint64_t n)
+{
+    uint32_t p = 1;
+    while (p < n && p < (1u << 31))
+        p <<= 1;
+    return p;
+}
+
+}
+
+void load_config()
+{
+    uint64_t sample = env_u64("LR_HISTOGRAM", 64);
+    g_config.histogram = sample != 0;
+    g_config.histogram_sample_mask = sample ? round_up_pow2(sample) - 1 : 0;
+    g_config.batch_notify = env_bool("LR_BATCH_NOTIFY", g_config.batch_notify);
+    g_config.gather_notify = env_bool("LR_GATHER_NOTIFY", g_config.gather_notify);
+    g_config.prefault_sessions = env_bool("LR_SESSIONS_PREFAULT", g_config.prefault_sessions);
+    g_config.stamp = env_bool("LR_STAMP", g_config.stamp);
+    g_config.clock_probe = env_bool("LR_CLOCK_PROBE", g_config.clock_probe);
+    g_config.workers = uint32_t(env_u64("LR_WORKERS", g_config.workers));
+    uint64_t ring = env_u64("LR_RING_BYTES", g_config.ring_bytes);
+    g_config.ring_bytes = round_up_pow2(ring < 4096 ? 4096 : ring);
+    g_config.pool_buffers = uint32_t(env_u64("LR_POOL_BUFFERS", g_config.pool_buffers));
+    g_config.shm_interval_ms = uint32_t(env_u64("LR_SHM_INTERVAL_MS", g_config.shm_interval_ms));
+    parse_shape("LR_SHAPE");
+    g_config.trace_bytes = env_u64("LR_TRACE_BYTES", g_config.trace_bytes);
+    g_config.trace_prefix = uint32_t(env_u64("LR_TRACE_PREFIX", g_config.trace_prefix));
+    g_config.trace_threads = uint32_t(env_u64("LR_TRACE_THREADS", g_config.trace_threads));
+    const char* trace = getenv("LR_TRACE");
+    if (trace && *trace)
+        snprintf(g_config.trace_path, sizeof(g_config.trace_path), "%s", trace);
+    g_config.flight_slo_ns = env_u64("LR_FLIGHT_SLO_NS", g_config.flight_slo_ns);
+    g_config.flight_events = uint32_t(env_u64("LR_FLIGHT_EVENTS", g_config.flight_events));
+    g_config.flight_max_dumps = uint32_t(env_u64("LR_FLIGHT_MAX_DUMPS", g_config.flight_max_dumps));
+    const char* flight = getenv("LR_FLIGHT_DIR");
+    snprintf(g_config.flight_dir, sizeof(g_config.flight_dir), "%s", flight && *flight ? flight : "/tmp");
+    g_config.rate = env_u64("LR_RATE", g_config.rate);
+    g_config.rate_burst = uint32_t(env_u64("LR_RATE_BURST", g_config.rate_burst));
+    g_config.rate_defer_us = uint32_t(env_u64("LR_RATE_DEFER_US", g_config.rate_defer_us));
+    g_config.rate_queue = uint32_t(env_u64("LR_RATE_QUEUE", g_config.rate_queue));
+    g_config.idle_timeout_ms = env_u64("LR_IDLE_TIMEOUT_MS", g_config.idle_timeout_ms);
+    g_config.idle_thread = env_bool("LR_IDLE_THREAD", g_config.idle_thread);
+    parse_dedup("LR_DEDUP");
+    g_config.dedup_entries = uint32_t(env_u64("LR_DEDUP_ENTRIES", g_config.dedup_entries));
+    g_config.dedup_bytes = uint32_t(env_u64("LR_DEDUP_BYTES", g_config.dedup_bytes));
+    g_config.kv_keys = env_u64("LR_KV", g_config.kv_keys);
+    g_config.jitter = env_bool("LR_JITTER", g_config.jitter);
+    bool stateful = g_config.rate || g_config.jitter || g_config.idle_timeout_ms ||
+                    g_config.dedup_mode != DedupCache::kOff;
+    g_config.max_sessions =
+        uint32_t(env_u64("LR_SESSIONS", stateful && !g_config.max_sessions ? kStatefulSessions : g_config.max_sessions));
+    const char* name = getenv("LR_SHM_NAME");
+    if (name && *name)
+        snprintf(g_config.shm_name, sizeof(g_config.shm_name), "%s", name);
+    else
+        snprintf(g_config.shm_name, sizeof(g_config.shm_name), "/latencyresponder.%d", int(getpid()));
+}
+
+}
@@ -0,0 +1,126 @@
+// Plugin configuration, read from LR_* environment variables when the
+// plugin is loaded.  The runtime offers no configuration channel of its
+// own, so the environment of the runtime process is the only knob.
+
+#ifndef LR_CONFIG_H
+#define LR_CONFIG_H
+
+#include <stdint.h>
+
+namespace lr {
+
+struct Config {
+    // LR_HISTOGRAM: record the responder latency of one in every N data
+    // events, N rounded up to a power of two; 0 switches recording off
+    // (default 64).  A recorded event costs two TSC reads and a bucket
+    // update, about 40 ns; 1 records every event at that price.
+    uint32_t histogram_sample_mask = 63;
+    bool histogram = true;
+    // LR_BATCH_NOTIFY: use the host's ENSSessionNotifyBatch, when it has
+    // one, from event_handler_batch (default 1).
+    bool batch_notify = true;
+    // LR_GATHER_NOTIFY: send responses the plugin extends as segments
+    // through the host's ENSSessionNotifyVec, when it has one, rather
+    // than copying them into one buffer (default 1).
+    bool gather_notify = true;
+    // LR_SESSIONS: sessions the per-session state table is sized for;
+    // 0 keeps the responder stateless (default 0, or 1048576 when LR_RATE,
+    // LR_JITTER, LR_IDLE_TIMEOUT_MS or LR_DEDUP needs the table).
+    uint32_t max_sessions = 0;
+    // LR_SESSIONS_PREFAULT: commit the whole table at load instead of on
+    // first touch from the event path (default 1).
+    bool prefault_sessions = true;
+    // LR_STAMP: write receive/send timestamps into every data response,
+    // see LRStampTrailer (default 0).
+    bool stamp = false;
+    // LR_CLOCK_PROBE: answer LR_EVENT_CLOCK_PROBE events with the
+    // plugin's receive and send times; 0 counts them as unknown
+    // (default 1).
+    bool clock_probe = true;
+    // LR_WORKERS: hand events to this many worker threads, which notify
+    // from there; 0 answers on the calling thread (default 0).
+    uint32_t workers = 0;
+    // LR_RING_BYTES: size of each producer-to-worker ring, rounded up to
+    // a power of two of at least 4096 (default 1048576).
+    uint32_t ring_bytes = 1u << 20;
+    // LR_POOL_BUFFERS: response buffers preallocated per size class when
+    // a feature takes them; 0 leaves every response buffer to malloc
+    // (default 64).
+    uint32_t pool_buffers = 64;
+    // LR_SHM_INTERVAL_MS: how often the shared-memory statistics segment
+    // is rewritten; 0 creates none (default 100).
+    uint32_t shm_interval_ms = 100;
+    // LR_SHM_NAME: name of that segment (default "/latencyresponder.<pid>").
+    char shm_name[64] = {};
+    // LR_SHAPE: echo, truncate:N, pad:N (N > 0) or amplify:R, see
+    // shaper.h (default echo).  shape_mode holds an lr::Shaper::Mode.
+    unsigned shape_mode = 0;
+    uint32_t shape_bytes = 0;
+    double shape_ratio = 1;
+    // LR_TRACE: record every event into this file, see trace_file.h
+    // (default none).
+    char trace_path[256] = {};
+    // LR_TRACE_BYTES: size of the trace file (default 67108864).
+    uint64_t trace_bytes = 64u << 20;
+    // LR_TRACE_PREFIX: payload bytes kept per event, rounded up to 32,
+    // at most 224 (default 0).
+    uint32_t trace_prefix = 0;
+    // LR_TRACE_THREADS: threads the file has a ring for (default 16).
+    uint32_t trace_threads = 16;
+    // LR_FLIGHT_SLO_NS: keep every thread's recent events in a flight
+    // recorder and dump them when one takes longer than this, see
+    // flight_recorder.h; 0 switches the recorder off (default 0).
+    uint64_t flight_slo_ns = 0;
+    // LR_FLIGHT_EVENTS: events each thread's recorder holds, rounded up
+    // to a power of two (default 4096).
+    uint32_t flight_events = 4096;
+    // LR_FLIGHT_DIR: where dumps go (default /tmp).
+    char flight_dir[256] = {};
+    // LR_FLIGHT_MAX_DUMPS: dumps written before the rest are dropped
+    // (default 16).
+    uint32_t flight_max_dumps = 16;
+    // LR_RATE: data events per second answered per session, see
+    // rate_limiter.h; needs the session table.  0 answers every event
+    // (default 0).
+    uint64_t rate = 0;
+    // LR_RATE_BURST: events a session may send back to back (default 32).
+    uint32_t rate_burst = 32;
+    // LR_RATE_DEFER_US: hold responses to excess events until they
+    // conform, if that is at most this far off, instead of dropping them;
+    // 0 drops every excess event (default 0).
+    uint32_t rate_defer_us = 0;
+    // LR_RATE_QUEUE: held responses per thread; excess events beyond it
+    // are dropped (default 1024).
+    uint32_t rate_queue = 1024;
+    // LR_IDLE_TIMEOUT_MS: erase sessions that have had no event for this
+    // long, see idle_evictor.h; 0 keeps them until they close (default 0).
+    uint64_t idle_timeout_ms = 0;
+    // LR_IDLE_THREAD: expire them from a housekeeping thread instead of
+    // the event path (default 0).
+    bool idle_thread = false;
+    // LR_DEDUP: off, replay or suppress, see dedup_cache.h.  A data event
+    // that repeats an answered (session_id, sqn) gets the cached response
+    // again, or nothing (default off).  dedup_mode holds an
+    // lr::DedupCache::Mode.
+    unsigned dedup_mode = 0;
+    // LR_DEDUP_ENTRIES: pairs the cache holds, rounded up to a power of
+    // two (default 65536).
+    uint32_t dedup_entries = 65536;
+    // LR_DEDUP_BYTES: longest response replay mode keeps (default 256).
+    uint32_t dedup_bytes = 256;
+    // LR_KV: answer data events as GET/PUT/DELETE commands against an
+    // in-plugin store of up to this many keys, see LRKvHeader; 0 echoes
+    // (default 0).
+    uint64_t kv_keys = 0;
+    // LR_JITTER: track interarrival jitter per session, see
+    // jitter_tracker.h; needs the session table (default 0).
+    bool jitter = false;
+};
+
+extern Config g_config;
+
+void load_config();
+
+}
+
+#endif
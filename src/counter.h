@@ -0,0 +1,32 @@
+// Statistics counter with a single writer thread and any number of
+// readers.  Updates are a relaxed load and store, not a locked add.
+
+#ifndef LR_COUNTER_H
+#define LR_COUNTER_H
+
+#include <stdint.h>
+
+#include <atomic>
+
+namespace lr {
+
+class Counter {
+public:
+    Counter()
+        : value_(0)
+    {
+    }
+
+    Counter(const Counter&) = delete;
+    Counter& operator=(const Counter&) = delete;
+
+    void add(uint64_t n = 1) { value_.store(value_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+    uint64_t get() const { return value_.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> value_;
+};
+
+}
+
+#endif
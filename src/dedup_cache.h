@@ -0,0 +1,197 @@
+// Cache of answered (session_id, sqn) pairs for retransmit deduplication
+// (LR_DEDUP).
+//
+// A fixed number of entries in sets of kWays, placed by a hash of the
+// pair, with CLOCK replacement inside each set: a hit sets an entry's
+// reference bit, and an insert sweeps the set's hand past referenced
+// entries, clearing their bits, to the first unreferenced one.  New
+// entries start unreferenced, so a stream of responses nobody asks for
+// again cannot push out the ones that were retransmitted.
+//
+// In replay mode each entry keeps the response as it was notified, up to
+// a fixed number of bytes; longer responses are not cached and their
+// retransmits are answered afresh.  In suppress mode only the pairs are
+// kept.  Memory is entries * (16 + bytes), mapped once at load.
+//
+// Every set has a spinlock of its own, held for a few compares and at
+// most one copy of a response, so any thread may insert or look up.
+
+#ifndef LR_DEDUP_CACHE_H
+#define LR_DEDUP_CACHE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <atomic>
+
+#include "ens.h"
+
+namespace lr {
+
+class DedupCache {
+public:
+    enum Mode { kOff, kReplay, kSuppress };
+
+    static const uint32_t kWays = 4;
+
+    // Room for `entries`, rounded up to a power of two of at least kWays,
+    // with `bytes` of response each in replay mode.
+    DedupCache(Mode mode, uint32_t entries, uint32_t bytes)
+        : mode_(mode)
+        , bytes_(mode == kReplay ? bytes : 0)
+        , sets_(nullptr)
+        , data_(nullptr)
+        , mask_(0)
+        , mapped_(0)
+    {
+        uint64_t n = kWays;
+        while (n < entries)
+            n <<= 1;
+        uint64_t sets = n / kWays;
+        mapped_ = sets * sizeof(Set) + n * bytes_;
+        void* p = mmap(nullptr, mapped_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+        if (p == MAP_FAILED)
+            return;
+        sets_ = static_cast<Set*>(p);
+        data_ = static_cast<uint8_t*>(p) + sets * sizeof(Set);
+        mask_ = sets - 1;
+    }
+
+    ~DedupCache()
+    {
+        if (sets_)
+            munmap(sets_, mapped_);
+    }
+
+    DedupCache(const DedupCache&) = delete;
+    DedupCache& operator=(const DedupCache&) = delete;
+
+    bool ok() const { return sets_ != nullptr; }
+    Mode mode() const { return mode_; }
+    uint64_t entries() const { return sets_ ? (mask_ + 1) * kWays : 0; }
+    uint32_t bytes() const { return bytes_; }
+
+    // Records that `data` answered (session_id, sqn).  Returns false if
+    // the response is too long to keep; sets *evicted when it displaced
+    // another pair.
+    bool insert(uint32_t session_id, uint32_t sqn, const ENSUserData* data, bool* evicted)
+    {
+        return data ? insert(session_id, sqn, data, 1, evicted) : insert(session_id, sqn, nullptr, 0, evicted);
+    }
+
+    // The same for a response sent as `count` segments, kept as their
+    // concatenation; segments == nullptr stands for no payload at all.
+    bool insert(uint32_t session_id, uint32_t sqn, const ENSUserData* segments, uint32_t count, bool* evicted)
+    {
+        uint64_t length = 0;
+        for (uint32_t i = 0; i < count; ++i)
+            length += segments[i].length;
+        if (mode_ == kReplay && length > bytes_)
+            return false;
+        uint64_t key = make_key(session_id, sqn);
+        uint64_t s = set_of(key);
+        Set& set = sets_[s];
+        lock(set);
+        unsigned w = find(set, key);
+        *evicted = false;
+        if (w == kWays) {
+            w = victim(set);
+            *evicted = (set.valid >> w) & 1;
+            set.keys[w] = key;
+            set.valid |= uint8_t(1u << w);
+            set.referenced &= uint8_t(~(1u << w));
+        }
+        set.lengths[w] = segments ? uint32_t(length) : kNull;
+        uint8_t* at = data_ + (s * kWays + w) * bytes_;
+        for (uint32_t i = 0; bytes_ && i < count; ++i) {
+            memcpy(at, segments[i].p, segments[i].length);
+            at += segments[i].length;
+        }
+        unlock(set);
+        return true;
+    }
+
+    // On a hit, marks (session_id, sqn) referenced and, in replay mode,
+    // calls copy(data) with the cached response, nullptr for none, while
+    // the set is locked.  Returns whether it was a hit.
+    template <typename Copy>
+    bool lookup(uint32_t session_id, uint32_t sqn, Copy copy)
+    {
+        uint64_t key = make_key(session_id, sqn);
+        uint64_t s = set_of(key);
+        Set& set = sets_[s];
+        lock(set);
+        unsigned w = find(set, key);
+        if (w == kWays) {
+            unlock(set);
+            return false;
+        }
+        set.referenced |= uint8_t(1u << w);
+        if (mode_ == kReplay) {
+            ENSUserData d = {set.lengths[w], data_ + (s * kWays + w) * bytes_};
+            copy(set.lengths[w] == kNull ? nullptr : &d);
+        }
+        unlock(set);
+        return true;
+    }
+
+private:
+    static const uint32_t kNull = UINT32_MAX;
+
+    struct alignas(64) Set {
+        std::atomic<uint32_t> lock;
+        uint8_t hand;
+        // Bit w for way w.
+        uint8_t valid;
+        uint8_t referenced;
+        uint32_t lengths[kWays];
+        uint64_t keys[kWays];
+    };
+    static_assert(sizeof(Set) == 64, "a set is one cache line");
+
+    static uint64_t make_key(uint32_t session_id, uint32_t sqn) { return uint64_t(session_id) << 32 | sqn; }
+
+    uint64_t set_of(uint64_t key) const { return (key * 0x9e3779b97f4a7c15ull) >> 32 & mask_; }
+
+    static unsigned find(const Set& set, uint64_t key)
+    {
+        for (unsigned w = 0; w < kWays; ++w)
+            if (set.keys[w] == key && ((set.valid >> w) & 1))
+                return w;
+        return kWays;
+    }
+
+    // CLOCK: the first way from the hand that is empty or unreferenced,
+    // clearing reference bits on the way; the hand moves past it.
+    static unsigned victim(Set& set)
+    {
+        for (;;) {
+            unsigned w = set.hand;
+            set.hand = uint8_t((w + 1) % kWays);
+            if (!((set.valid >> w) & 1) || !((set.referenced >> w) & 1))
+                return w;
+            set.referenced &= uint8_t(~(1u << w));
+        }
+    }
+
+    static void lock(Set& set)
+    {
+        while (set.lock.exchange(1, std::memory_order_acquire))
+            while (set.lock.load(std::memory_order_relaxed))
+                __builtin_ia32_pause();
+    }
+
+    static void unlock(Set& set) { set.lock.store(0, std::memory_order_release); }
+
+    Mode mode_;
+    uint32_t bytes_;
+    Set* sets_;
+    uint8_t* data_;
+    uint64_t mask_;
+    size_t mapped_;
+};
+
+}
+
+#endif
@@ -0,0 +1,93 @@
+// Responses held back by the rate limiter until their due time.
+//
+// A fixed-capacity binary min-heap on the due TSC, one per thread, owned
+// and drained by that thread alone.  The entries array is allocated on
+// the first push so threads that never defer pay nothing.
+
+#ifndef LR_DEFER_QUEUE_H
+#define LR_DEFER_QUEUE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "ens.h"
+
+namespace lr {
+
+class DeferQueue {
+public:
+    struct Entry {
+        uint64_t due;
+        uint64_t rx_tsc;
+        uint32_t session_id;
+        uint32_t sqn;
+        // A private copy of the payload, or p == nullptr for none.
+        ENSUserData data;
+    };
+
+    DeferQueue() = default;
+    ~DeferQueue() { free(heap_); }
+
+    DeferQueue(const DeferQueue&) = delete;
+    DeferQueue& operator=(const DeferQueue&) = delete;
+
+    uint32_t size() const { return size_; }
+    bool full(uint32_t capacity) const { return size_ >= capacity; }
+
+    // Whether the earliest entry is due at `now`.
+    bool due(uint64_t now) const { return size_ && int64_t(now - heap_[0].due) >= 0; }
+
+    // Adds e, growing to `capacity` entries on first use.  Returns false
+    // if the queue is full or cannot be allocated.
+    bool push(const Entry& e, uint32_t capacity)
+    {
+        if (!heap_) {
+            heap_ = static_cast<Entry*>(malloc(size_t(capacity) * sizeof(Entry)));
+            if (!heap_)
+                return false;
+            capacity_ = capacity;
+        }
+        if (size_ >= capacity_)
+            return false;
+        uint32_t i = size_++;
+        while (i && before(e, heap_[(i - 1) / 2])) {
+            heap_[i] = heap_[(i - 1) / 2];
+            i = (i - 1) / 2;
+        }
+        heap_[i] = e;
+        return true;
+    }
+
+    // Removes and returns the earliest entry; the queue must not be empty.
+    Entry pop()
+    {
+        Entry top = heap_[0];
+        Entry last = heap_[--size_];
+        uint32_t i = 0;
+        for (;;) {
+            uint32_t c = 2 * i + 1;
+            if (c >= size_)
+                break;
+            if (c + 1 < size_ && before(heap_[c + 1], heap_[c]))
+                ++c;
+            if (!before(heap_[c], last))
+                break;
+            heap_[i] = heap_[c];
+            i = c;
+        }
+        if (size_)
+            heap_[i] = last;
+        return top;
+    }
+
+private:
+    static bool before(const Entry& a, const Entry& b) { return int64_t(a.due - b.due) < 0; }
+
+    Entry* heap_ = nullptr;
+    uint32_t size_ = 0;
+    uint32_t capacity_ = 0;
+};
+
+}
+
+#endif
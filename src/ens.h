@@ -0,0 +1,31 @@
+// Subset of the ENS runtime SDK header used by latencyresponder.
+//
+// The runtimecpp image ships the full ens.h; this copy only declares what
+// the plugin and the local host tools need.  Layouts and signatures match
+// the DWARF of the shipped workload/latencyresponder.so.
+
+#ifndef ENS_H
+#define ENS_H
+
+#include <stdint.h>
+
+typedef struct {
+    uint32_t length;
+    uint8_t* p;
+} ENSUserData;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Provided by the runtime: delivers data to the client of session_id.
+void ENSSessionNotify(uint32_t session_id, uint32_t sqn, ENSUserData* data);
+
+// Provided by the plugin: called by the runtime for every session event.
+void event_handler(uint32_t session_id, uint32_t event_type, uint32_t sqn, ENSUserData* data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,187 @@
+// Epoch-based reclamation for structures with lock-free readers (LR_KV,
+// and evicted session slots).
+//
+// Readers bracket every visit to shared nodes with an Epoch::Guard: on
+// entry a thread publishes the global epoch it saw and fences, on exit
+// it clears it, and it never waits.  A writer that unlinks a node passes
+// it to retire() instead of free().  The global epoch moves on once
+// every thread inside a guard has published the current one, and a node
+// retired in epoch e is freed once the global epoch reaches e + 2, when
+// no guard that might have reached it can still be open.
+//
+// Retired nodes wait on per-thread lists, one for each of the last three
+// epochs, so retiring and freeing take no locks.  A retiring thread
+// tries to move the epoch on every kAdvanceEvery nodes and frees a list
+// when it comes round to it again.  Lists of threads that stop retiring
+// wait for reclaim_all().
+//
+// There is one epoch per process.  Nodes must come from malloc().  The
+// session table uses the same epoch, through current() and passed(), to
+// hold back slots it erased under other threads' feet.
+
+#ifndef LR_EPOCH_H
+#define LR_EPOCH_H
+
+#include <malloc.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <atomic>
+#include <vector>
+
+#include "counter.h"
+#include "per_thread.h"
+
+namespace lr {
+
+class Epoch {
+    struct Thread;
+
+public:
+    static const uint64_t kAdvanceEvery = 64;
+
+    // Guards nest; only the outermost one publishes.
+    class Guard {
+    public:
+        Guard()
+            : thread_(enter())
+        {
+        }
+        ~Guard() { exit(thread_); }
+
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+
+    private:
+        Thread& thread_;
+    };
+
+    struct Stats {
+        uint64_t epoch = 0;
+        uint64_t retired = 0;
+        uint64_t reclaimed = 0;
+        // malloc_usable_size() of the nodes retired and not yet freed.
+        uint64_t pending_bytes = 0;
+    };
+
+    // Frees `node` once no guard can still see it.
+    static void retire(void* node)
+    {
+        Thread& t = PerThread<Thread>::local();
+        uint64_t e = global().load(std::memory_order_seq_cst);
+        unsigned i = unsigned(e % 3);
+        if (t.epochs[i] != e) {
+            // Left from epoch e - 3 or earlier.
+            reclaim(t, i);
+            t.epochs[i] = e;
+        }
+        t.lists[i].push_back(node);
+        t.retired.add();
+        t.retired_bytes.add(malloc_usable_size(node));
+        if (++t.since_advance >= kAdvanceEvery) {
+            t.since_advance = 0;
+            try_advance();
+        }
+    }
+
+    static Stats stats()
+    {
+        Stats s;
+        s.epoch = global().load(std::memory_order_relaxed);
+        uint64_t retired_bytes = 0;
+        uint64_t reclaimed_bytes = 0;
+        PerThread<Thread>::for_each([&](const Thread& t) {
+            s.retired += t.retired.get();
+            s.reclaimed += t.reclaimed.get();
+            retired_bytes += t.retired_bytes.get();
+            reclaimed_bytes += t.reclaimed_bytes.get();
+        });
+        s.pending_bytes = retired_bytes - reclaimed_bytes;
+        return s;
+    }
+
+    // The global epoch.  Something made unreachable before reading it can
+    // be reused once passed(epoch).
+    static uint64_t current() { return global().load(std::memory_order_seq_cst); }
+
+    // Whether every guard open when the global epoch was `epoch` has
+    // closed since.
+    static bool passed(uint64_t epoch) { return global().load(std::memory_order_seq_cst) >= epoch + 2; }
+
+    // Moves the global epoch on if every open guard has seen it.  retire()
+    // calls this by itself; users that wait on passed() call it instead.
+    static void try_advance()
+    {
+        uint64_t e = global().load(std::memory_order_seq_cst);
+        bool current = true;
+        PerThread<Thread>::for_each([&](const Thread& t) {
+            uint64_t s = t.state.load(std::memory_order_seq_cst);
+            if ((s & 1) && (s >> 1) != e)
+                current = false;
+        });
+        if (current)
+            global().compare_exchange_strong(e, e + 1, std::memory_order_seq_cst);
+    }
+
+    // Frees every retired node.  No thread may be inside a guard or
+    // retiring.
+    static void reclaim_all()
+    {
+        PerThread<Thread>::for_each([](Thread& t) {
+            for (unsigned i = 0; i < 3; ++i)
+                reclaim(t, i);
+        });
+    }
+
+private:
+    struct Thread {
+        // Epoch << 1 | 1 while inside a guard, 0 outside.
+        std::atomic<uint64_t> state{0};
+        uint32_t depth = 0;
+        uint64_t since_advance = 0;
+        uint64_t epochs[3] = {};
+        std::vector<void*> lists[3];
+        Counter retired;
+        Counter reclaimed;
+        Counter retired_bytes;
+        Counter reclaimed_bytes;
+    };
+
+    static std::atomic<uint64_t>& global()
+    {
+        static std::atomic<uint64_t> epoch(0);
+        return epoch;
+    }
+
+    static Thread& enter()
+    {
+        Thread& t = PerThread<Thread>::local();
+        if (t.depth++ == 0) {
+            t.state.store(global().load(std::memory_order_relaxed) << 1 | 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+        return t;
+    }
+
+    static void exit(Thread& t)
+    {
+        if (--t.depth == 0)
+            t.state.store(0, std::memory_order_release);
+    }
+
+    static void reclaim(Thread& t, unsigned i)
+    {
+        uint64_t bytes = 0;
+        for (void* node : t.lists[i]) {
+            bytes += malloc_usable_size(node);
+            free(node);
+        }
+        t.reclaimed.add(t.lists[i].size());
+        t.reclaimed_bytes.add(bytes);
+        t.lists[i].clear();
+    }
+};
+
+}
+
+#endif
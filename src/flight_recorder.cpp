@@ -0,0 +1,170 @@
+#include "flight_recorder.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <new>
+
+#include "tsc.h"
+
+namespace lr {
+
+namespace {
+
+// How often the dumper looks for frozen rings.  Freezing never wakes it,
+// so the event path makes no system call.
+const unsigned kPollMs = 10;
+
+}
+
+FlightRecorder::FlightRecorder(uint32_t events, uint64_t slo_cycles, const char* dir, uint32_t max_dumps,
+                               double tsc_hz)
+    : mask_(1)
+    , slo_(slo_cycles > uint64_t(INT64_MAX) ? INT64_MAX : int64_t(slo_cycles))
+    , dir_(dir && *dir ? dir : "/tmp")
+    , max_dumps_(max_dumps)
+    , tsc_hz_(tsc_hz)
+    , dumps_(0)
+    , dropped_(0)
+    , stop_(false)
+{
+    uint64_t n = 2;
+    while (n < events)
+        n <<= 1;
+    mask_ = n - 1;
+    thread_ = std::thread(&FlightRecorder::run, this);
+}
+
+FlightRecorder::~FlightRecorder()
+{
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        stop_ = true;
+    }
+    wake_.notify_one();
+    thread_.join();
+    collect();
+}
+
+FlightRecorder::Ring* FlightRecorder::new_ring(uint32_t tid) const
+{
+    void* mem = malloc(sizeof(Ring) + (mask_ + 1) * sizeof(Entry));
+    if (!mem)
+        throw std::bad_alloc();
+    Ring* r = static_cast<Ring*>(mem);
+    r->head = 0;
+    r->tid = tid;
+    r->entries = reinterpret_cast<Entry*>(r + 1);
+    // Commit the pages now rather than on the event path.
+    memset(r->entries, 0, (mask_ + 1) * sizeof(Entry));
+    return r;
+}
+
+void FlightRecorder::claim(Writer& w)
+{
+    // Rings of an earlier recorder are all back with the thread by now.
+    free(w.active);
+    free(w.spare);
+    free(w.returned.exchange(nullptr));
+    uint32_t tid = uint32_t(syscall(SYS_gettid));
+    w.active = new_ring(tid);
+    w.spare = new_ring(tid);
+    w.recorder = this;
+}
+
+void FlightRecorder::freeze(Writer& w)
+{
+    w.violations.add();
+    if (!w.spare)
+        w.spare = w.returned.exchange(nullptr, std::memory_order_acquire);
+    if (!w.spare) {
+        w.suppressed.add();
+        return;
+    }
+    w.frozen.store(w.active, std::memory_order_release);
+    w.active = w.spare;
+    w.active->head = 0;
+    w.spare = nullptr;
+}
+
+void FlightRecorder::run()
+{
+    std::unique_lock<std::mutex> guard(lock_);
+    while (!stop_) {
+        guard.unlock();
+        collect();
+        guard.lock();
+        wake_.wait_for(guard, std::chrono::milliseconds(kPollMs), [this] { return stop_; });
+    }
+}
+
+void FlightRecorder::collect()
+{
+    PerThread<Writer>::for_each([&](const Writer& cw) {
+        // The frozen and returned slots are the only parts shared with
+        // the writer.
+        Writer& w = const_cast<Writer&>(cw);
+        if (w.recorder != this)
+            return;
+        Ring* r = w.frozen.exchange(nullptr, std::memory_order_acquire);
+        if (!r)
+            return;
+        // Only this thread, or the destructor after it, counts dumps.
+        uint64_t n = dumps_.load(std::memory_order_relaxed);
+        if (n < max_dumps_ && dump(*r, n))
+            dumps_.store(n + 1, std::memory_order_relaxed);
+        else
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+        w.returned.store(r, std::memory_order_release);
+    });
+}
+
+// One CSV row per event, oldest first, timed relative to the event that
+// broke the SLO, which comes last.
+bool FlightRecorder::dump(const Ring& ring, uint64_t n)
+{
+    std::string path = dir_ + "/lr-flight." + std::to_string(getpid()) + "." + std::to_string(n) + ".csv";
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f)
+        return false;
+    uint64_t count = ring.head < mask_ + 1 ? ring.head : mask_ + 1;
+    const Entry& last = ring.entries[(ring.head - 1) & mask_];
+    double ns = 1e9 / tsc_hz_;
+    // The trigger's wall time, from how long ago it happened.
+    uint64_t now_ns = realtime_ns();
+    int64_t ago = int64_t(rdtsc() - last.entry);
+    uint64_t at_ns = now_ns - uint64_t(double(ago > 0 ? ago : 0) * ns);
+    fprintf(f, "# latencyresponder flight recorder: pid %d tid %u, %" PRIu64 " events, slo %.0f ns\n", int(getpid()),
+            ring.tid, count, double(slo_) * ns);
+    fprintf(f, "# trigger: session %u type %u sqn %u took %.0f ns, at %" PRIu64 ".%09" PRIu64 " CLOCK_REALTIME\n",
+            last.session_id, last.event_type, last.sqn, double(last.total) * ns, at_ns / 1000000000u,
+            at_ns % 1000000000u);
+    fprintf(f, "ns,session,type,sqn,length,state_ns,total_ns\n");
+    for (uint64_t i = ring.head - count; i < ring.head; ++i) {
+        const Entry& e = ring.entries[i & mask_];
+        fprintf(f, "%.0f,%u,%u,%u,%u,%.0f,%.0f\n", double(int64_t(e.entry - last.entry)) * ns, e.session_id,
+                e.event_type, e.sqn, e.length, double(e.state) * ns, double(e.total) * ns);
+    }
+    return fclose(f) == 0;
+}
+
+FlightRecorder::Stats FlightRecorder::stats() const
+{
+    Stats s;
+    PerThread<Writer>::for_each([&](const Writer& w) {
+        if (w.recorder != this)
+            return;
+        s.violations += w.violations.get();
+        s.suppressed += w.suppressed.get();
+    });
+    s.dumps = dumps_.load(std::memory_order_relaxed);
+    s.dropped = dropped_.load(std::memory_order_relaxed);
+    return s;
+}
+
+}
@@ -0,0 +1,161 @@
+// Per-thread flight recorder for tail-latency post-mortems.
+//
+// With LR_FLIGHT_SLO_NS set, every thread that calls into the plugin
+// keeps its last LR_FLIGHT_EVENTS events in a ring of its own, each with
+// the TSC at entry and the cycles to two later stages: per-session state
+// done, and response sent.  Recording is a few stores into that ring.
+//
+// An event that took longer than the SLO freezes the ring: the thread
+// hands it, ending with the slow event, to a dumper thread and carries
+// on with a spare ring.  The dumper writes it as CSV to
+// LR_FLIGHT_DIR/lr-flight.<pid>.<n>.csv and gives the ring back as the
+// next spare.  A thread whose spare is still out being dumped cannot
+// freeze again until it is back; such violations are counted as
+// suppressed.  At most LR_FLIGHT_MAX_DUMPS files are written, later
+// frozen rings are dropped unwritten.
+
+#ifndef LR_FLIGHT_RECORDER_H
+#define LR_FLIGHT_RECORDER_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "counter.h"
+#include "per_thread.h"
+
+namespace lr {
+
+class FlightRecorder {
+public:
+    struct Entry {
+        uint64_t entry;
+        uint32_t session_id;
+        uint32_t event_type;
+        uint32_t sqn;
+        uint32_t length;
+        // Cycles from entry, saturated at 2^32 - 1.
+        uint32_t state;
+        uint32_t total;
+    };
+
+    struct Stats {
+        uint64_t violations = 0;
+        uint64_t suppressed = 0;
+        uint64_t dumps = 0;
+        uint64_t dropped = 0;
+    };
+
+    // Rings of `events` entries, rounded up to a power of two; events
+    // slower than `slo_cycles` freeze them.
+    FlightRecorder(uint32_t events, uint64_t slo_cycles, const char* dir, uint32_t max_dumps, double tsc_hz);
+    // Writes out whatever is still frozen, then stops the dumper.
+    ~FlightRecorder();
+
+    FlightRecorder(const FlightRecorder&) = delete;
+    FlightRecorder& operator=(const FlightRecorder&) = delete;
+
+    // `state` and `exit` are the TSC after the per-session work and after
+    // the response went out.
+    void record(uint64_t entry, uint64_t state, uint64_t exit, uint32_t session_id, uint32_t event_type,
+                uint32_t sqn, uint32_t length)
+    {
+        Writer& w = writer();
+        Entry& e = w.active->entries[w.active->head++ & mask_];
+        e.entry = entry;
+        e.session_id = session_id;
+        e.event_type = event_type;
+        e.sqn = sqn;
+        e.length = length;
+        e.state = cycles(entry, state);
+        e.total = cycles(entry, exit);
+        if (__builtin_expect(int64_t(exit - entry) > slo_, 0))
+            freeze(w);
+    }
+
+    // Records every event of a batch with the batch's stamps, and checks
+    // the SLO once for all of them.
+    template <typename Event>
+    void record_batch(uint64_t entry, uint64_t exit, const Event* events, uint32_t count)
+    {
+        Writer& w = writer();
+        uint32_t total = cycles(entry, exit);
+        for (uint32_t i = 0; i < count; ++i) {
+            Entry& e = w.active->entries[w.active->head++ & mask_];
+            e.entry = entry;
+            e.session_id = events[i].session_id;
+            e.event_type = events[i].event_type;
+            e.sqn = events[i].sqn;
+            e.length = events[i].data ? events[i].data->length : 0;
+            e.state = total;
+            e.total = total;
+        }
+        if (__builtin_expect(count && int64_t(exit - entry) > slo_, 0))
+            freeze(w);
+    }
+
+    Stats stats() const;
+    double slo_ns() const { return double(slo_) * 1e9 / tsc_hz_; }
+
+private:
+    struct Ring {
+        uint64_t head;
+        uint32_t tid;
+        Entry* entries;
+    };
+
+    struct Writer {
+        const FlightRecorder* recorder = nullptr;
+        Ring* active = nullptr;
+        // Owned by the writer, or nullptr while it is out being dumped.
+        Ring* spare = nullptr;
+        // Frozen ring for the dumper, and the ring it gives back.
+        std::atomic<Ring*> frozen{nullptr};
+        std::atomic<Ring*> returned{nullptr};
+        Counter violations;
+        Counter suppressed;
+    };
+
+    // Entry stamps may come from another core, as in asynchronous mode,
+    // so differences can come out slightly negative.
+    static uint32_t cycles(uint64_t from, uint64_t to)
+    {
+        int64_t d = int64_t(to - from);
+        return d < 0 ? 0 : d > int64_t(UINT32_MAX) ? UINT32_MAX : uint32_t(d);
+    }
+
+    Writer& writer()
+    {
+        Writer& w = PerThread<Writer>::local();
+        if (__builtin_expect(w.recorder != this, 0))
+            claim(w);
+        return w;
+    }
+
+    void claim(Writer& w);
+    void freeze(Writer& w);
+    Ring* new_ring(uint32_t tid) const;
+    void run();
+    void collect();
+    bool dump(const Ring& ring, uint64_t n);
+
+    uint64_t mask_;
+    int64_t slo_;
+    std::string dir_;
+    uint32_t max_dumps_;
+    double tsc_hz_;
+    std::atomic<uint64_t> dumps_;
+    std::atomic<uint64_t> dropped_;
+    std::mutex lock_;
+    std::condition_variable wake_;
+    bool stop_;
+    std::thread thread_;
+};
+
+}
+
+#endif
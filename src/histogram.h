@@ -0,0 +1,190 @@
+// Log-linear latency histogram in the style of HdrHistogram.
+//
+// Values below 2^kSubBucketBits get one bucket each; every power of two
+// above that is split into 2^kSubBucketBits linear sub-buckets, which keeps
+// the relative error under 1/64 over the whole range.  Values are unit
+// agnostic (TSC cycles on the hot path, converted on read).
+
+#ifndef LR_HISTOGRAM_H
+#define LR_HISTOGRAM_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include <atomic>
+
+namespace lr {
+
+class Histogram {
+public:
+    static const unsigned kSubBucketBits = 6;
+    static const unsigned kSubBucketCount = 1u << kSubBucketBits;
+    static const unsigned kMaxExponent = 40;
+    static const unsigned kBucketCount = (kMaxExponent - kSubBucketBits + 2) * kSubBucketCount;
+    static const uint64_t kMaxValue = (uint64_t(1) << (kMaxExponent + 1)) - 1;
+
+    Histogram() { reset(); }
+
+    static unsigned index_of(uint64_t v)
+    {
+        if (v > kMaxValue)
+            v = kMaxValue;
+        if (v < kSubBucketCount)
+            return unsigned(v);
+        unsigned e = 63 - __builtin_clzll(v);
+        unsigned shift = e - kSubBucketBits;
+        return (shift + 1) * kSubBucketCount + unsigned(v >> shift) - kSubBucketCount;
+    }
+
+    static uint64_t lowest_value(unsigned index)
+    {
+        unsigned q = index >> kSubBucketBits;
+        uint64_t r = index & (kSubBucketCount - 1);
+        if (q == 0)
+            return r;
+        return (kSubBucketCount + r) << (q - 1);
+    }
+
+    static uint64_t highest_value(unsigned index)
+    {
+        unsigned q = index >> kSubBucketBits;
+        if (q <= 1)
+            return lowest_value(index);
+        return lowest_value(index) + (uint64_t(1) << (q - 1)) - 1;
+    }
+
+    void record(uint64_t v)
+    {
+        ++counts_[index_of(v)];
+        ++count_;
+        sum_ += v;
+        if (v < min_)
+            min_ = v;
+        if (v > max_)
+            max_ = v;
+    }
+
+    void merge(const Histogram& other)
+    {
+        for (unsigned i = 0; i < kBucketCount; ++i)
+            counts_[i] += other.counts_[i];
+        count_ += other.count_;
+        sum_ += other.sum_;
+        if (other.min_ < min_)
+            min_ = other.min_;
+        if (other.max_ > max_)
+            max_ = other.max_;
+    }
+
+    // Adds raw bucket counts, e.g. from a RecordingHistogram.  The
+    // minimum is taken to bucket resolution.
+    void merge_buckets(const uint64_t* counts, uint64_t sum, uint64_t max)
+    {
+        for (unsigned i = 0; i < kBucketCount; ++i) {
+            if (counts[i] == 0)
+                continue;
+            if (lowest_value(i) < min_)
+                min_ = lowest_value(i);
+            counts_[i] += counts[i];
+            count_ += counts[i];
+        }
+        sum_ += sum;
+        if (max > max_)
+            max_ = max;
+    }
+
+    void reset()
+    {
+        memset(counts_, 0, sizeof(counts_));
+        count_ = 0;
+        sum_ = 0;
+        min_ = UINT64_MAX;
+        max_ = 0;
+    }
+
+    uint64_t count() const { return count_; }
+    uint64_t min() const { return count_ ? min_ : 0; }
+    uint64_t max() const { return max_; }
+    double mean() const { return count_ ? double(sum_) / double(count_) : 0.0; }
+    uint64_t sum() const { return sum_; }
+    uint64_t bucket(unsigned index) const { return counts_[index]; }
+
+    // Smallest recorded value v such that at least `percentile`% of all
+    // recorded values are <= v (to bucket resolution).
+    uint64_t percentile(double percentile) const
+    {
+        if (count_ == 0)
+            return 0;
+        uint64_t rank = uint64_t(percentile / 100.0 * double(count_) + 0.5);
+        if (rank == 0)
+            rank = 1;
+        if (rank > count_)
+            rank = count_;
+        uint64_t seen = 0;
+        for (unsigned i = 0; i < kBucketCount; ++i) {
+            seen += counts_[i];
+            if (seen >= rank) {
+                uint64_t v = highest_value(i);
+                return v < max_ ? v : max_;
+            }
+        }
+        return max_;
+    }
+
+private:
+    uint64_t counts_[kBucketCount];
+    uint64_t count_;
+    uint64_t sum_;
+    uint64_t min_;
+    uint64_t max_;
+};
+
+// Histogram with a single writer thread that other threads may read at
+// any time.  Recording is a relaxed load and store per field, never a
+// locked read-modify-write, so it costs the same as a plain histogram.
+// Readers copy the counters out; a copy taken while the writer records
+// may be off by the values in flight but is never torn.
+class RecordingHistogram {
+public:
+    RecordingHistogram()
+    {
+        for (unsigned i = 0; i < Histogram::kBucketCount; ++i)
+            counts_[i].store(0, std::memory_order_relaxed);
+        sum_.store(0, std::memory_order_relaxed);
+        max_.store(0, std::memory_order_relaxed);
+    }
+
+    RecordingHistogram(const RecordingHistogram&) = delete;
+    RecordingHistogram& operator=(const RecordingHistogram&) = delete;
+
+    // Records `n` occurrences of v.
+    void record(uint64_t v, uint64_t n = 1)
+    {
+        bump(counts_[Histogram::index_of(v)], n);
+        bump(sum_, v * n);
+        if (v > max_.load(std::memory_order_relaxed))
+            max_.store(v, std::memory_order_relaxed);
+    }
+
+    void add_to(Histogram& h) const
+    {
+        uint64_t counts[Histogram::kBucketCount];
+        for (unsigned i = 0; i < Histogram::kBucketCount; ++i)
+            counts[i] = counts_[i].load(std::memory_order_relaxed);
+        h.merge_buckets(counts, sum_.load(std::memory_order_relaxed), max_.load(std::memory_order_relaxed));
+    }
+
+private:
+    static void bump(std::atomic<uint64_t>& a, uint64_t n)
+    {
+        a.store(a.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> counts_[Histogram::kBucketCount];
+    std::atomic<uint64_t> sum_;
+    std::atomic<uint64_t> max_;
+};
+
+}
+
+#endif
@@ -0,0 +1,105 @@
+#include "idle_evictor.h"
+
+#include <chrono>
+
+#include "tsc.h"
+
+namespace lr {
+
+namespace {
+
+const unsigned kPollMs = 10;
+
+// The shift that makes TSC >> shift tick about once a millisecond.
+unsigned tick_shift(double tsc_hz)
+{
+    unsigned shift = 0;
+    while (shift < 40 && double(uint64_t(1) << (shift + 1)) <= tsc_hz / 1000)
+        ++shift;
+    return shift;
+}
+
+}
+
+IdleEvictor::IdleEvictor(Sessions& sessions, uint64_t timeout_ms, double tsc_hz, bool thread, bool prefault)
+    : sessions_(sessions)
+    , timeout_ms_(timeout_ms)
+    , shift_(tick_shift(tsc_hz))
+    , timeout_(0)
+    , wheel_(sessions.capacity(), uint32_t(rdtsc() >> shift_), prefault)
+    , evicted_(0)
+    , retired_(0)
+    , checked_(0)
+    , stop_(false)
+{
+    double ticks = double(timeout_ms) * tsc_hz / 1000 / double(uint64_t(1) << shift_) + 1;
+    // Past INT32_MAX ticks wrapped stamps would compare as the future.
+    timeout_ = ticks < double(INT32_MAX) ? uint32_t(ticks) : uint32_t(INT32_MAX);
+    if (wheel_.ok() && thread)
+        thread_ = std::thread(&IdleEvictor::run, this);
+}
+
+IdleEvictor::~IdleEvictor()
+{
+    if (!thread_.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        stop_ = true;
+    }
+    wake_.notify_one();
+    thread_.join();
+}
+
+void IdleEvictor::advance(uint64_t tsc, uint64_t budget)
+{
+    std::unique_lock<std::mutex> guard(advancing_, std::try_to_lock);
+    if (!guard.owns_lock())
+        return;
+    wheel_.advance(uint32_t(tsc >> shift_));
+    uint64_t backlog = wheel_.backlog() >> 14;
+    uint64_t evicted = 0;
+    uint64_t checked = wheel_.expire([&](uint64_t slot, uint32_t now, uint32_t* when) {
+        uint32_t session_id = 0;
+        const SessionState* s = sessions_.at(slot, &session_id);
+        if (!s)
+            return false;
+        uint32_t due = s->last_seen + timeout_;
+        if (int32_t(due - now) > 0) {
+            *when = due;
+            return true;
+        }
+        evicted += sessions_.erase_at(slot, session_id);
+        return false;
+    }, budget > backlog ? budget : backlog);
+    if (checked) {
+        checked_.fetch_add(checked, std::memory_order_relaxed);
+        evicted_.fetch_add(evicted, std::memory_order_relaxed);
+    }
+    Epoch::try_advance();
+    retired_.store(sessions_.collect(), std::memory_order_relaxed);
+}
+
+void IdleEvictor::run()
+{
+    std::unique_lock<std::mutex> guard(lock_);
+    while (!stop_) {
+        guard.unlock();
+        advance(rdtsc(), UINT64_MAX);
+        guard.lock();
+        wake_.wait_for(guard, std::chrono::milliseconds(kPollMs), [this] { return stop_; });
+    }
+}
+
+IdleEvictor::Stats IdleEvictor::stats() const
+{
+    Stats s;
+    s.evicted = evicted_.load(std::memory_order_relaxed);
+    s.retired = retired_.load(std::memory_order_relaxed);
+    s.checked = checked_.load(std::memory_order_relaxed);
+    s.armed = wheel_.armed();
+    s.backlog = wheel_.backlog();
+    return s;
+}
+
+}
@@ -0,0 +1,111 @@
+// Expiry of idle sessions (LR_IDLE_TIMEOUT_MS).
+//
+// Sessions that go quiet without a close event would otherwise hold
+// their slot in the session table forever.  Every session gets a timer
+// in a TimingWheel when it is inserted; events only stamp the session
+// with the wheel's current tick.  When the timer comes up, a session
+// stamped within the timeout is re-armed for its new due time and one
+// that is not is erased.  So the wheel sees each live session about once
+// per timeout, however many events it gets.
+//
+// Ticks are TSC >> shift, about a millisecond.  The wheel is driven
+// either from the event path or by a housekeeping thread every 10 ms,
+// which keeps eviction off the event path entirely.  On the event path,
+// a call that sees the tick change moves the wheel on, and any call
+// that finds timers waiting runs a few of them: kPerEvent, or 1/16384 of
+// the backlog if that is more, so the backlog cannot grow without
+// bound when events are sparse.  Either way the wheel is taken with
+// try_lock, so no event ever waits for another thread's sweep.
+//
+// An event for a session that is being evicted at that moment may still
+// be writing to the erased slot; what it records is lost, as if it had
+// arrived just after the eviction.  Eviction can run on any thread, so
+// the slot is retired, not freed: the event path holds an lr::Epoch
+// guard while it uses a session, and each sweep moves the epoch on and
+// frees the slots retired two epochs ago.  No new session can be placed
+// in a slot an event still writes to.
+
+#ifndef LR_IDLE_EVICTOR_H
+#define LR_IDLE_EVICTOR_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "session.h"
+#include "session_table.h"
+#include "timing_wheel.h"
+
+namespace lr {
+
+class IdleEvictor {
+public:
+    typedef SessionTable<SessionState> Sessions;
+
+    struct Stats {
+        uint64_t evicted = 0;
+        // Timers that came up, for active sessions as well as idle ones.
+        uint64_t checked = 0;
+        uint64_t armed = 0;
+        // Timers that came up and have not been run yet.
+        uint64_t backlog = 0;
+        // Evicted slots waiting for the epoch before they can be reused.
+        uint64_t retired = 0;
+    };
+
+    IdleEvictor(Sessions& sessions, uint64_t timeout_ms, double tsc_hz, bool thread, bool prefault);
+    // Stops the housekeeping thread.
+    ~IdleEvictor();
+
+    IdleEvictor(const IdleEvictor&) = delete;
+    IdleEvictor& operator=(const IdleEvictor&) = delete;
+
+    bool ok() const { return wheel_.ok(); }
+    bool threaded() const { return thread_.joinable(); }
+    uint64_t timeout_ms() const { return timeout_ms_; }
+
+    // The tick to stamp a session's last_seen with.
+    uint32_t now() const { return wheel_.now(); }
+    // Starts the timer of a newly inserted session.
+    void arm(const SessionState* s) { wheel_.arm(sessions_.index(s)); }
+
+    // Event path: moves the wheel on and expires a few sessions, unless
+    // a housekeeping thread does that.
+    void poll(uint64_t tsc)
+    {
+        if (!thread_.joinable() && (uint32_t(tsc >> shift_) != wheel_.now() || wheel_.busy()))
+            advance(tsc, kPerEvent);
+    }
+
+    // Moves the wheel to `tsc` and runs up to `budget` of the timers
+    // waiting, unless another thread is already at it.
+    void advance(uint64_t tsc, uint64_t budget);
+
+    Stats stats() const;
+
+private:
+    static const uint64_t kPerEvent = 8;
+
+    void run();
+
+    Sessions& sessions_;
+    uint64_t timeout_ms_;
+    unsigned shift_;
+    uint32_t timeout_;
+    TimingWheel wheel_;
+    std::atomic<uint64_t> evicted_;
+    std::atomic<uint64_t> retired_;
+    std::atomic<uint64_t> checked_;
+    std::mutex advancing_;
+    std::mutex lock_;
+    std::condition_variable wake_;
+    bool stop_;
+    std::thread thread_;
+};
+
+}
+
+#endif
@@ -0,0 +1,110 @@
+// Per-session interarrival jitter (LR_JITTER), after RFC 3550 6.4.1.
+//
+// RFC 3550 compares the spacing of arrivals with the spacing of the
+// sender's timestamps, D = (Rj - Ri) - (Sj - Si), and smooths |D| as
+// J += (|D| - J) / 16.  Events carry no sender time, so the sender's
+// spacing is taken to be the sqn step times the session's mean interval
+// per sqn, itself a running average with the same gain.  A session that
+// sends on a steady clock then shows the variation the path added, and
+// lost sqns do not count as jitter.
+//
+// Like the rate limiter's TATs, the state lives in a flat array parallel
+// to the session table, indexed by slot: 16 bytes per session, updated
+// with integer arithmetic on the TSC read the caller already made.  Only
+// forward steps update it; reordered and duplicate arrivals are skipped.
+// A pause longer than kMaxInterval cycles per sqn restarts the spacing
+// without counting as jitter.  A given slot must only be used by one
+// thread at a time.
+
+#ifndef LR_JITTER_TRACKER_H
+#define LR_JITTER_TRACKER_H
+
+#include <stdint.h>
+#include <sys/mman.h>
+
+namespace lr {
+
+class JitterTracker {
+public:
+    static const uint64_t kMaxInterval = 1ull << 31;
+
+    struct Entry {
+        // TSC of the latest forward arrival.
+        uint64_t last;
+        // Mean cycles per sqn step; 0 until the second arrival.
+        uint32_t interval;
+        // J in cycles, times 16 as in RFC 3550 A.8.
+        uint32_t jitter;
+    };
+
+    JitterTracker(uint64_t slots, bool prefault)
+        : entries_(nullptr)
+        , slots_(slots)
+    {
+        if (slots == 0)
+            return;
+        void* p = mmap(nullptr, slots * sizeof(Entry), PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | (prefault ? MAP_POPULATE : 0), -1, 0);
+        if (p != MAP_FAILED)
+            entries_ = static_cast<Entry*>(p);
+    }
+
+    ~JitterTracker()
+    {
+        if (entries_)
+            munmap(entries_, slots_ * sizeof(Entry));
+    }
+
+    JitterTracker(const JitterTracker&) = delete;
+    JitterTracker& operator=(const JitterTracker&) = delete;
+
+    bool ok() const { return entries_ != nullptr; }
+    uint64_t bytes() const { return slots_ * sizeof(Entry); }
+
+    // The session in `slot` starts over with an arrival at `now`.
+    void start(uint64_t slot, uint64_t now)
+    {
+        Entry& e = entries_[slot];
+        e.last = now;
+        e.interval = 0;
+        e.jitter = 0;
+    }
+
+    // An arrival at `now`, `step` sqns past the previous forward one.
+    void update(uint64_t slot, uint64_t now, uint32_t step)
+    {
+        Entry& e = entries_[slot];
+        // Stamps may come from other cores, so take the gap as signed.
+        int64_t gap = int64_t(now - e.last);
+        e.last = now;
+        if (gap < 0)
+            gap = 0;
+        int64_t per = step == 1 ? gap : gap / int64_t(step);
+        if (uint64_t(per) >= kMaxInterval)
+            return;
+        if (e.interval == 0) {
+            e.interval = uint32_t(per ? per : 1);
+            return;
+        }
+        int64_t d = gap - int64_t(step) * int64_t(e.interval);
+        if (d < 0)
+            d = -d;
+        int64_t j = int64_t(e.jitter) + d - ((int64_t(e.jitter) + 8) >> 4);
+        e.jitter = j > int64_t(UINT32_MAX) ? UINT32_MAX : uint32_t(j);
+        int64_t interval = int64_t(e.interval) + (per - int64_t(e.interval)) / 16;
+        e.interval = uint32_t(interval > 0 ? interval : 1);
+    }
+
+    const Entry& entry(uint64_t slot) const { return entries_[slot]; }
+
+    // J in cycles.
+    static uint64_t jitter(const Entry& e) { return e.jitter >> 4; }
+
+private:
+    Entry* entries_;
+    uint64_t slots_;
+};
+
+}
+
+#endif
@@ -0,0 +1,241 @@
+// Hash map of byte-string keys to byte-string values for the key-value
+// responder (LR_KV).
+//
+// A fixed array of buckets, one per key the store is sized for, each the
+// head of a chain of immutable nodes holding the hash, key and value.
+// Readers walk chains inside an Epoch::Guard with acquire loads and take
+// no locks.  Writers lock the bucket's stripe, one of kStripes spinlocks,
+// and never change a node a reader may see: a put links a new node in
+// place of the old one, and the old one, like an erased one, is retired
+// to the epoch and freed once no reader can still hold it.
+//
+// The stripes and the bucket array are mapped once at load.  Nodes come
+// from malloc and are counted at their usable size, so node_bytes() is
+// what the keys and values really cost.
+
+#ifndef LR_KV_STORE_H
+#define LR_KV_STORE_H
+
+#include <malloc.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <atomic>
+
+#include "epoch.h"
+
+namespace lr {
+
+class KvStore {
+public:
+    enum Result { kOk, kNotFound, kFull };
+
+    static const uint32_t kStripes = 1024;
+
+    // Room for `capacity` keys, with a bucket for each, rounded up to a
+    // power of two.
+    KvStore(uint64_t capacity, bool prefault)
+        : stripes_(nullptr)
+        , buckets_(nullptr)
+        , mask_(0)
+        , capacity_(capacity)
+        , size_(0)
+        , node_bytes_(0)
+    {
+        uint64_t n = 1;
+        while (n < capacity)
+            n <<= 1;
+        size_t bytes = kStripes * sizeof(Stripe) + n * sizeof(Link);
+        void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (p == MAP_FAILED)
+            return;
+        madvise(p, bytes, MADV_HUGEPAGE);
+        stripes_ = static_cast<Stripe*>(p);
+        buckets_ = reinterpret_cast<Link*>(stripes_ + kStripes);
+        mask_ = n - 1;
+        if (prefault) {
+            for (uint64_t i = 0; i < n; i += 4096 / sizeof(Link))
+                buckets_[i].store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    // No thread may be using the store.  Nodes already retired are left
+    // to the epoch.
+    ~KvStore()
+    {
+        if (!buckets_)
+            return;
+        for (uint64_t b = 0; b <= mask_; ++b) {
+            Node* n = buckets_[b].load(std::memory_order_relaxed);
+            while (n) {
+                Node* next = n->next.load(std::memory_order_relaxed);
+                free(n);
+                n = next;
+            }
+        }
+        munmap(stripes_, kStripes * sizeof(Stripe) + (mask_ + 1) * sizeof(Link));
+    }
+
+    KvStore(const KvStore&) = delete;
+    KvStore& operator=(const KvStore&) = delete;
+
+    bool ok() const { return buckets_ != nullptr; }
+    uint64_t capacity() const { return capacity_; }
+    uint64_t size() const { return size_.load(std::memory_order_relaxed); }
+    uint64_t table_bytes() const { return buckets_ ? kStripes * sizeof(Stripe) + (mask_ + 1) * sizeof(Link) : 0; }
+    uint64_t node_bytes() const { return node_bytes_.load(std::memory_order_relaxed); }
+
+    // Calls copy(value, length) with the value of `key` if it has one and
+    // returns whether it did.  The value is only valid inside copy.
+    template <typename Copy>
+    bool get(const uint8_t* key, uint32_t key_length, Copy copy) const
+    {
+        uint64_t h = hash(key, key_length);
+        Epoch::Guard guard;
+        for (const Node* n = buckets_[h & mask_].load(std::memory_order_acquire); n;
+             n = n->next.load(std::memory_order_acquire)) {
+            if (n->matches(h, key, key_length)) {
+                copy(n->bytes() + n->key_length, n->value_length);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Sets `key` to `value`.  kFull if the key is new and the store holds
+    // capacity() keys already, or a node cannot be allocated.
+    Result put(const uint8_t* key, uint32_t key_length, const uint8_t* value, uint32_t value_length)
+    {
+        uint64_t h = hash(key, key_length);
+        Node* node = static_cast<Node*>(malloc(sizeof(Node) + key_length + value_length));
+        if (!node)
+            return kFull;
+        node->hash = h;
+        node->key_length = key_length;
+        node->value_length = value_length;
+        memcpy(node->bytes(), key, key_length);
+        memcpy(node->bytes() + key_length, value, value_length);
+        int64_t bytes = int64_t(malloc_usable_size(node));
+
+        uint64_t b = h & mask_;
+        Stripe& s = stripes_[b & (kStripes - 1)];
+        lock(s);
+        Link* link = &buckets_[b];
+        Node* old = find(link, h, key, key_length);
+        if (!old && size_.fetch_add(1, std::memory_order_relaxed) >= capacity_) {
+            size_.fetch_sub(1, std::memory_order_relaxed);
+            unlock(s);
+            free(node);
+            return kFull;
+        }
+        node->next.store(old ? old->next.load(std::memory_order_relaxed) : link->load(std::memory_order_relaxed),
+                         std::memory_order_relaxed);
+        link->store(node, std::memory_order_release);
+        unlock(s);
+        if (old) {
+            bytes -= int64_t(malloc_usable_size(old));
+            Epoch::retire(old);
+        }
+        node_bytes_.fetch_add(uint64_t(bytes), std::memory_order_relaxed);
+        return kOk;
+    }
+
+    // Removes `key`.  kNotFound if it had no value.
+    Result erase(const uint8_t* key, uint32_t key_length)
+    {
+        uint64_t h = hash(key, key_length);
+        uint64_t b = h & mask_;
+        Stripe& s = stripes_[b & (kStripes - 1)];
+        lock(s);
+        Link* link = &buckets_[b];
+        Node* old = find(link, h, key, key_length);
+        if (old) {
+            link->store(old->next.load(std::memory_order_relaxed), std::memory_order_release);
+            size_.fetch_sub(1, std::memory_order_relaxed);
+        }
+        unlock(s);
+        if (!old)
+            return kNotFound;
+        node_bytes_.fetch_sub(malloc_usable_size(old), std::memory_order_relaxed);
+        Epoch::retire(old);
+        return kOk;
+    }
+
+    static uint64_t hash(const uint8_t* p, uint32_t n)
+    {
+        uint64_t h = 0x9e3779b97f4a7c15ull ^ n;
+        for (; n >= 8; p += 8, n -= 8) {
+            uint64_t w;
+            memcpy(&w, p, 8);
+            h = (h ^ w) * 0xff51afd7ed558ccdull;
+            h ^= h >> 32;
+        }
+        if (n) {
+            uint64_t w = 0;
+            memcpy(&w, p, n);
+            h = (h ^ w) * 0xff51afd7ed558ccdull;
+        }
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ull;
+        h ^= h >> 33;
+        return h;
+    }
+
+private:
+    struct Node {
+        std::atomic<Node*> next;
+        uint64_t hash;
+        uint32_t key_length;
+        uint32_t value_length;
+
+        // The key, then the value.
+        uint8_t* bytes() { return reinterpret_cast<uint8_t*>(this + 1); }
+        const uint8_t* bytes() const { return reinterpret_cast<const uint8_t*>(this + 1); }
+
+        bool matches(uint64_t h, const uint8_t* key, uint32_t length) const
+        {
+            return hash == h && key_length == length && memcmp(bytes(), key, length) == 0;
+        }
+    };
+
+    typedef std::atomic<Node*> Link;
+
+    struct alignas(64) Stripe {
+        std::atomic<uint32_t> lock;
+    };
+
+    // The node holding `key` in the chain at *link, with *link left
+    // pointing at the link to it; nullptr if there is none.  The stripe
+    // must be locked.
+    static Node* find(Link*& link, uint64_t h, const uint8_t* key, uint32_t key_length)
+    {
+        for (Node* n = link->load(std::memory_order_relaxed); n; n = link->load(std::memory_order_relaxed)) {
+            if (n->matches(h, key, key_length))
+                return n;
+            link = &n->next;
+        }
+        return nullptr;
+    }
+
+    static void lock(Stripe& s)
+    {
+        while (s.lock.exchange(1, std::memory_order_acquire))
+            while (s.lock.load(std::memory_order_relaxed))
+                __builtin_ia32_pause();
+    }
+
+    static void unlock(Stripe& s) { s.lock.store(0, std::memory_order_release); }
+
+    Stripe* stripes_;
+    Link* buckets_;
+    uint64_t mask_;
+    uint64_t capacity_;
+    std::atomic<uint64_t> size_;
+    std::atomic<uint64_t> node_bytes_;
+};
+
+}
+
+#endif
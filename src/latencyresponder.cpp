@@ -0,0 +1,1520 @@
+#include "latencyresponder.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+
+#include "buffer_pool.h"
+#include "config.h"
+#include "counter.h"
+#include "dedup_cache.h"
+#include "epoch.h"
+#include "defer_queue.h"
+#include "flight_recorder.h"
+#include "histogram.h"
+#include "idle_evictor.h"
+#include "jitter_tracker.h"
+#include "kv_store.h"
+#include "per_thread.h"
+#include "rate_limiter.h"
+#include "session.h"
+#include "session_table.h"
+#include "shaper.h"
+#include "stats_segment.h"
+#include "trace_file.h"
+#include "tsc.h"
+#include "worker_pool.h"
+
+#define LR_EXPORT __attribute__((visibility("default")))
+
+// Hosts that register through lr_plugin_init need not provide it.
+#pragma weak ENSSessionNotify
+
+namespace {
+
+// Slots in the event-type dispatch table.  Types past the last slot
+// share it.
+const uint32_t kDispatchSlots = LR_UNKNOWN_TYPE_SLOTS;
+static_assert(LR_POOL_CLASSES == lr::BufferPool::kClasses, "LRPoolStats must cover every size class");
+static_assert(LR_SHAPE_TRUNCATE == lr::Shaper::kTruncate && LR_SHAPE_PAD == lr::Shaper::kPad &&
+                  LR_SHAPE_AMPLIFY == lr::Shaper::kAmplify,
+              "LR_SHAPE_* must match lr::Shaper::Mode");
+static_assert(LR_DEDUP_REPLAY == lr::DedupCache::kReplay && LR_DEDUP_SUPPRESS == lr::DedupCache::kSuppress,
+              "LR_DEDUP_* must match lr::DedupCache::Mode");
+static_assert(LR_STATS_BUCKETS == lr::Histogram::kBucketCount, "the stats segment must hold every bucket");
+// Notifications event_handler_batch collects before flushing them.
+const uint32_t kNotifyChunk = 256;
+
+// Everything event_handler records, one instance per calling thread.
+struct ThreadContext {
+    uint32_t events = 0;
+    lr::RecordingHistogram latency;
+    lr::Counter notifies;
+    // Events by type.
+    lr::Counter data_events;
+    lr::Counter opens;
+    lr::Counter reopens;
+    lr::Counter closes;
+    lr::Counter closes_unknown;
+    lr::Counter keepalives;
+    lr::Counter keepalives_unknown;
+    lr::Counter unknown[kDispatchSlots];
+    // Sequence tracking of data events, summed over this thread's sessions.
+    lr::Counter seq_gaps;
+    lr::Counter seq_reordered;
+    lr::Counter seq_duplicates;
+    lr::Counter seq_stale;
+    lr::Counter seq_resyncs;
+    // Residence stamping (LR_STAMP).
+    lr::Counter stamp_in_place;
+    lr::Counter stamp_copied;
+    lr::Counter stamp_skipped;
+    lr::Counter stamp_gathered;
+    // Payload bytes in and out while LR_SHAPE is on.
+    lr::Counter request_bytes;
+    lr::Counter response_bytes;
+    // Rate limiting (LR_RATE): data events dropped, held back, and held
+    // back ones answered since.
+    lr::Counter rate_dropped;
+    lr::Counter rate_deferred;
+    lr::Counter rate_released;
+    lr::DeferQueue deferred;
+    // Retransmit deduplication (LR_DEDUP): retransmits looked up and
+    // found, responses cached, the pairs they displaced, and responses
+    // too long to cache.
+    lr::Counter dedup_lookups;
+    lr::Counter dedup_hits;
+    lr::Counter dedup_inserts;
+    lr::Counter dedup_evictions;
+    lr::Counter dedup_too_large;
+    // Key-value commands (LR_KV).
+    lr::Counter kv_gets;
+    lr::Counter kv_hits;
+    lr::Counter kv_puts;
+    lr::Counter kv_deletes;
+    lr::Counter kv_full;
+    lr::Counter kv_bad;
+    lr::Counter kv_dropped;
+    // Clock probes (LR_CLOCK_PROBE) answered and dropped as malformed.
+    lr::Counter clock_probes;
+    lr::Counter clock_bad;
+    // A response a handler built itself, for its caller to send in the
+    // event's place: `out`, which may point at `data`, and a pool buffer
+    // to release once it is sent.
+    struct {
+        ENSUserData data;
+        ENSUserData* out;
+        uint8_t* held;
+    } answer = {};
+};
+
+typedef lr::SessionTable<lr::SessionState> Sessions;
+
+lr::TscClock g_clock;
+lr::TscWallClock g_wall_clock;
+// The host's notify: ENSSessionNotify as bound at load, or what
+// lr_plugin_init was handed.
+void (*g_notify)(uint32_t, uint32_t, ENSUserData*) = nullptr;
+void (*g_notify_batch)(const LRNotify*, uint32_t) = nullptr;
+void (*g_notify_vec)(uint32_t, uint32_t, const LRUserDataVec*) = nullptr;
+Sessions* g_sessions = nullptr;
+lr::RateLimiter* g_rate = nullptr;
+lr::JitterTracker* g_jitter = nullptr;
+lr::IdleEvictor* g_idle = nullptr;
+lr::DedupCache* g_dedup = nullptr;
+std::atomic<uint64_t> g_table_full(0);
+// Responses dropped for want of a notify to send them through.
+std::atomic<uint64_t> g_unbound(0);
+lr::WorkerPool* g_workers = nullptr;
+// Buffers for responses the plugin builds itself.
+lr::BufferPool* g_pool = nullptr;
+lr::StatsPublisher* g_publisher = nullptr;
+lr::Shaper* g_shaper = nullptr;
+lr::TraceRecorder* g_trace = nullptr;
+lr::FlightRecorder* g_flight = nullptr;
+lr::KvStore* g_kv = nullptr;
+// Whether every event needs its receive TSC, not only sampled ones.
+bool g_rx_tsc = false;
+// Whether responses differ from requests: key-value replies, shaped,
+// stamped or any mix.
+bool g_transform = false;
+// Whether event_handler only echoes data events: nothing is switched on
+// that looks at, counts or answers any other event.
+bool g_bare = false;
+// Whether data events are only counted, sampled into the histogram and
+// echoed: no session table, no response changes, no trace, flight
+// recorder or workers.
+bool g_counted = false;
+
+void handle_queued(const lr::AsyncEvent& e, ENSUserData* data);
+void notify_unbound(uint32_t session_id, uint32_t sqn, ENSUserData* data);
+bool defer(ThreadContext& ctx, uint32_t session_id, uint32_t sqn, ENSUserData* data, uint64_t rx_tsc, uint64_t due);
+void collect_stats(LRStatsSnapshot& out);
+
+// Sets the flags that pick event_handler's path from what is switched on.
+void choose_paths()
+{
+    g_counted = !g_sessions && !g_transform && !g_trace && !g_flight && !g_workers;
+    g_bare = g_counted && !lr::g_config.histogram && !lr::g_config.clock_probe && !g_publisher;
+}
+
+__attribute__((constructor)) void plugin_load()
+{
+    lr::load_config();
+    g_clock.start();
+    if (lr::g_config.stamp || lr::g_config.clock_probe)
+        g_wall_clock.calibrate(g_clock.hz());
+    if (lr::g_config.shape_mode != lr::Shaper::kEcho) {
+        g_shaper = new lr::Shaper(lr::Shaper::Mode(lr::g_config.shape_mode), lr::g_config.shape_bytes,
+                                  lr::g_config.shape_ratio);
+        if (!g_shaper->ok()) {
+            fprintf(stderr, "latencyresponder: ignoring LR_SHAPE, cannot map its fill buffer\n");
+            delete g_shaper;
+            g_shaper = nullptr;
+        }
+    }
+    if (lr::g_config.kv_keys) {
+        g_kv = new lr::KvStore(lr::g_config.kv_keys, true);
+        if (!g_kv->ok()) {
+            fprintf(stderr, "latencyresponder: cannot map a key-value store for %llu keys\n",
+                    (unsigned long long)lr::g_config.kv_keys);
+            delete g_kv;
+            g_kv = nullptr;
+        }
+    }
+    g_transform = lr::g_config.stamp || g_shaper || g_kv;
+    if (lr::g_config.trace_path[0]) {
+        g_trace = new lr::TraceRecorder(lr::g_config.trace_path, lr::g_config.trace_bytes, lr::g_config.trace_prefix,
+                                        lr::g_config.trace_threads, g_clock);
+        if (!g_trace->ok()) {
+            fprintf(stderr, "latencyresponder: cannot create trace file %s\n", lr::g_config.trace_path);
+            delete g_trace;
+            g_trace = nullptr;
+        }
+    }
+    if (lr::g_config.flight_slo_ns) {
+        double hz = g_clock.hz();
+        g_flight = new lr::FlightRecorder(lr::g_config.flight_events,
+                                          uint64_t(double(lr::g_config.flight_slo_ns) * hz / 1e9),
+                                          lr::g_config.flight_dir, lr::g_config.flight_max_dumps, hz);
+    }
+    g_notify = ENSSessionNotify ? ENSSessionNotify : notify_unbound;
+    if (lr::g_config.batch_notify && ENSSessionNotifyBatch)
+        g_notify_batch = ENSSessionNotifyBatch;
+    if (lr::g_config.gather_notify && ENSSessionNotifyVec)
+        g_notify_vec = ENSSessionNotifyVec;
+    if (lr::g_config.max_sessions) {
+        g_sessions = new Sessions(lr::g_config.max_sessions, lr::g_config.prefault_sessions);
+        if (!g_sessions->ok()) {
+            delete g_sessions;
+            g_sessions = nullptr;
+        }
+    }
+    if (lr::g_config.rate && !g_sessions) {
+        fprintf(stderr, "latencyresponder: ignoring LR_RATE, it needs the session table\n");
+    } else if (lr::g_config.rate) {
+        double hz = g_clock.hz();
+        g_rate = new lr::RateLimiter(g_sessions->capacity(), uint64_t(hz / double(lr::g_config.rate)),
+                                     lr::g_config.rate_burst, uint64_t(lr::g_config.rate_defer_us * hz / 1e6),
+                                     lr::g_config.prefault_sessions);
+        if (!g_rate->ok()) {
+            delete g_rate;
+            g_rate = nullptr;
+        }
+    }
+    if (lr::g_config.jitter && !g_sessions) {
+        fprintf(stderr, "latencyresponder: ignoring LR_JITTER, it needs the session table\n");
+    } else if (lr::g_config.jitter) {
+        g_jitter = new lr::JitterTracker(g_sessions->capacity(), lr::g_config.prefault_sessions);
+        if (!g_jitter->ok()) {
+            delete g_jitter;
+            g_jitter = nullptr;
+        }
+    }
+    if (lr::g_config.idle_timeout_ms && !g_sessions) {
+        fprintf(stderr, "latencyresponder: ignoring LR_IDLE_TIMEOUT_MS, it needs the session table\n");
+    } else if (lr::g_config.idle_timeout_ms) {
+        g_idle = new lr::IdleEvictor(*g_sessions, lr::g_config.idle_timeout_ms, g_clock.hz(), lr::g_config.idle_thread,
+                                     lr::g_config.prefault_sessions);
+        if (!g_idle->ok()) {
+            delete g_idle;
+            g_idle = nullptr;
+        }
+    }
+    if (lr::g_config.dedup_mode != lr::DedupCache::kOff && !g_sessions) {
+        fprintf(stderr, "latencyresponder: ignoring LR_DEDUP, it needs the session table\n");
+    } else if (lr::g_config.dedup_mode != lr::DedupCache::kOff) {
+        g_dedup = new lr::DedupCache(lr::DedupCache::Mode(lr::g_config.dedup_mode), lr::g_config.dedup_entries,
+                                     lr::g_config.dedup_bytes);
+        if (!g_dedup->ok()) {
+            delete g_dedup;
+            g_dedup = nullptr;
+        }
+    }
+    // Only responses the plugin builds or holds back itself take buffers.
+    if (lr::g_config.stamp || g_kv || (g_dedup && g_dedup->mode() == lr::DedupCache::kReplay) ||
+        (g_rate && g_rate->defers()))
+        g_pool = new lr::BufferPool(lr::g_config.pool_buffers);
+    g_rx_tsc = lr::g_config.stamp || g_trace || g_flight || g_rate || g_jitter || (g_idle && !g_idle->threaded());
+    if (lr::g_config.workers)
+        g_workers = new lr::WorkerPool(lr::g_config.workers, lr::g_config.ring_bytes, handle_queued);
+    if (lr::g_config.shm_interval_ms) {
+        g_publisher = new lr::StatsPublisher(lr::g_config.shm_name, lr::g_config.shm_interval_ms, g_clock.hz(),
+                                             collect_stats);
+        if (!g_publisher->ok()) {
+            delete g_publisher;
+            g_publisher = nullptr;
+        }
+    }
+    choose_paths();
+}
+
+__attribute__((destructor)) void plugin_unload()
+{
+    delete g_publisher;
+    g_publisher = nullptr;
+    delete g_workers;
+    g_workers = nullptr;
+    delete g_dedup;
+    g_dedup = nullptr;
+    delete g_idle;
+    g_idle = nullptr;
+    delete g_rate;
+    g_rate = nullptr;
+    delete g_jitter;
+    g_jitter = nullptr;
+    delete g_sessions;
+    g_sessions = nullptr;
+    delete g_flight;
+    g_flight = nullptr;
+    delete g_trace;
+    g_trace = nullptr;
+    delete g_shaper;
+    g_shaper = nullptr;
+    delete g_kv;
+    g_kv = nullptr;
+    lr::Epoch::reclaim_all();
+    delete g_pool;
+    g_pool = nullptr;
+}
+
+// g_notify when the host exports no ENSSessionNotify, until
+// lr_plugin_init hands over its notify.
+void notify_unbound(uint32_t, uint32_t, ENSUserData*)
+{
+    if (g_unbound.fetch_add(1, std::memory_order_relaxed) == 0)
+        fprintf(stderr, "latencyresponder: dropping responses, the host neither exports ENSSessionNotify nor "
+                        "called lr_plugin_init\n");
+}
+
+lr::SeqWindow::Result track_sequence(ThreadContext& ctx, lr::SeqWindow& seq, uint32_t sqn)
+{
+    uint32_t gaps = seq.gaps;
+    lr::SeqWindow::Result r = seq.update(sqn);
+    switch (r) {
+    case lr::SeqWindow::kFirst:
+    case lr::SeqWindow::kInOrder:
+        break;
+    case lr::SeqWindow::kGap:
+        ctx.seq_gaps.add(seq.gaps - gaps);
+        break;
+    case lr::SeqWindow::kReordered:
+        ctx.seq_reordered.add();
+        break;
+    case lr::SeqWindow::kDuplicate:
+        ctx.seq_duplicates.add();
+        break;
+    case lr::SeqWindow::kStale:
+        ctx.seq_stale.add();
+        break;
+    case lr::SeqWindow::kResync:
+        ctx.seq_resyncs.add();
+        break;
+    }
+    return r;
+}
+
+// Answers a retransmit from the dedup cache: in replay mode leaves a
+// copy of the response the pair got in ctx.answer, in suppress mode
+// drops it.  Returns false if the pair is not cached; the event is then
+// handled like a new one.
+bool retransmit(ThreadContext& ctx, uint32_t session_id, uint32_t sqn)
+{
+    ctx.dedup_lookups.add();
+    ENSUserData copy = {0, nullptr};
+    bool copied = true;
+    bool hit = g_dedup->lookup(session_id, sqn, [&](const ENSUserData* cached) {
+        if (!cached)
+            return;
+        copy.p = static_cast<uint8_t*>(g_pool->alloc(cached->length));
+        copied = copy.p != nullptr;
+        if (copied) {
+            copy.length = cached->length;
+            memcpy(copy.p, cached->p, cached->length);
+        }
+    });
+    if (!hit || !copied)
+        return false;
+    ctx.dedup_hits.add();
+    if (g_dedup->mode() == lr::DedupCache::kReplay) {
+        ctx.answer.data = copy;
+        ctx.answer.out = copy.p ? &ctx.answer.data : nullptr;
+        ctx.answer.held = copy.p;
+    }
+    return true;
+}
+
+// Caches the response to (session_id, sqn), sent as `count` segments,
+// for its retransmits.
+void remember(ThreadContext& ctx, uint32_t session_id, uint32_t sqn, const ENSUserData* segments, uint32_t count)
+{
+    bool evicted = false;
+    if (!g_dedup->insert(session_id, sqn, segments, count, &evicted)) {
+        ctx.dedup_too_large.add();
+        return;
+    }
+    ctx.dedup_inserts.add();
+    if (evicted)
+        ctx.dedup_evictions.add();
+}
+
+inline void remember(ThreadContext& ctx, uint32_t session_id, uint32_t sqn, const ENSUserData* data)
+{
+    remember(ctx, session_id, sqn, data, data ? 1 : 0);
+}
+
+// A session that just got its slot, or started over in it: what the
+// per-slot side tables kept for the slot's previous occupant goes.
+void restart_slot(const lr::SessionState* s, uint64_t now)
+{
+    uint64_t slot = g_sessions->index(s);
+    if (g_rate)
+        g_rate->reset(slot);
+    if (g_jitter)
+        g_jitter->start(slot, now);
+}
+
+// Runs a session's data event past its token bucket.  Returns whether to
+// answer it now.
+bool admit(ThreadContext& ctx, const lr::SessionState* s, uint32_t session_id, uint32_t sqn, ENSUserData* data,
+           uint64_t rx_tsc)
+{
+    uint64_t slot = g_sessions->index(s);
+    uint64_t due = 0;
+    bool can_defer = g_rate->defers() && !ctx.deferred.full(lr::g_config.rate_queue);
+    switch (g_rate->admit(slot, rx_tsc, can_defer, &due)) {
+    case lr::RateLimiter::kAdmit:
+        return true;
+    case lr::RateLimiter::kDefer:
+        if (defer(ctx, session_id, sqn, data, rx_tsc, due)) {
+            ctx.rate_deferred.add();
+            return false;
+        }
+        break;
+    case lr::RateLimiter::kDrop:
+        break;
+    }
+    ctx.rate_dropped.add();
+    return false;
+}
+
+// Feeds a data event's receive stamp to the session's jitter estimate.
+// `step` is how far sqn moved the session's highest sqn.
+void track_jitter(const lr::SessionState* s, lr::SeqWindow::Result seq, uint32_t step, uint64_t rx_tsc)
+{
+    uint64_t slot = g_sessions->index(s);
+    switch (seq) {
+    case lr::SeqWindow::kFirst:
+    case lr::SeqWindow::kResync:
+        g_jitter->start(slot, rx_tsc);
+        break;
+    case lr::SeqWindow::kInOrder:
+    case lr::SeqWindow::kGap:
+        g_jitter->update(slot, rx_tsc, step);
+        break;
+    default:
+        break;
+    }
+}
+
+// What to send for an event, as its handler decides.
+enum Reply {
+    kNoReply,
+    // The response to the event's payload, built as configured.
+    kRespond,
+    // ctx.answer as it is: a replayed retransmit or a probe's answer.
+    kAnswer,
+};
+
+// Event handlers, one per event type.  Each does the per-session
+// bookkeeping for one event and returns whether to notify it.
+typedef bool (*EventFn)(ThreadContext& ctx, uint32_t session_id, uint32_t event_type, uint32_t sqn);
+
+// Data events also take the payload and receive stamp, which the rate
+// limiter needs, so they never go through the EventFn table.
+inline Reply on_data(ThreadContext& ctx, uint32_t session_id, uint32_t event_type, uint32_t sqn, ENSUserData* data,
+                     uint64_t rx_tsc)
+{
+    ctx.data_events.add();
+    if (!g_sessions)
+        return kRespond;
+    bool inserted = false;
+    lr::SessionState* s = g_sessions->find_or_insert(session_id, &inserted);
+    if (!s) {
+        g_table_full.fetch_add(1, std::memory_order_relaxed);
+        return kRespond;
+    }
+    if (inserted)
+        restart_slot(s, rx_tsc);
+    ++s->events;
+    s->last_event_type = event_type;
+    if (g_idle) {
+        s->last_seen = g_idle->now();
+        if (inserted)
+            g_idle->arm(s);
+    }
+    uint32_t highest = s->seq.highest;
+    lr::SeqWindow::Result seq = track_sequence(ctx, s->seq, sqn);
+    if (g_jitter)
+        track_jitter(s, seq, sqn - highest, rx_tsc);
+    if (g_dedup && (seq == lr::SeqWindow::kDuplicate || seq == lr::SeqWindow::kStale) &&
+        retransmit(ctx, session_id, sqn)) {
+        if (g_dedup->mode() != lr::DedupCache::kReplay)
+            return kNoReply;
+        ++s->notifies;
+        return kAnswer;
+    }
+    if (g_rate && !admit(ctx, s, session_id, sqn, data, rx_tsc))
+        return kNoReply;
+    ++s->notifies;
+    return kRespond;
+}
+
+bool on_open(ThreadContext& ctx, uint32_t session_id, uint32_t event_type, uint32_t)
+{
+    ctx.opens.add();
+    if (!g_sessions)
+        return false;
+    bool inserted = false;
+    lr::SessionState* s = g_sessions->find_or_insert(session_id, &inserted);
+    if (!s) {
+        g_table_full.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    if (!inserted) {
+        // The id was reused without a close: the new session starts over.
+        ctx.reopens.add();
+        *s = lr::SessionState();
+    }
+    restart_slot(s, g_jitter ? lr::rdtsc() : 0);
+    s->events = 1;
+    s->last_event_type = event_type;
+    if (g_idle) {
+        s->last_seen = g_idle->now();
+        if (inserted)
+            g_idle->arm(s);
+    }
+    return false;
+}
+
+bool on_close(ThreadContext& ctx, uint32_t session_id, uint32_t, uint32_t)
+{
+    ctx.closes.add();
+    if (!g_sessions || !g_sessions->erase(session_id))
+        ctx.closes_unknown.add();
+    return false;
+}
+
+bool on_keepalive(ThreadContext& ctx, uint32_t session_id, uint32_t event_type, uint32_t)
+{
+    ctx.keepalives.add();
+    lr::SessionState* s = g_sessions ? g_sessions->find(session_id) : nullptr;
+    if (!s) {
+        ctx.keepalives_unknown.add();
+        return false;
+    }
+    ++s->events;
+    s->last_event_type = event_type;
+    if (g_idle)
+        s->last_seen = g_idle->now();
+    return false;
+}
+
+// Clock probes take the payload and receive stamp as well, and are
+// answered in place, bypassing LR_SHAPE and the rest.  t2 is the receive
+// stamp when there is one, which makes it the time event_handler was
+// entered (or the event queued) rather than now.
+Reply on_probe(ThreadContext& ctx, ENSUserData* data, uint64_t rx_tsc)
+{
+    LRClockProbe probe;
+    if (!data || data->length < sizeof(probe)) {
+        ctx.clock_bad.add();
+        return kNoReply;
+    }
+    memcpy(&probe, data->p, sizeof(probe));
+    if (probe.magic != LR_CLOCK_PROBE_MAGIC) {
+        ctx.clock_bad.add();
+        return kNoReply;
+    }
+    uint64_t t2 = g_rx_tsc ? rx_tsc : lr::rdtsc();
+    g_wall_clock.sync(t2);
+    probe.t2_ns = g_wall_clock.to_ns(t2);
+    probe.t3_ns = g_wall_clock.to_ns(lr::rdtsc());
+    memcpy(data->p, &probe, sizeof(probe));
+    ctx.clock_probes.add();
+    ctx.answer.out = data;
+    ctx.answer.held = nullptr;
+    return kAnswer;
+}
+
+// Handler<T>::handle is the handler for event type T; types without a
+// specialization are counted as unknown in slot T.
+template <uint32_t Type>
+struct Handler {
+    static bool handle(ThreadContext& ctx, uint32_t, uint32_t, uint32_t)
+    {
+        ctx.unknown[Type].add();
+        return false;
+    }
+};
+
+template <>
+struct Handler<LR_EVENT_SESSION_OPEN> {
+    static bool handle(ThreadContext& ctx, uint32_t id, uint32_t type, uint32_t sqn) { return on_open(ctx, id, type, sqn); }
+};
+
+template <>
+struct Handler<LR_EVENT_SESSION_CLOSE> {
+    static bool handle(ThreadContext& ctx, uint32_t id, uint32_t type, uint32_t sqn) { return on_close(ctx, id, type, sqn); }
+};
+
+template <>
+struct Handler<LR_EVENT_KEEPALIVE> {
+    static bool handle(ThreadContext& ctx, uint32_t id, uint32_t type, uint32_t sqn) { return on_keepalive(ctx, id, type, sqn); }
+};
+
+// Dispatch<kDispatchSlots>::table lists Handler<0>::handle through
+// Handler<kDispatchSlots - 1>::handle, built at compile time.
+template <uint32_t N, uint32_t... Types>
+struct Dispatch : Dispatch<N - 1, N - 1, Types...> {
+};
+
+template <uint32_t... Types>
+struct Dispatch<0, Types...> {
+    static constexpr EventFn table[sizeof...(Types)] = {&Handler<Types>::handle...};
+};
+
+template <uint32_t... Types>
+constexpr EventFn Dispatch<0, Types...>::table[sizeof...(Types)];
+
+static_assert(LR_EVENT_KEEPALIVE < kDispatchSlots - 1 && LR_EVENT_CLOCK_PROBE < kDispatchSlots - 1,
+              "handled types need their own dispatch slot");
+
+// Events that take neither payload nor receive stamp, through the table.
+inline bool on_other(ThreadContext& ctx, uint32_t session_id, uint32_t event_type, uint32_t sqn)
+{
+    uint32_t slot = event_type < kDispatchSlots - 1 ? event_type : kDispatchSlots - 1;
+    return Dispatch<kDispatchSlots>::table[slot](ctx, session_id, event_type, sqn);
+}
+
+// Data events, the common case, are handled inline behind the same single
+// compare event_handler always made; everything else goes through the
+// table.  `rx_tsc` is only valid when g_rx_tsc is set.
+inline Reply dispatch_event(ThreadContext& ctx, uint32_t session_id, uint32_t event_type, uint32_t sqn,
+                            ENSUserData* data, uint64_t rx_tsc)
+{
+    if (__builtin_expect(event_type == LR_EVENT_DATA, 1))
+        return on_data(ctx, session_id, event_type, sqn, data, rx_tsc);
+    if (event_type == LR_EVENT_CLOCK_PROBE && lr::g_config.clock_probe)
+        return on_probe(ctx, data, rx_tsc);
+    return on_other(ctx, session_id, event_type, sqn) ? kRespond : kNoReply;
+}
+
+// With idle expiry another thread may evict the session while a handler
+// uses it; the guard keeps its slot from being reused meanwhile.
+inline Reply on_event(ThreadContext& ctx, uint32_t session_id, uint32_t event_type, uint32_t sqn, ENSUserData* data,
+                      uint64_t rx_tsc)
+{
+    if (__builtin_expect(g_idle != nullptr, 0)) {
+        lr::Epoch::Guard guard;
+        return dispatch_event(ctx, session_id, event_type, sqn, data, rx_tsc);
+    }
+    return dispatch_event(ctx, session_id, event_type, sqn, data, rx_tsc);
+}
+
+// Whether `data` ends in a trailer with LR_STAMP_MAGIC, to be stamped
+// where it is.
+bool has_trailer(const ENSUserData* data)
+{
+    uint32_t magic = 0;
+    if (data->length >= sizeof(LRStampTrailer))
+        memcpy(&magic, data->p + data->length - sizeof(LRStampTrailer), sizeof(magic));
+    return magic == LR_STAMP_MAGIC;
+}
+
+void fill_trailer(LRStampTrailer& t, uint64_t rx_tsc)
+{
+    t.magic = LR_STAMP_MAGIC;
+    t.flags = 0;
+    g_wall_clock.sync(rx_tsc);
+    t.rx_ns = g_wall_clock.to_ns(rx_tsc);
+    t.tx_ns = g_wall_clock.to_ns(lr::rdtsc());
+}
+
+// Writes receive and send times into the response.  A payload that ends
+// in a trailer with LR_STAMP_MAGIC is stamped where it is and returned;
+// any other payload is copied into a pool buffer with a trailer
+// appended, described by `copy`, and the caller releases copy.p once
+// the response is sent.  Payloads too large for the largest pool buffer
+// go out unstamped.
+ENSUserData* stamp_response(ThreadContext& ctx, ENSUserData* data, uint64_t rx_tsc, ENSUserData& copy)
+{
+    LRStampTrailer t;
+    const uint32_t size = sizeof(t);
+    if (!data)
+        return data;
+    uint8_t* at;
+    ENSUserData* out;
+    if (has_trailer(data)) {
+        at = data->p + data->length - size;
+        out = data;
+        ctx.stamp_in_place.add();
+    } else {
+        uint8_t* buf = nullptr;
+        if (data->length <= lr::BufferPool::kMaxSize - size)
+            buf = static_cast<uint8_t*>(g_pool->alloc(data->length + size));
+        if (!buf) {
+            ctx.stamp_skipped.add();
+            return data;
+        }
+        memcpy(buf, data->p, data->length);
+        at = buf + data->length;
+        copy.length = data->length + size;
+        copy.p = buf;
+        out = &copy;
+        ctx.stamp_copied.add();
+    }
+    fill_trailer(t, rx_tsc);
+    memcpy(at, &t, size);
+    return out;
+}
+
+// Whether the response `data` is to be stamped by sending it and a
+// trailer as two segments rather than by copying it.
+inline bool gathers_stamp(const ENSUserData* data)
+{
+    return g_notify_vec && data && data->length <= UINT32_MAX - sizeof(LRStampTrailer) && !has_trailer(data);
+}
+
+// Sends `data` followed by a freshly stamped trailer, as two segments.
+void notify_stamped(ThreadContext& ctx, uint32_t session_id, uint32_t sqn, const ENSUserData* data, uint64_t rx_tsc)
+{
+    LRStampTrailer t;
+    ENSUserData segments[2] = {{data->length, data->p}, {sizeof(t), reinterpret_cast<uint8_t*>(&t)}};
+    LRUserDataVec v = {data->length + uint32_t(sizeof(t)), 2, segments};
+    fill_trailer(t, rx_tsc);
+    ctx.stamp_gathered.add();
+    g_notify_vec(session_id, sqn, &v);
+    if (g_dedup)
+        remember(ctx, session_id, sqn, segments, 2);
+}
+
+// Runs the LR_KV command in `data` and returns the reply, built in a
+// pool buffer that `reply` describes; the caller releases reply.p once
+// the response is sent.  Returns nullptr, with nothing to release, if
+// no buffer can be had.
+ENSUserData* kv_reply(ThreadContext& ctx, const ENSUserData* data, ENSUserData& reply)
+{
+    LRKvHeader h = {0, 0, 0, 0};
+    uint8_t status = LR_KV_BAD_REQUEST;
+    bool found = false;
+    reply.length = sizeof(h);
+    reply.p = nullptr;
+    if (data && data->length >= sizeof(h))
+        memcpy(&h, data->p, sizeof(h));
+    const uint8_t* key = data ? data->p + sizeof(h) : nullptr;
+    bool valid = data && data->length >= sizeof(h) && h.status == 0 && h.key_length &&
+                 h.value_length <= LR_KV_MAX_VALUE &&
+                 uint64_t(sizeof(h)) + h.key_length + h.value_length == data->length &&
+                 (h.op == LR_KV_PUT || h.value_length == 0);
+    if (valid && h.op == LR_KV_GET) {
+        ctx.kv_gets.add();
+        found = g_kv->get(key, h.key_length, [&](const uint8_t* value, uint32_t length) {
+            reply.p = static_cast<uint8_t*>(g_pool->alloc(sizeof(h) + length));
+            if (reply.p) {
+                memcpy(reply.p + sizeof(h), value, length);
+                reply.length += length;
+            }
+        });
+        if (found && !reply.p)
+            return nullptr;
+        status = found ? LR_KV_OK : LR_KV_NOT_FOUND;
+        if (found)
+            ctx.kv_hits.add();
+    } else if (valid && h.op == LR_KV_PUT) {
+        ctx.kv_puts.add();
+        status = g_kv->put(key, h.key_length, key + h.key_length, h.value_length) == lr::KvStore::kOk ? LR_KV_OK
+                                                                                                   : LR_KV_FULL;
+        if (status == LR_KV_FULL)
+            ctx.kv_full.add();
+    } else if (valid && h.op == LR_KV_DELETE) {
+        ctx.kv_deletes.add();
+        status = g_kv->erase(key, h.key_length) == lr::KvStore::kOk ? LR_KV_OK : LR_KV_NOT_FOUND;
+    } else {
+        ctx.kv_bad.add();
+    }
+    if (!found) {
+        reply.p = static_cast<uint8_t*>(g_pool->alloc(sizeof(h)));
+        if (!reply.p)
+            return nullptr;
+    }
+    LRKvHeader out = {h.op, status, 0, reply.length - uint32_t(sizeof(h))};
+    memcpy(reply.p, &out, sizeof(out));
+    return &reply;
+}
+
+// The response to `data` as LR_SHAPE has it, with `shaped` the caller's
+// storage for the descriptor.
+inline ENSUserData* shape_response(ThreadContext& ctx, ENSUserData* data, ENSUserData& shaped)
+{
+    if (g_shaper) {
+        ctx.request_bytes.add(data ? data->length : 0);
+        data = g_shaper->shape(data, shaped);
+        ctx.response_bytes.add(data ? data->length : 0);
+    }
+    return data;
+}
+
+// A response being built: where it ended up, and the storage for the
+// descriptors that may point to.
+struct Response {
+    ENSUserData* out;
+    ENSUserData reply;
+    ENSUserData shaped;
+    ENSUserData copy;
+    // Whether `out` still has to go out with a trailer, as two segments.
+    bool gather;
+};
+
+// Builds the response to `data`: the LR_KV reply to it, or `data` itself,
+// shaped by LR_SHAPE and then stamped if LR_STAMP asks for it, left for
+// notify_stamped() when `gather` is set and gathers_stamp() agrees.  A
+// shaped response may point into the shaper's read-only fill buffer, but
+// that never ends in LR_STAMP_MAGIC, so it is never stamped in place.
+// Returns false, with nothing to release, if the response is dropped
+// for want of a buffer; otherwise release_response() gives back its
+// buffers once it is sent.
+bool build_response(ThreadContext& ctx, ENSUserData* data, uint64_t rx_tsc, bool gather, Response& r)
+{
+    r.reply.p = nullptr;
+    r.gather = false;
+    if (g_kv) {
+        data = kv_reply(ctx, data, r.reply);
+        if (!data) {
+            ctx.kv_dropped.add();
+            return false;
+        }
+    }
+    data = shape_response(ctx, data, r.shaped);
+    if (lr::g_config.stamp) {
+        r.gather = gather && gathers_stamp(data);
+        if (!r.gather)
+            data = stamp_response(ctx, data, rx_tsc, r.copy);
+    }
+    r.out = data;
+    return true;
+}
+
+void release_response(const Response& r)
+{
+    if (r.reply.p)
+        g_pool->release(r.reply.p);
+    if (r.out == &r.copy)
+        g_pool->release(r.copy.p);
+}
+
+// Sends one response, shaped and stamped as configured.
+inline void respond(ThreadContext& ctx, uint32_t session_id, uint32_t sqn, ENSUserData* data, uint64_t rx_tsc)
+{
+    if (!g_transform) {
+        ctx.notifies.add();
+        g_notify(session_id, sqn, data);
+        if (g_dedup)
+            remember(ctx, session_id, sqn, data);
+        return;
+    }
+    Response r;
+    if (!build_response(ctx, data, rx_tsc, true, r))
+        return;
+    ctx.notifies.add();
+    if (r.gather) {
+        notify_stamped(ctx, session_id, sqn, r.out, rx_tsc);
+    } else {
+        g_notify(session_id, sqn, r.out);
+        if (g_dedup)
+            remember(ctx, session_id, sqn, r.out);
+    }
+    release_response(r);
+}
+
+// Sends what the handler of an event asked for: the response to `data`,
+// or the answer it built.
+inline void reply(ThreadContext& ctx, Reply r, uint32_t session_id, uint32_t sqn, ENSUserData* data, uint64_t rx_tsc)
+{
+    if (r == kRespond) {
+        respond(ctx, session_id, sqn, data, rx_tsc);
+        return;
+    }
+    ctx.notifies.add();
+    g_notify(session_id, sqn, ctx.answer.out);
+    if (ctx.answer.held)
+        g_pool->release(ctx.answer.held);
+}
+
+// Holds back the response to an event the rate limiter deferred, with a
+// copy of its payload.  Returns false if there is no room for it.
+bool defer(ThreadContext& ctx, uint32_t session_id, uint32_t sqn, ENSUserData* data, uint64_t rx_tsc, uint64_t due)
+{
+    lr::DeferQueue::Entry e;
+    e.due = due;
+    e.rx_tsc = rx_tsc;
+    e.session_id = session_id;
+    e.sqn = sqn;
+    e.data.length = 0;
+    e.data.p = nullptr;
+    if (data) {
+        e.data.length = data->length;
+        e.data.p = static_cast<uint8_t*>(g_pool->alloc(data->length));
+        if (!e.data.p)
+            return false;
+        memcpy(e.data.p, data->p, data->length);
+    }
+    if (!ctx.deferred.push(e, lr::g_config.rate_queue)) {
+        g_pool->release(e.data.p);
+        return false;
+    }
+    return true;
+}
+
+// Answers every held-back response due by `now`.
+void release_deferred(ThreadContext& ctx, uint64_t now)
+{
+    while (ctx.deferred.due(now)) {
+        lr::DeferQueue::Entry e = ctx.deferred.pop();
+        respond(ctx, e.session_id, e.sqn, e.data.p ? &e.data : nullptr, e.rx_tsc);
+        if (e.data.p)
+            g_pool->release(e.data.p);
+        ctx.rate_released.add();
+    }
+}
+
+// Notifies every data event in events[0, count) one call at a time.
+// Returns the number of notifications.
+uint32_t notify_each(ThreadContext& ctx, const LREvent* events, uint32_t count, uint64_t rx_tsc)
+{
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        const LREvent& e = events[i];
+        Reply r = on_event(ctx, e.session_id, e.event_type, e.sqn, e.data, rx_tsc);
+        if (r == kNoReply)
+            continue;
+        reply(ctx, r, e.session_id, e.sqn, e.data, rx_tsc);
+        ++n;
+    }
+    return n;
+}
+
+// Responses of one event_handler_batch chunk, and the pool buffers they
+// hold until the chunk is sent.
+struct NotifyChunk {
+    LRNotify out[kNotifyChunk];
+    Response responses[kNotifyChunk];
+    // Up to a reply and a copy per response.
+    uint8_t* held[2 * kNotifyChunk];
+    uint32_t n = 0;
+    uint32_t nheld = 0;
+
+    void flush()
+    {
+        g_notify_batch(out, n);
+        for (uint32_t i = 0; i < nheld; ++i)
+            g_pool->release(held[i]);
+        n = 0;
+        nheld = 0;
+    }
+};
+
+// Same through the host's batched notify, in chunks of kNotifyChunk.
+uint32_t notify_batched(ThreadContext& ctx, const LREvent* events, uint32_t count, uint64_t rx_tsc)
+{
+    NotifyChunk chunk;
+    uint32_t total = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        const LREvent& e = events[i];
+        Reply r = on_event(ctx, e.session_id, e.event_type, e.sqn, e.data, rx_tsc);
+        if (r == kNoReply)
+            continue;
+        uint32_t n = chunk.n;
+        ENSUserData* data = e.data;
+        if (r == kAnswer) {
+            // ctx.answer is reused by the next event.
+            data = ctx.answer.out;
+            if (data == &ctx.answer.data) {
+                chunk.responses[n].reply = ctx.answer.data;
+                data = &chunk.responses[n].reply;
+            }
+            if (ctx.answer.held)
+                chunk.held[chunk.nheld++] = ctx.answer.held;
+        } else if (g_transform) {
+            Response& r = chunk.responses[n];
+            if (!build_response(ctx, e.data, rx_tsc, false, r))
+                continue;
+            data = r.out;
+            if (r.reply.p)
+                chunk.held[chunk.nheld++] = r.reply.p;
+            if (data == &r.copy)
+                chunk.held[chunk.nheld++] = r.copy.p;
+        }
+        chunk.out[n].session_id = e.session_id;
+        chunk.out[n].sqn = e.sqn;
+        chunk.out[n].data = data;
+        if (g_dedup && r == kRespond)
+            remember(ctx, e.session_id, e.sqn, data);
+        if (++chunk.n == kNotifyChunk) {
+            total += chunk.n;
+            ctx.notifies.add(chunk.n);
+            chunk.flush();
+        }
+    }
+    total += chunk.n;
+    ctx.notifies.add(chunk.n);
+    if (chunk.n)
+        chunk.flush();
+    return total;
+}
+
+// Worker side of asynchronous mode: an event_handler call, minus the
+// sampling decision the submitting thread already made.  Latency runs
+// from that thread's receive stamp, so it includes the time queued.
+void handle_queued(const lr::AsyncEvent& e, ENSUserData* data)
+{
+    ThreadContext& ctx = lr::PerThread<ThreadContext>::local();
+    if (__builtin_expect(ctx.deferred.due(e.rx_tsc), 0))
+        release_deferred(ctx, e.rx_tsc);
+    Reply r = on_event(ctx, e.session_id, e.event_type, e.sqn, data, e.rx_tsc);
+    uint64_t state = g_flight ? lr::rdtsc() : 0;
+    if (r != kNoReply) {
+        reply(ctx, r, e.session_id, e.sqn, data, e.rx_tsc);
+        if (e.flags & lr::WorkerPool::kSampled) {
+            // Workers run on other cores; never let TSC skew go negative.
+            int64_t cycles = int64_t(lr::rdtscp() - e.rx_tsc);
+            ctx.latency.record(cycles > 0 ? uint64_t(cycles) : 0);
+        }
+    }
+    if (g_flight)
+        g_flight->record(e.rx_tsc, state, lr::rdtscp(), e.session_id, e.event_type, e.sqn, e.length);
+}
+
+// event_handler with the flight recorder on: the same steps, stamped
+// after each stage.
+void handle_recorded(ThreadContext& ctx, uint32_t session_id, uint32_t event_type, uint32_t sqn, ENSUserData* data,
+                     uint64_t t0, bool sampled)
+{
+    Reply r = on_event(ctx, session_id, event_type, sqn, data, t0);
+    uint64_t state = lr::rdtsc();
+    if (r != kNoReply)
+        reply(ctx, r, session_id, sqn, data, t0);
+    uint64_t t1 = lr::rdtscp();
+    if (r != kNoReply && sampled)
+        ctx.latency.record(t1 - t0);
+    g_flight->record(t0, state, t1, session_id, event_type, sqn, data ? data->length : 0);
+}
+
+// How often the segment's jitter summary is refreshed.
+const uint64_t kJitterPublishNs = 1000000000;
+
+// Everything the shared-memory segment shows, summed over all threads.
+void collect_stats(LRStatsSnapshot& out)
+{
+    out.data_events = out.notifies = out.opens = out.closes = out.keepalives = out.unknown_events = 0;
+    out.seq_gaps = out.seq_reordered = out.seq_duplicates = out.stamp_skipped = 0;
+    out.rate_dropped = out.dedup_suppressed = out.kv_dropped = out.kv_full = 0;
+    bool suppress = g_dedup && g_dedup->mode() == lr::DedupCache::kSuppress;
+    lr::Histogram latency;
+    lr::PerThread<ThreadContext>::for_each([&](const ThreadContext& c) {
+        out.data_events += c.data_events.get();
+        out.notifies += c.notifies.get();
+        out.opens += c.opens.get();
+        out.closes += c.closes.get();
+        out.keepalives += c.keepalives.get();
+        for (uint32_t i = 0; i < kDispatchSlots; ++i)
+            out.unknown_events += c.unknown[i].get();
+        out.seq_gaps += c.seq_gaps.get();
+        out.seq_reordered += c.seq_reordered.get();
+        out.seq_duplicates += c.seq_duplicates.get();
+        out.stamp_skipped += c.stamp_skipped.get();
+        out.rate_dropped += c.rate_dropped.get();
+        if (suppress)
+            out.dedup_suppressed += c.dedup_hits.get();
+        out.kv_dropped += c.kv_dropped.get();
+        out.kv_full += c.kv_full.get();
+        c.latency.add_to(latency);
+    });
+    out.sessions = g_sessions ? g_sessions->size() : 0;
+    out.table_full = g_table_full.load(std::memory_order_relaxed);
+    out.pool_overflows = 0;
+    if (g_pool) {
+        lr::BufferPool::Stats pool = g_pool->stats();
+        for (unsigned i = 0; i < lr::BufferPool::kClasses; ++i)
+            out.pool_overflows += pool.overflows[i];
+    }
+    out.ring_full_waits = g_workers ? g_workers->stats().ring_full_waits : 0;
+    // Only the publisher thread gets here.
+    static LRJitterStats jitter = LRJitterStats();
+    static uint64_t jitter_ns = 0;
+    uint64_t now = lr::monotonic_ns();
+    if (g_jitter && (jitter_ns == 0 || now - jitter_ns >= kJitterPublishNs)) {
+        lr_jitter_stats(&jitter);
+        jitter_ns = now;
+    }
+    out.jitter_sessions = jitter.sessions;
+    out.jitter_mean_ns = jitter.mean_ns;
+    out.jitter_p99_ns = jitter.p99_ns;
+    out.jitter_max_ns = jitter.max_ns;
+    out.latency_count = latency.count();
+    out.latency_sum = latency.sum();
+    out.latency_max = latency.max();
+    for (unsigned i = 0; i < lr::Histogram::kBucketCount; ++i)
+        out.latency_buckets[i] = latency.bucket(i);
+}
+
+// event_handler with any LR_* feature on.  Kept out of line so the bare
+// path pays for none of it.
+__attribute__((noinline)) void handle_event(uint32_t session_id, uint32_t event_type, uint32_t sqn,
+                                            ENSUserData* data)
+{
+    ThreadContext& ctx = lr::PerThread<ThreadContext>::local();
+    bool sampled = lr::g_config.histogram && (++ctx.events & lr::g_config.histogram_sample_mask) == 0;
+    if (__builtin_expect(g_counted && event_type != LR_EVENT_CLOCK_PROBE, 1)) {
+        // All on_event() and respond() come down to with g_counted set:
+        // data events are echoed, the rest only counted.
+        if (event_type != LR_EVENT_DATA) {
+            on_other(ctx, session_id, event_type, sqn);
+            return;
+        }
+        uint64_t t0 = sampled ? lr::rdtsc() : 0;
+        ctx.data_events.add();
+        ctx.notifies.add();
+        g_notify(session_id, sqn, data);
+        if (sampled)
+            ctx.latency.record(lr::rdtscp() - t0);
+        return;
+    }
+    uint64_t t0 = sampled || g_rx_tsc ? lr::rdtsc() : 0;
+    if (g_idle)
+        g_idle->poll(t0);
+    if (g_trace)
+        g_trace->record(t0, session_id, event_type, sqn, data);
+    if (g_workers) {
+        g_workers->submit(session_id, event_type, sqn, data, t0, sampled ? lr::WorkerPool::kSampled : 0);
+        if (g_flight)
+            g_flight->record(t0, t0, lr::rdtscp(), session_id, event_type, sqn, data ? data->length : 0);
+        return;
+    }
+    if (__builtin_expect(ctx.deferred.due(t0), 0))
+        release_deferred(ctx, t0);
+    if (g_flight) {
+        handle_recorded(ctx, session_id, event_type, sqn, data, t0, sampled);
+        return;
+    }
+    Reply r = on_event(ctx, session_id, event_type, sqn, data, t0);
+    if (r == kNoReply)
+        return;
+    reply(ctx, r, session_id, sqn, data, t0);
+    if (sampled)
+        ctx.latency.record(lr::rdtscp() - t0);
+}
+
+}
+
+// With every feature off this is the plugin as it started out: a compare
+// and a tail jump to the host's notify.
+extern "C" LR_EXPORT void event_handler(uint32_t session_id, uint32_t event_type, uint32_t sqn, ENSUserData* data)
+{
+    if (__builtin_expect(g_bare, 1)) {
+        if (event_type == LR_EVENT_DATA)
+            g_notify(session_id, sqn, data);
+        return;
+    }
+    handle_event(session_id, event_type, sqn, data);
+}
+
+// Every event of a batch waits for the whole batch, so each data event is
+// recorded with the batch's latency.  Sampling applies per batch.
+extern "C" LR_EXPORT void event_handler_batch(const LREvent* events, uint32_t count)
+{
+    ThreadContext& ctx = lr::PerThread<ThreadContext>::local();
+    bool sampled = lr::g_config.histogram && (++ctx.events & lr::g_config.histogram_sample_mask) == 0;
+    uint64_t t0 = sampled || g_rx_tsc ? lr::rdtsc() : 0;
+    if (g_idle)
+        g_idle->poll(t0);
+    if (g_trace) {
+        for (uint32_t i = 0; i < count; ++i)
+            g_trace->record(t0, events[i].session_id, events[i].event_type, events[i].sqn, events[i].data);
+    }
+    if (g_workers) {
+        for (uint32_t i = 0; i < count; ++i) {
+            const LREvent& e = events[i];
+            g_workers->submit(e.session_id, e.event_type, e.sqn, e.data, t0, sampled ? lr::WorkerPool::kSampled : 0);
+        }
+        if (g_flight)
+            g_flight->record_batch(t0, lr::rdtscp(), events, count);
+        return;
+    }
+    if (__builtin_expect(ctx.deferred.due(t0), 0))
+        release_deferred(ctx, t0);
+    uint32_t n = g_notify_batch ? notify_batched(ctx, events, count, t0) : notify_each(ctx, events, count, t0);
+    if ((sampled && n) || g_flight) {
+        uint64_t t1 = lr::rdtscp();
+        if (sampled && n)
+            ctx.latency.record(t1 - t0, n);
+        if (g_flight)
+            g_flight->record_batch(t0, t1, events, count);
+    }
+}
+
+extern "C" LR_EXPORT int lr_plugin_init(const LRHostApi* host, LRPluginApi* plugin)
+{
+    if (!host || !plugin || host->version != LR_API_VERSION ||
+        host->size < offsetof(LRHostApi, notify) + sizeof(host->notify) || !host->notify ||
+        plugin->size < offsetof(LRPluginApi, event_handler) + sizeof(plugin->event_handler))
+        return -1;
+    g_notify = host->notify;
+    bool has_batch = host->size >= offsetof(LRHostApi, notify_batch) + sizeof(host->notify_batch);
+    g_notify_batch = lr::g_config.batch_notify && has_batch ? host->notify_batch : nullptr;
+    bool has_vec = host->size >= offsetof(LRHostApi, notify_vec) + sizeof(host->notify_vec);
+    g_notify_vec = lr::g_config.gather_notify && has_vec ? host->notify_vec : nullptr;
+    if (g_workers && !(host->capabilities & LR_HOST_NOTIFY_ANY_THREAD)) {
+        // No event has arrived yet, so the workers have nothing queued.
+        delete g_workers;
+        g_workers = nullptr;
+        choose_paths();
+    }
+
+    LRPluginApi p;
+    p.version = LR_API_VERSION;
+    p.size = sizeof(p);
+    p.capabilities = LR_PLUGIN_BATCH;
+    if (g_workers)
+        p.capabilities |= LR_PLUGIN_ASYNC;
+    if (lr::g_config.stamp)
+        p.capabilities |= LR_PLUGIN_STAMP_IN_PLACE;
+    if (g_shaper)
+        p.capabilities |= LR_PLUGIN_READONLY_RESPONSES;
+    p.event_handler = event_handler;
+    p.event_handler_batch = event_handler_batch;
+    memcpy(plugin, &p, plugin->size < sizeof(p) ? plugin->size : sizeof(p));
+    return 0;
+}
+
+extern "C" LR_EXPORT int lr_latency_summary(LRLatencySummary* out)
+{
+    if (!lr::g_config.histogram)
+        return -1;
+    lr::Histogram h;
+    lr::PerThread<ThreadContext>::for_each([&](const ThreadContext& c) { c.latency.add_to(h); });
+    double ns = 1e9 / g_clock.hz();
+    out->count = h.count();
+    out->mean_ns = h.mean() * ns;
+    out->min_ns = double(h.min()) * ns;
+    out->p50_ns = double(h.percentile(50)) * ns;
+    out->p90_ns = double(h.percentile(90)) * ns;
+    out->p99_ns = double(h.percentile(99)) * ns;
+    out->p999_ns = double(h.percentile(99.9)) * ns;
+    out->p9999_ns = double(h.percentile(99.99)) * ns;
+    out->max_ns = double(h.max()) * ns;
+    return 0;
+}
+
+extern "C" LR_EXPORT int lr_session_info(uint32_t session_id, LRSessionInfo* out)
+{
+    const lr::SessionState* s = g_sessions ? g_sessions->find(session_id) : nullptr;
+    if (!s)
+        return -1;
+    out->events = s->events;
+    out->notifies = s->notifies;
+    out->last_event_type = s->last_event_type;
+    out->highest_sqn = s->seq.highest;
+    out->seq_gaps = s->seq.gaps;
+    out->seq_reordered = s->seq.reordered;
+    out->seq_duplicates = s->seq.duplicates;
+    out->seq_stale = s->seq.stale;
+    out->seq_resyncs = s->seq.resyncs;
+    return 0;
+}
+
+extern "C" LR_EXPORT int lr_sequence_stats(LRSequenceStats* out)
+{
+    if (!g_sessions)
+        return -1;
+    *out = LRSequenceStats();
+    lr::PerThread<ThreadContext>::for_each([&](const ThreadContext& c) {
+        out->data_events += c.data_events.get();
+        out->gaps += c.seq_gaps.get();
+        out->reordered += c.seq_reordered.get();
+        out->duplicates += c.seq_duplicates.get();
+        out->stale += c.seq_stale.get();
+        out->resyncs += c.seq_resyncs.get();
+    });
+    return 0;
+}
+
+extern "C" LR_EXPORT uint64_t lr_session_count(void)
+{
+    return g_sessions ? g_sessions->size() : 0;
+}
+
+extern "C" LR_EXPORT uint64_t lr_session_table_full(void)
+{
+    return g_table_full.load(std::memory_order_relaxed);
+}
+
+extern "C" LR_EXPORT uint64_t lr_unbound_drops(void)
+{
+    return g_unbound.load(std::memory_order_relaxed);
+}
+
+extern "C" LR_EXPORT int lr_async_stats(LRAsyncStats* out)
+{
+    if (!g_workers)
+        return -1;
+    lr::WorkerPool::Stats s = g_workers->stats();
+    out->workers = g_workers->workers();
+    out->submitted = s.submitted;
+    out->handled = s.handled;
+    out->ring_full_waits = s.ring_full_waits;
+    out->inline_events = s.inline_events;
+    return 0;
+}
+
+extern "C" LR_EXPORT void lr_async_drain(void)
+{
+    if (g_workers)
+        g_workers->drain();
+}
+
+extern "C" LR_EXPORT int lr_event_type_stats(LREventTypeStats* out)
+{
+    if (g_bare)
+        return -1;
+    *out = LREventTypeStats();
+    lr::PerThread<ThreadContext>::for_each([&](const ThreadContext& c) {
+        out->data += c.data_events.get();
+        out->opens += c.opens.get();
+        out->reopens += c.reopens.get();
+        out->closes += c.closes.get();
+        out->closes_unknown += c.closes_unknown.get();
+        out->keepalives += c.keepalives.get();
+        out->keepalives_unknown += c.keepalives_unknown.get();
+        for (uint32_t i = 0; i < kDispatchSlots; ++i) {
+            out->unknown += c.unknown[i].get();
+            out->unknown_by_type[i] += c.unknown[i].get();
+        }
+    });
+    return 0;
+}
+
+extern "C" LR_EXPORT int lr_pool_stats(LRPoolStats* out)
+{
+    if (!g_pool)
+        return -1;
+    lr::BufferPool::Stats s = g_pool->stats();
+    *out = LRPoolStats();
+    out->reserved_bytes = g_pool->reserved_bytes();
+    for (unsigned i = 0; i < lr::BufferPool::kClasses; ++i) {
+        out->allocs[i] = s.allocs[i];
+        out->overflows[i] = s.overflows[i];
+    }
+    out->oversize = s.oversize;
+    return 0;
+}
+
+extern "C" LR_EXPORT int lr_stamp_stats(LRStampStats* out)
+{
+    if (!lr::g_config.stamp)
+        return -1;
+    *out = LRStampStats();
+    lr::PerThread<ThreadContext>::for_each([&](const ThreadContext& c) {
+        out->in_place += c.stamp_in_place.get();
+        out->copied += c.stamp_copied.get();
+        out->skipped += c.stamp_skipped.get();
+        out->gathered += c.stamp_gathered.get();
+    });
+    return 0;
+}
+
+extern "C" LR_EXPORT int lr_shape_stats(LRShapeStats* out)
+{
+    if (!g_shaper)
+        return -1;
+    *out = LRShapeStats();
+    out->mode = uint32_t(g_shaper->mode());
+    lr::PerThread<ThreadContext>::for_each([&](const ThreadContext& c) {
+        out->request_bytes += c.request_bytes.get();
+        out->response_bytes += c.response_bytes.get();
+    });
+    return 0;
+}
+
+extern "C" LR_EXPORT int lr_trace_stats(LRTraceStats* out)
+{
+    if (!g_trace)
+        return -1;
+    lr::TraceRecorder::Stats s = g_trace->stats();
+    out->records = s.records;
+    out->overwritten = s.overwritten;
+    out->unrecorded = s.unrecorded;
+    out->threads = s.threads;
+    out->reserved = 0;
+    return 0;
+}
+
+extern "C" LR_EXPORT int lr_flight_stats(LRFlightStats* out)
+{
+    if (!g_flight)
+        return -1;
+    lr::FlightRecorder::Stats s = g_flight->stats();
+    out->violations = s.violations;
+    out->suppressed = s.suppressed;
+    out->dumps = s.dumps;
+    out->dropped = s.dropped;
+    out->slo_ns = g_flight->slo_ns();
+    return 0;
+}
+
+extern "C" LR_EXPORT int lr_rate_stats(LRRateStats* out)
+{
+    if (!g_rate)
+        return -1;
+    *out = LRRateStats();
+    out->rate = lr::g_config.rate;
+    out->burst = lr::g_config.rate_burst;
+    out->defer_us = g_rate->defers() ? lr::g_config.rate_defer_us : 0;
+    lr::PerThread<ThreadContext>::for_each([&](const ThreadContext& c) {
+        out->dropped += c.rate_dropped.get();
+        out->deferred += c.rate_deferred.get();
+        out->released += c.rate_released.get();
+    });
+    return 0;
+}
+
+extern "C" LR_EXPORT int lr_jitter_stats(LRJitterStats* out)
+{
+    if (!g_jitter)
+        return -1;
+    *out = LRJitterStats();
+    double ns = 1e9 / g_clock.hz();
+    lr::Histogram h;
+    // A min-heap on jitter of the worst sessions so far.
+    LRJitterSession* worst = out->worst;
+    auto less_jitter = [](const LRJitterSession& a, const LRJitterSession& b) { return a.jitter_ns > b.jitter_ns; };
+    g_sessions->for_each([&](uint32_t session_id, const lr::SessionState& s) {
+        const lr::JitterTracker::Entry& e = g_jitter->entry(g_sessions->index(&s));
+        if (s.events < LR_JITTER_MIN_EVENTS || e.interval == 0)
+            return;
+        uint64_t j = lr::JitterTracker::jitter(e);
+        h.record(j);
+        LRJitterSession w = {session_id, 0, s.events, double(j) * ns, double(e.interval) * ns};
+        if (out->worst_count < LR_JITTER_WORST) {
+            worst[out->worst_count++] = w;
+            std::push_heap(worst, worst + out->worst_count, less_jitter);
+        } else if (w.jitter_ns > worst[0].jitter_ns) {
+            std::pop_heap(worst, worst + LR_JITTER_WORST, less_jitter);
+            worst[LR_JITTER_WORST - 1] = w;
+            std::push_heap(worst, worst + LR_JITTER_WORST, less_jitter);
+        }
+    });
+    std::sort_heap(worst, worst + out->worst_count, less_jitter);
+    out->sessions = h.count();
+    out->mean_ns = h.mean() * ns;
+    out->p50_ns = double(h.percentile(50)) * ns;
+    out->p90_ns = double(h.percentile(90)) * ns;
+    out->p99_ns = double(h.percentile(99)) * ns;
+    out->max_ns = double(h.max()) * ns;
+    return 0;
+}
+
+extern "C" LR_EXPORT int lr_idle_stats(LRIdleStats* out)
+{
+    if (!g_idle)
+        return -1;
+    lr::IdleEvictor::Stats s = g_idle->stats();
+    out->timeout_ms = g_idle->timeout_ms();
+    out->evicted = s.evicted;
+    out->checked = s.checked;
+    out->armed = s.armed;
+    out->backlog = s.backlog;
+    out->threaded = g_idle->threaded() ? 1 : 0;
+    out->reserved = 0;
+    return 0;
+}
+
+extern "C" LR_EXPORT int lr_dedup_stats(LRDedupStats* out)
+{
+    if (!g_dedup)
+        return -1;
+    *out = LRDedupStats();
+    out->mode = uint32_t(g_dedup->mode());
+    out->bytes = g_dedup->bytes();
+    out->entries = g_dedup->entries();
+    lr::PerThread<ThreadContext>::for_each([&](const ThreadContext& c) {
+        out->lookups += c.dedup_lookups.get();
+        out->hits += c.dedup_hits.get();
+        out->inserts += c.dedup_inserts.get();
+        out->evictions += c.dedup_evictions.get();
+        out->too_large += c.dedup_too_large.get();
+    });
+    return 0;
+}
+
+extern "C" LR_EXPORT int lr_kv_stats(LRKvStats* out)
+{
+    if (!g_kv)
+        return -1;
+    *out = LRKvStats();
+    out->capacity = g_kv->capacity();
+    out->keys = g_kv->size();
+    out->table_bytes = g_kv->table_bytes();
+    out->node_bytes = g_kv->node_bytes();
+    out->pending_bytes = lr::Epoch::stats().pending_bytes;
+    lr::PerThread<ThreadContext>::for_each([&](const ThreadContext& c) {
+        out->gets += c.kv_gets.get();
+        out->hits += c.kv_hits.get();
+        out->puts += c.kv_puts.get();
+        out->deletes += c.kv_deletes.get();
+        out->full += c.kv_full.get();
+        out->bad += c.kv_bad.get();
+        out->dropped += c.kv_dropped.get();
+    });
+    return 0;
+}
+
+extern "C" LR_EXPORT int lr_clock_stats(LRClockStats* out)
+{
+    if (!lr::g_config.clock_probe)
+        return -1;
+    *out = LRClockStats();
+    lr::TscWallClock::Stats s = g_wall_clock.stats();
+    out->syncs = s.syncs;
+    out->steps = s.steps;
+    out->last_offset_ns = s.last_offset_ns;
+    out->tsc_hz = s.hz;
+    lr::PerThread<ThreadContext>::for_each([&](const ThreadContext& c) {
+        out->probes += c.clock_probes.get();
+        out->bad += c.clock_bad.get();
+    });
+    return 0;
+}
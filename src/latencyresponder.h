@@ -0,0 +1,558 @@
+// Entry points latencyresponder.so exports in addition to the ENS
+// event_handler.  Hosts look them up with dlsym() and must cope with a
+// plugin build that lacks them.
+
+#ifndef LATENCYRESPONDER_H
+#define LATENCYRESPONDER_H
+
+#include <stdint.h>
+
+#include "ens.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Event types event_handler acts on.  Data events are answered; the
+// others only drive per-session state:
+//   SESSION_OPEN   creates the session's state, or resets it when the id
+//                  is reused, so the data path finds it already there
+//   SESSION_CLOSE  frees the session's state
+//   KEEPALIVE      counts against a known session, never creates one
+//   CLOCK_PROBE    answered with the plugin's clock, see LRClockProbe;
+//                  touches no session state
+// Every other type is counted and dropped.
+#define LR_EVENT_DATA 1
+#define LR_EVENT_SESSION_OPEN 2
+#define LR_EVENT_SESSION_CLOSE 3
+#define LR_EVENT_KEEPALIVE 4
+#define LR_EVENT_CLOCK_PROBE 5
+
+// One event_handler call's worth of arguments.
+typedef struct {
+    uint32_t session_id;
+    uint32_t event_type;
+    uint32_t sqn;
+    ENSUserData* data;
+} LREvent;
+
+// One ENSSessionNotify call's worth of arguments.
+typedef struct {
+    uint32_t session_id;
+    uint32_t sqn;
+    ENSUserData* data;
+} LRNotify;
+
+// Handles `count` events exactly as that many event_handler calls would,
+// in order.  Lets a host hand over everything one poll returned in one
+// call.
+void event_handler_batch(const LREvent* events, uint32_t count);
+
+// Optional host extension: delivers `count` notifications in order.  The
+// stock runtime does not provide it; when a host exports it, the plugin
+// binds it at load and event_handler_batch notifies through it, otherwise
+// it falls back to one ENSSessionNotify per event.  LR_BATCH_NOTIFY=0
+// forces the fallback.
+void ENSSessionNotifyBatch(const LRNotify* notifies, uint32_t count) __attribute__((weak));
+
+// A payload in `count` segments, delivered as if it were one buffer of
+// `length` bytes holding them in order: the iovec form of ENSUserData.
+typedef struct {
+    uint32_t length;
+    uint32_t count;
+    const ENSUserData* segments;
+} LRUserDataVec;
+
+// Optional host extension: delivers the concatenation of data's segments
+// as one notification.  Segments are only valid for the duration of the
+// call.  When a host exports it, responses the plugin extends, such as
+// stamped ones (LR_STAMP) whose request left no room for the trailer,
+// go out as the request's payload followed by a segment of their own;
+// otherwise, or with LR_GATHER_NOTIFY=0, the plugin copies them into one
+// buffer first.  event_handler_batch always sends contiguous buffers.
+void ENSSessionNotifyVec(uint32_t session_id, uint32_t sqn, const LRUserDataVec* data) __attribute__((weak));
+
+// Registration through function tables.  A host that finds
+// lr_plugin_init calls it once, before the first event, and from then on
+// calls the plugin through the LRPluginApi it gets back, while the plugin
+// notifies through a pointer from the host's LRHostApi rather than
+// through its PLT entry for ENSSessionNotify.  Hosts that never call it
+// get the exported symbols as before; a host that does need not export
+// ENSSessionNotify at all, as the plugin only references it weakly.  A
+// host that does neither gets no responses: they are dropped, counted by
+// lr_unbound_drops(), and the first one is reported on stderr.
+//
+// Both tables start with the API version and the size their writer knows.
+// Fields are only ever appended, so each side reads no further than the
+// other's size and treats fields past it as absent; the version changes
+// only when a table changes incompatibly.
+#define LR_API_VERSION 1
+
+// LRHostApi.capabilities
+//   NOTIFY_ANY_THREAD    notify may be called from threads other than the
+//                        one the event arrived on; without it the plugin
+//                        stops its LR_WORKERS and answers every event inline
+#define LR_HOST_NOTIFY_ANY_THREAD (1ull << 0)
+
+// LRPluginApi.capabilities
+//   BATCH                event_handler_batch is set
+//   ASYNC                responses come from worker threads (LR_WORKERS)
+//   STAMP_IN_PLACE       requests ending in an LRStampTrailer are stamped
+//                        without a copy (LR_STAMP)
+//   READONLY_RESPONSES   responses may point into read-only memory
+//                        (LR_SHAPE); notify must not write to them
+#define LR_PLUGIN_BATCH (1ull << 0)
+#define LR_PLUGIN_ASYNC (1ull << 1)
+#define LR_PLUGIN_STAMP_IN_PLACE (1ull << 2)
+#define LR_PLUGIN_READONLY_RESPONSES (1ull << 3)
+
+typedef struct {
+    uint32_t version;
+    uint32_t size;
+    uint64_t capabilities;
+    void (*notify)(uint32_t session_id, uint32_t sqn, ENSUserData* data);
+    // NULL if the host has no batched notify.
+    void (*notify_batch)(const LRNotify* notifies, uint32_t count);
+    // NULL if the host has no gathering notify.
+    void (*notify_vec)(uint32_t session_id, uint32_t sqn, const LRUserDataVec* data);
+} LRHostApi;
+
+typedef struct {
+    uint32_t version;
+    uint32_t size;
+    uint64_t capabilities;
+    void (*event_handler)(uint32_t session_id, uint32_t event_type, uint32_t sqn, ENSUserData* data);
+    void (*event_handler_batch)(const LREvent* events, uint32_t count);
+} LRPluginApi;
+
+// Takes the host's table and fills in the plugin's, of which the host has
+// room for plugin->size bytes.  Returns 0, or -1 when the host's version
+// differs or its table has no notify; then nothing has changed and the
+// host should use the exported symbols instead.
+int lr_plugin_init(const LRHostApi* host, LRPluginApi* plugin);
+
+// Responder latency, from event_handler entry to ENSSessionNotify return,
+// over the data events recorded so far on every thread: one in 64 of
+// them, or one in LR_HISTOGRAM.
+typedef struct {
+    uint64_t count;
+    double mean_ns;
+    double min_ns;
+    double p50_ns;
+    double p90_ns;
+    double p99_ns;
+    double p999_ns;
+    double p9999_ns;
+    double max_ns;
+} LRLatencySummary;
+
+// Merges the per-thread histograms into *out.  Returns 0, or -1 when the
+// plugin was loaded with LR_HISTOGRAM=0.  Safe to call from any thread
+// while events are being handled.
+int lr_latency_summary(LRLatencySummary* out);
+
+// Sequence numbers of data events are tracked per session over a sliding
+// window of 64, with 32-bit wraparound:
+//   gaps        sqns skipped when a session's highest sqn jumped ahead
+//   reordered   arrivals that filled one of those gaps later
+//   duplicates  sqns seen twice within the window
+//   stale       arrivals too far behind the highest sqn to classify
+//   resyncs     jumps of 65536 or more either way, taken as a restart
+// gaps - reordered is what the network lost, as far as the window tells.
+typedef struct {
+    uint64_t events;
+    uint64_t notifies;
+    uint32_t last_event_type;
+    uint32_t highest_sqn;
+    uint32_t seq_gaps;
+    uint32_t seq_reordered;
+    uint32_t seq_duplicates;
+    uint32_t seq_stale;
+    uint32_t seq_resyncs;
+} LRSessionInfo;
+
+// Copies the state kept for session_id into *out.  Returns 0, or -1 when
+// the session is unknown or the plugin runs with LR_SESSIONS=0.  Fields
+// may be mid-update if the session is handling an event.
+int lr_session_info(uint32_t session_id, LRSessionInfo* out);
+
+typedef struct {
+    uint64_t data_events;
+    uint64_t gaps;
+    uint64_t reordered;
+    uint64_t duplicates;
+    uint64_t stale;
+    uint64_t resyncs;
+} LRSequenceStats;
+
+// Sums the sequence tracking of every session ever seen.  Returns 0, or
+// -1 with LR_SESSIONS=0.
+int lr_sequence_stats(LRSequenceStats* out);
+
+// Sessions currently tracked, and events that found the table full and
+// went untracked (they are still answered).
+uint64_t lr_session_count(void);
+uint64_t lr_session_table_full(void);
+
+// Responses dropped because the host neither exports ENSSessionNotify nor
+// called lr_plugin_init.
+uint64_t lr_unbound_drops(void);
+
+// Asynchronous mode, enabled with LR_WORKERS=N.  event_handler and
+// event_handler_batch copy each event into a lock-free ring to one of N
+// worker threads, chosen by session_id, and return; the workers do the
+// per-session work and call ENSSessionNotify.  Responder latency then
+// runs from event_handler entry to the worker's notify.
+typedef struct {
+    uint32_t workers;
+    uint64_t submitted;
+    uint64_t handled;
+    // Events that found their ring full and waited for room.
+    uint64_t ring_full_waits;
+    // Events larger than half a ring, handled on the calling thread and
+    // not counted in handled.
+    uint64_t inline_events;
+} LRAsyncStats;
+
+// Returns 0, or -1 when the plugin runs synchronously.
+int lr_async_stats(LRAsyncStats* out);
+
+// Waits until the workers have handled every event submitted before the
+// call.  Returns immediately when the plugin runs synchronously.
+void lr_async_drain(void);
+
+// Unknown event types are counted by value up to
+// LR_UNKNOWN_TYPE_SLOTS - 2; the last slot holds every larger value.
+#define LR_UNKNOWN_TYPE_SLOTS 16
+
+typedef struct {
+    uint64_t data;
+    uint64_t opens;
+    uint64_t reopens;
+    uint64_t closes;
+    uint64_t closes_unknown;
+    uint64_t keepalives;
+    uint64_t keepalives_unknown;
+    uint64_t unknown;
+    uint64_t unknown_by_type[LR_UNKNOWN_TYPE_SLOTS];
+} LREventTypeStats;
+
+// Events handled per type, summed over all threads.  reopens are opens of
+// an id that was still live; closes_unknown and keepalives_unknown name no
+// live session (or the plugin runs with LR_SESSIONS=0).  Returns -1 if
+// events are not counted: with LR_HISTOGRAM=0, LR_CLOCK_PROBE=0,
+// LR_SHM_INTERVAL_MS=0 and every other feature off, event_handler only
+// echoes data events.
+int lr_event_type_stats(LREventTypeStats* out);
+
+// Residence stamping, enabled with LR_STAMP=1.  Every data response
+// carries an LRStampTrailer as its last 24 bytes (little endian, no
+// alignment guaranteed) with the CLOCK_REALTIME ns at which event_handler
+// received the event and at which it handed the response to
+// ENSSessionNotify; tx_ns - rx_ns is the time the edge held the request.
+//
+// A client that ends its request payload with a trailer whose magic is
+// LR_STAMP_MAGIC gets it filled in place: no allocation, no copy, same
+// length.  Other payloads are copied into a buffer from the response
+// buffer pool (see LRPoolStats) with the trailer appended, so the
+// response grows by 24 bytes; payloads over 64 KiB - 24 go out
+// unstamped.  Hosts with ENSSessionNotifyVec get those responses as the
+// payload and the trailer in two segments instead, counted as gathered,
+// at any size and without a copy.
+#define LR_STAMP_MAGIC 0x5354524cu /* "LRTS" */
+
+typedef struct {
+    uint32_t magic;
+    uint32_t flags;
+    uint64_t rx_ns;
+    uint64_t tx_ns;
+} LRStampTrailer;
+
+typedef struct {
+    uint64_t in_place;
+    uint64_t copied;
+    uint64_t skipped;
+    uint64_t gathered;
+} LRStampStats;
+
+// Returns 0, or -1 when stamping is off.
+int lr_stamp_stats(LRStampStats* out);
+
+// Response buffer pool.  Responses the plugin builds itself take their
+// memory from LR_POOL_BUFFERS (default 64) prefaulted buffers per size
+// class, 64 B << class up to 64 KiB, held in per-thread free lists.  The
+// pool is only set up for the features that take buffers: LR_STAMP,
+// LR_KV, LR_DEDUP=replay and LR_RATE with LR_RATE_DEFER_US.
+// allocs counts every request of a class; overflows those that found the
+// pool exhausted and fell back to malloc; oversize requests over 64 KiB,
+// which always go to malloc.
+#define LR_POOL_CLASSES 11
+
+typedef struct {
+    uint64_t reserved_bytes;
+    uint64_t allocs[LR_POOL_CLASSES];
+    uint64_t overflows[LR_POOL_CLASSES];
+    uint64_t oversize;
+} LRPoolStats;
+
+// Returns 0, or -1 when no feature that takes buffers is on.
+int lr_pool_stats(LRPoolStats* out);
+
+// Response shaping, LR_SHAPE=truncate:N, pad:N or amplify:R.  Data
+// responses are cut to the first N bytes of the request, made exactly N
+// bytes long, or made R times the request's length (at most 1 MiB).
+// Responses no longer than the request are a prefix of it; longer ones
+// are a prefix of a read-only buffer holding the bytes 0, 1, ... 255, 0,
+// ... filled once at load, so no mode copies or clears memory per event.
+// The request's own bytes are not repeated in padded responses.  Shaping
+// happens before stamping, so with LR_STAMP=1 the trailer comes on top.
+#define LR_SHAPE_TRUNCATE 1
+#define LR_SHAPE_PAD 2
+#define LR_SHAPE_AMPLIFY 3
+
+typedef struct {
+    uint32_t mode;
+    uint32_t reserved;
+    uint64_t request_bytes;
+    uint64_t response_bytes;
+} LRShapeStats;
+
+// Returns 0, or -1 when shaping is off.
+int lr_shape_stats(LRShapeStats* out);
+
+// Event trace, LR_TRACE=<path>; the file format is in trace_file.h.
+// records counts events written to the file, overwritten those whose
+// slot has since been reused, unrecorded events from threads that found
+// every ring taken; threads is the number of rings in use.
+typedef struct {
+    uint64_t records;
+    uint64_t overwritten;
+    uint64_t unrecorded;
+    uint32_t threads;
+    uint32_t reserved;
+} LRTraceStats;
+
+// Returns 0, or -1 when no trace is being recorded.
+int lr_trace_stats(LRTraceStats* out);
+
+// Flight recorder, LR_FLIGHT_SLO_NS=<ns>.  Each thread keeps its last
+// LR_FLIGHT_EVENTS events with per-stage TSC stamps; an event slower
+// than the SLO has them written, as CSV, to
+// LR_FLIGHT_DIR/lr-flight.<pid>.<n>.csv from a background thread.
+// violations counts events over the SLO, suppressed those that came
+// while their thread's previous dump was still being written, dumps the
+// files written and dropped the dumps skipped past LR_FLIGHT_MAX_DUMPS
+// or lost to I/O errors.
+typedef struct {
+    uint64_t violations;
+    uint64_t suppressed;
+    uint64_t dumps;
+    uint64_t dropped;
+    double slo_ns;
+} LRFlightStats;
+
+// Returns 0, or -1 when the flight recorder is off.
+int lr_flight_stats(LRFlightStats* out);
+
+// Per-session rate limiting, LR_RATE=<events/s> with bursts of
+// LR_RATE_BURST.  Data events over a session's rate are dropped
+// unanswered or, with LR_RATE_DEFER_US, answered once they conform.
+// Held-back responses go out from the next call into the plugin on the
+// thread that held them at or after their due time; deferred - released
+// are still held.  Other event types are never limited.
+typedef struct {
+    uint64_t rate;
+    uint32_t burst;
+    uint32_t defer_us;
+    uint64_t dropped;
+    uint64_t deferred;
+    uint64_t released;
+} LRRateStats;
+
+// Returns 0, or -1 when rate limiting is off.
+int lr_rate_stats(LRRateStats* out);
+
+// Idle session expiry, LR_IDLE_TIMEOUT_MS=<ms>.  Sessions without an
+// event for that long are erased from the session table, from the event
+// path or, with LR_IDLE_THREAD=1, from a housekeeping thread.  checked
+// counts the timers that came up, for busy sessions as well as idle
+// ones, armed the sessions that have one, and backlog the timers that
+// came up and wait to be checked.
+typedef struct {
+    uint64_t timeout_ms;
+    uint64_t evicted;
+    uint64_t checked;
+    uint64_t armed;
+    uint64_t backlog;
+    uint32_t threaded;
+    uint32_t reserved;
+} LRIdleStats;
+
+// Returns 0, or -1 when idle sessions are kept.
+int lr_idle_stats(LRIdleStats* out);
+
+// Retransmit deduplication, LR_DEDUP=replay|suppress.  A data event whose
+// sqn the session's sequence window reports as a duplicate or as stale
+// is looked up by (session_id, sqn) among the LR_DEDUP_ENTRIES pairs
+// answered most recently, kept with CLOCK replacement.  On a hit it is
+// answered with the cached response (replay) or not at all (suppress),
+// and never handled again.  Replay keeps responses of up to
+// LR_DEDUP_BYTES; longer ones count as too_large and their retransmits
+// are handled afresh.  hits / lookups is the retransmit hit rate.
+#define LR_DEDUP_REPLAY 1
+#define LR_DEDUP_SUPPRESS 2
+
+typedef struct {
+    uint32_t mode;
+    uint32_t bytes;
+    uint64_t entries;
+    uint64_t lookups;
+    uint64_t hits;
+    uint64_t inserts;
+    uint64_t evictions;
+    uint64_t too_large;
+} LRDedupStats;
+
+// Returns 0, or -1 when deduplication is off.
+int lr_dedup_stats(LRDedupStats* out);
+
+// Key-value responder, LR_KV=<keys>.  Instead of being echoed, the
+// payload of a data event is a command against a hash map of up to that
+// many keys, kept inside the plugin and shared by every thread:
+//   LRKvHeader, key_length bytes of key, value_length bytes of value
+// with a non-empty key and a value for PUT only.  The response is an
+// LRKvHeader with the request's op and a status, followed for a GET that
+// found its key by the value.  Values are limited to LR_KV_MAX_VALUE
+// bytes.  Reads take no locks; replaced and deleted values are freed
+// once no reader can still see them.  Responses are shaped and stamped
+// like echoed ones, and retransmits answered by LR_DEDUP are not run
+// again.
+#define LR_KV_GET 1
+#define LR_KV_PUT 2
+#define LR_KV_DELETE 3
+
+#define LR_KV_OK 0
+#define LR_KV_NOT_FOUND 1
+#define LR_KV_FULL 2
+#define LR_KV_BAD_REQUEST 3
+
+#define LR_KV_MAX_VALUE (65536 - 8)
+
+// Little endian, no alignment guaranteed.  status is 0 in requests.
+typedef struct {
+    uint8_t op;
+    uint8_t status;
+    uint16_t key_length;
+    uint32_t value_length;
+} LRKvHeader;
+
+// keys is what the store holds; table_bytes its bucket array, node_bytes
+// the keys and values as malloc holds them, and pending_bytes replaced
+// or deleted values not yet freed.  gets counts GETs and hits those that
+// found their key; full counts PUTs of new keys refused because the
+// store held LR_KV keys; bad counts malformed commands.  dropped counts
+// commands left unanswered because no buffer could be had for the reply.
+typedef struct {
+    uint64_t capacity;
+    uint64_t keys;
+    uint64_t table_bytes;
+    uint64_t node_bytes;
+    uint64_t pending_bytes;
+    uint64_t gets;
+    uint64_t hits;
+    uint64_t puts;
+    uint64_t deletes;
+    uint64_t full;
+    uint64_t bad;
+    uint64_t dropped;
+} LRKvStats;
+
+// Returns 0, or -1 when the plugin echoes.
+int lr_kv_stats(LRKvStats* out);
+
+// Clock probes (LR_CLOCK_PROBE, on by default).  The payload of an
+// LR_EVENT_CLOCK_PROBE event starts with an LRClockProbe carrying
+// LR_CLOCK_PROBE_MAGIC and the client's send time t1; the plugin fills
+// in t2, when event_handler received the probe, and t3, just before it
+// hands it back to ENSSessionNotify, in place, and answers it
+// unshaped and unstamped.  With t4 the client's receive time, NTP style:
+//   offset = ((t2 - t1) + (t3 - t4)) / 2    plugin clock minus client's
+//   delay  = (t4 - t1) - (t3 - t2)          round trip outside the plugin
+// and with the offset known, t2 - t1 - offset is the one-way uplink time.
+//
+// The plugin's times are CLOCK_REALTIME ns from the time stamp counter,
+// calibrated at load and resynced against CLOCK_REALTIME once a second
+// from the event path, without a system call.  The difference found is
+// slewed out over the next second; differences over 1 ms, as when the
+// system clock is set, are stepped.  Probes that are too short or lack
+// the magic are counted as bad and dropped.
+#define LR_CLOCK_PROBE_MAGIC 0x4b4c434cu /* "LCLK" */
+
+// Little endian, no alignment guaranteed.  flags is 0.
+typedef struct {
+    uint32_t magic;
+    uint32_t flags;
+    uint64_t t1_ns;
+    uint64_t t2_ns;
+    uint64_t t3_ns;
+} LRClockProbe;
+
+// syncs counts resyncs against CLOCK_REALTIME and steps those that
+// stepped; last_offset_ns is CLOCK_REALTIME minus the plugin's clock
+// found by the latest, and tsc_hz the counter rate measured so far.
+typedef struct {
+    uint64_t probes;
+    uint64_t bad;
+    uint64_t syncs;
+    uint64_t steps;
+    int64_t last_offset_ns;
+    double tsc_hz;
+} LRClockStats;
+
+// Returns 0, or -1 when probes are off.
+int lr_clock_stats(LRClockStats* out);
+
+// Interarrival jitter, LR_JITTER=1.  For every session the plugin keeps
+// the RFC 3550 jitter estimate J += (|D| - J) / 16 over the receive times
+// of its data events, where D is how far the gap to the previous one
+// strayed from the session's mean spacing times the sqn step.  Lost
+// sqns widen the expected gap rather than count as jitter; reordered and
+// duplicate events are left out.
+//
+// lr_jitter_stats walks the session table: the distribution is over
+// live sessions with an estimate from at least LR_JITTER_MIN_EVENTS
+// events, and worst lists the worst_count of them with the most jitter,
+// worst first.  Values may be mid-update; the walk reads every slot, so
+// it is meant for a monitoring interval, not for every event.
+#define LR_JITTER_WORST 16
+#define LR_JITTER_MIN_EVENTS 16
+
+typedef struct {
+    uint32_t session_id;
+    uint32_t reserved;
+    uint64_t events;
+    double jitter_ns;
+    // The session's mean spacing per sqn.
+    double interval_ns;
+} LRJitterSession;
+
+typedef struct {
+    uint64_t sessions;
+    double mean_ns;
+    double p50_ns;
+    double p90_ns;
+    double p99_ns;
+    double max_ns;
+    uint32_t worst_count;
+    uint32_t reserved;
+    LRJitterSession worst[LR_JITTER_WORST];
+} LRJitterStats;
+
+// Returns 0, or -1 when jitter is not tracked.
+int lr_jitter_stats(LRJitterStats* out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
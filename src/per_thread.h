@@ -0,0 +1,66 @@
+// Per-thread instances of T that other threads can enumerate.
+//
+// Each thread lazily gets its own cache-line aligned T on first use of
+// local().  Instances are pushed onto a lock-free list and never freed,
+// so whatever a thread recorded stays visible to for_each() after that
+// thread exits.  T must be default constructible.
+//
+// The per-thread pointer uses the initial-exec TLS model so local() is a
+// single %fs-relative load even inside the dlopen()ed plugin; it takes
+// 8 bytes of the static TLS surplus glibc reserves for such libraries.
+
+#ifndef LR_PER_THREAD_H
+#define LR_PER_THREAD_H
+
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+
+namespace lr {
+
+template <typename T>
+class PerThread {
+public:
+    static T& local()
+    {
+        static thread_local T* instance __attribute__((tls_model("initial-exec"))) = nullptr;
+        if (__builtin_expect(instance == nullptr, 0))
+            instance = add();
+        return *instance;
+    }
+
+    template <typename F>
+    static void for_each(F f)
+    {
+        for (Node* n = head().load(std::memory_order_acquire); n; n = n->next)
+            f(n->value);
+    }
+
+private:
+    struct alignas(64) Node {
+        T value;
+        Node* next;
+    };
+
+    static std::atomic<Node*>& head()
+    {
+        static std::atomic<Node*> list(nullptr);
+        return list;
+    }
+
+    static T* add()
+    {
+        void* mem = nullptr;
+        if (posix_memalign(&mem, alignof(Node), sizeof(Node)) != 0)
+            throw std::bad_alloc();
+        Node* n = new (mem) Node();
+        n->next = head().load(std::memory_order_relaxed);
+        while (!head().compare_exchange_weak(n->next, n, std::memory_order_release, std::memory_order_relaxed))
+            ;
+        return &n->value;
+    }
+};
+
+}
+
+#endif
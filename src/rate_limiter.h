@@ -0,0 +1,95 @@
+// Per-session token-bucket admission control (LR_RATE).
+//
+// Each session may have LR_RATE data events per second answered, with
+// bursts of up to LR_RATE_BURST.  The bucket is kept in its GCRA form:
+// one 64-bit theoretical arrival time (TAT) per session, in TSC cycles.
+// An event conforms if, after charging it one interval, the TAT is no
+// more than burst intervals ahead of now.  Admitting an event is a
+// compare and an add on the TSC read the caller already made; there is
+// no division and no floating point on the event path.
+//
+// The TATs live in a flat array parallel to the session table, indexed
+// by slot, so a session costs 8 more bytes and the limiter needs no hash
+// of its own.  Like the session table, a given slot must only be used by
+// one thread at a time.
+
+#ifndef LR_RATE_LIMITER_H
+#define LR_RATE_LIMITER_H
+
+#include <stdint.h>
+#include <sys/mman.h>
+
+namespace lr {
+
+class RateLimiter {
+public:
+    enum Verdict { kAdmit, kDefer, kDrop };
+
+    // `slots` TATs; `interval` cycles per event at the sustained rate,
+    // `burst` events back to back.  Events up to `max_delay` cycles
+    // early may be deferred instead of dropped.
+    RateLimiter(uint64_t slots, uint64_t interval, uint32_t burst, uint64_t max_delay, bool prefault)
+        : tat_(nullptr)
+        , slots_(slots)
+        , interval_(interval ? interval : 1)
+        , window_(interval_ * (burst ? burst : 1))
+        , max_delay_(max_delay)
+    {
+        if (slots == 0)
+            return;
+        void* p = mmap(nullptr, slots * sizeof(uint64_t), PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | (prefault ? MAP_POPULATE : 0), -1, 0);
+        if (p != MAP_FAILED)
+            tat_ = static_cast<uint64_t*>(p);
+    }
+
+    ~RateLimiter()
+    {
+        if (tat_)
+            munmap(tat_, slots_ * sizeof(uint64_t));
+    }
+
+    RateLimiter(const RateLimiter&) = delete;
+    RateLimiter& operator=(const RateLimiter&) = delete;
+
+    bool ok() const { return tat_ != nullptr; }
+    uint64_t interval() const { return interval_; }
+    bool defers() const { return max_delay_ != 0; }
+
+    // A new session in `slot` starts with a full bucket.
+    void reset(uint64_t slot) { tat_[slot] = 0; }
+
+    // Charges the session in `slot` for an event at `now`.  kDefer, only
+    // offered when `can_defer`, also charges it and sets *due to when the
+    // event would have conformed.
+    Verdict admit(uint64_t slot, uint64_t now, bool can_defer, uint64_t* due)
+    {
+        uint64_t tat = tat_[slot];
+        // Stamps may come from other cores, so compare as a difference.
+        if (int64_t(tat - now) < 0)
+            tat = now;
+        uint64_t next = tat + interval_;
+        uint64_t ahead = next - now;
+        if (ahead <= window_) {
+            tat_[slot] = next;
+            return kAdmit;
+        }
+        if (can_defer && ahead - window_ <= max_delay_) {
+            tat_[slot] = next;
+            *due = next - window_;
+            return kDefer;
+        }
+        return kDrop;
+    }
+
+private:
+    uint64_t* tat_;
+    uint64_t slots_;
+    uint64_t interval_;
+    uint64_t window_;
+    uint64_t max_delay_;
+};
+
+}
+
+#endif
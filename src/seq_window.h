@@ -0,0 +1,85 @@
+// Per-session sequence number tracking: loss, duplicates and reordering.
+//
+// Keeps the highest sqn seen plus a bitmap of which of the 64 sqns at and
+// below it have arrived, like an IPsec anti-replay window.  Comparisons
+// use serial number arithmetic (RFC 1982), so the 32-bit sqn may wrap.
+
+#ifndef LR_SEQ_WINDOW_H
+#define LR_SEQ_WINDOW_H
+
+#include <stdint.h>
+
+namespace lr {
+
+struct SeqWindow {
+    enum Result {
+        kFirst,      // first sqn of the session
+        kInOrder,    // highest + 1
+        kGap,        // beyond highest + 1; the skipped sqns count as gaps
+        kReordered,  // below highest, inside the window, not seen before
+        kDuplicate,  // already seen inside the window
+        kStale,      // too far below highest to tell
+        kResync,     // jumped so far either way the sender must have restarted
+    };
+
+    static const unsigned kWindow = 64;
+    // Jumps at least this large either way restart the window: forward
+    // instead of counting tens of thousands of lost sqns, backward
+    // instead of taking every event of a restarted sender as stale.
+    static const uint32_t kResyncDistance = 1u << 16;
+
+    uint64_t bitmap;
+    uint32_t highest;
+    uint32_t gaps;
+    uint32_t reordered;
+    uint32_t duplicates;
+    uint32_t stale;
+    uint32_t resyncs;
+
+    // The window must start zeroed; bit 0 doubles as "seen anything".
+    Result update(uint32_t sqn)
+    {
+        if (bitmap == 0) {
+            highest = sqn;
+            bitmap = 1;
+            return kFirst;
+        }
+        int32_t delta = int32_t(sqn - highest);
+        if (delta > 0) {
+            highest = sqn;
+            if (uint32_t(delta) >= kResyncDistance) {
+                bitmap = 1;
+                ++resyncs;
+                return kResync;
+            }
+            bitmap = uint32_t(delta) < kWindow ? (bitmap << delta) | 1 : 1;
+            if (delta == 1)
+                return kInOrder;
+            gaps += uint32_t(delta) - 1;
+            return kGap;
+        }
+        uint32_t back = uint32_t(-int64_t(delta));
+        if (back >= kResyncDistance) {
+            highest = sqn;
+            bitmap = 1;
+            ++resyncs;
+            return kResync;
+        }
+        if (back >= kWindow) {
+            ++stale;
+            return kStale;
+        }
+        uint64_t bit = uint64_t(1) << back;
+        if (bitmap & bit) {
+            ++duplicates;
+            return kDuplicate;
+        }
+        bitmap |= bit;
+        ++reordered;
+        return kReordered;
+    }
+};
+
+}
+
+#endif
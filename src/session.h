@@ -0,0 +1,27 @@
+// What the responder keeps per session.  Lives inline in a SessionTable
+// slot next to the 8-byte tag, so it must stay within 56 bytes to keep a
+// slot on one cache line.
+
+#ifndef LR_SESSION_H
+#define LR_SESSION_H
+
+#include <stdint.h>
+
+#include "seq_window.h"
+
+namespace lr {
+
+struct SessionState {
+    uint64_t events;
+    uint64_t notifies;
+    SeqWindow seq;
+    uint32_t last_event_type;
+    // IdleEvictor tick of the latest event, while LR_IDLE_TIMEOUT_MS is set.
+    uint32_t last_seen;
+};
+
+static_assert(sizeof(SessionState) <= 56, "SessionState must fit a one-line slot");
+
+}
+
+#endif
@@ -0,0 +1,306 @@
+// Open-addressing hash table from 32-bit session_id to per-session state.
+//
+// Slots are flat, cache-line sized and aligned, so a lookup that hits on
+// its home slot touches exactly one line, and probing walks adjacent lines
+// the hardware prefetcher already follows.  The slot array is reserved
+// once with mmap and backed by transparent huge pages where available;
+// inserts never allocate.  By default the whole array is prefaulted when
+// the table is created, because sessions land on random slots and a first
+// touch page fault costs microseconds on the event path.  Without
+// prefaulting, pages are committed as sessions land on them.
+//
+// Each slot's tag packs (session_id << 32 | state) into one atomic word,
+// so an all-zero page is an empty table and lookups read one word to both
+// match the key and check liveness.  Operations on different sessions may
+// run concurrently from any threads; a given session must only be used by
+// one thread at a time, as the runtime delivers each session's events in
+// order.  Values are owned by that thread and are not atomic.
+//
+// Erasing leaves a tombstone, since values never move: other threads hold
+// pointers to them and arrays parallel to the table are indexed by slot.
+// After each erase the probe run around the slot is swept backwards from
+// its end, and every tombstone that no live session further along the run
+// probes past is emptied again.  The tombstones left are reused by the
+// inserts that probe past them, so under churn the slots in use stay
+// close to the live sessions instead of filling the table.  Sweeps and the
+// inserts of new sessions take one mutex; lookups, and lookups of sessions
+// find_or_insert already has, take none.  Erasing is a single CAS outside
+// it, which only ever makes more of a run sweepable.
+//
+// erase() is for the thread that owns the session.  erase_at() may be
+// called from any thread, while the owner is still handling an event with
+// a pointer to the value, so the slot it frees is retired rather than
+// deleted: it is neither reused nor emptied until every lr::Epoch guard
+// open at the time has closed, and users of the table that erase_at()
+// hold a guard while they use a value.  collect() turns such slots into
+// ordinary tombstones once that is the case.
+
+#ifndef LR_SESSION_TABLE_H
+#define LR_SESSION_TABLE_H
+
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "epoch.h"
+
+namespace lr {
+
+template <typename V>
+class SessionTable {
+public:
+    static const uint64_t kEmpty = 0;
+    static const uint64_t kLive = 1;
+    static const uint64_t kDeleted = 2;
+    // Erased by erase_at() and waiting for the epoch.
+    static const uint64_t kRetired = 3;
+
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> tag;
+        V value;
+    };
+    static_assert(sizeof(Slot) % 64 == 0, "slots must be whole cache lines");
+    static_assert(std::is_trivially_destructible<V>::value, "erase does not run destructors");
+
+    // Room for max_sessions at a load factor of at most 1/2.
+    explicit SessionTable(uint32_t max_sessions, bool prefault = true)
+        : slots_(nullptr)
+        , mask_(0)
+        , shift_(32)
+        , size_(0)
+    {
+        if (max_sessions == 0)
+            return;
+        uint64_t capacity = 2;
+        unsigned bits = 1;
+        while (capacity < 2 * uint64_t(max_sessions)) {
+            capacity <<= 1;
+            ++bits;
+        }
+        size_t bytes = capacity * sizeof(Slot);
+        void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (p == MAP_FAILED)
+            return;
+        madvise(p, bytes, MADV_HUGEPAGE);
+        slots_ = static_cast<Slot*>(p);
+        if (prefault) {
+            for (uint64_t i = 0; i < capacity; i += 4096 / sizeof(Slot))
+                slots_[i].tag.store(kEmpty, std::memory_order_relaxed);
+        }
+        mask_ = capacity - 1;
+        shift_ = 32 - bits;
+    }
+
+    ~SessionTable()
+    {
+        if (slots_)
+            munmap(slots_, capacity() * sizeof(Slot));
+    }
+
+    SessionTable(const SessionTable&) = delete;
+    SessionTable& operator=(const SessionTable&) = delete;
+
+    bool ok() const { return slots_ != nullptr; }
+    uint64_t capacity() const { return slots_ ? mask_ + 1 : 0; }
+    uint64_t size() const { return size_.load(std::memory_order_relaxed); }
+
+    // Position of a value find() or find_or_insert() returned, for state
+    // kept in arrays parallel to the table.
+    uint64_t index(const V* value) const
+    {
+        return uint64_t(reinterpret_cast<const char*>(value) - reinterpret_cast<const char*>(slots_)) / sizeof(Slot);
+    }
+
+    V* find(uint32_t session_id)
+    {
+        if (!slots_)
+            return nullptr;
+        uint64_t live = live_tag(session_id);
+        for (uint64_t i = home(session_id), n = 0; n <= mask_; i = (i + 1) & mask_, ++n) {
+            uint64_t tag = slots_[i].tag.load(std::memory_order_acquire);
+            if (tag == live)
+                return &slots_[i].value;
+            if (tag == kEmpty)
+                return nullptr;
+        }
+        return nullptr;
+    }
+
+    // Returns the session's state, inserting a value-initialized one if
+    // the session is new.  *inserted tells which.  Returns nullptr only
+    // when the table is full or could not be mapped.
+    V* find_or_insert(uint32_t session_id, bool* inserted = nullptr)
+    {
+        if (V* value = find(session_id)) {
+            if (inserted)
+                *inserted = false;
+            return value;
+        }
+        if (!slots_)
+            return nullptr;
+        std::lock_guard<std::mutex> guard(structure_);
+        Slot* reuse = nullptr;
+        uint64_t i = home(session_id);
+        for (uint64_t n = 0; n <= mask_; i = (i + 1) & mask_, ++n) {
+            uint64_t tag = slots_[i].tag.load(std::memory_order_acquire);
+            if (tag == kEmpty)
+                return fresh(reuse ? *reuse : slots_[i], session_id, inserted);
+            if (tag == kDeleted && !reuse)
+                reuse = &slots_[i];
+        }
+        return reuse ? fresh(*reuse, session_id, inserted) : nullptr;
+    }
+
+    bool erase(uint32_t session_id)
+    {
+        if (!slots_)
+            return false;
+        uint64_t live = live_tag(session_id);
+        for (uint64_t i = home(session_id), n = 0; n <= mask_; i = (i + 1) & mask_, ++n) {
+            uint64_t tag = slots_[i].tag.load(std::memory_order_acquire);
+            if (tag == live) {
+                // erase_at() may have taken it in the meantime.
+                if (!slots_[i].tag.compare_exchange_strong(tag, kDeleted, std::memory_order_acq_rel))
+                    return false;
+                size_.fetch_sub(1, std::memory_order_relaxed);
+                std::lock_guard<std::mutex> guard(structure_);
+                sweep(i);
+                return true;
+            }
+            if (tag == kEmpty)
+                return false;
+        }
+        return false;
+    }
+
+    // The value in slot `index` and its session, if the slot is live.
+    V* at(uint64_t index, uint32_t* session_id)
+    {
+        uint64_t tag = slots_[index].tag.load(std::memory_order_acquire);
+        if ((tag & 0xffffffffu) != kLive)
+            return nullptr;
+        *session_id = uint32_t(tag >> 32);
+        return &slots_[index].value;
+    }
+
+    // Erases the session in slot `index` if it is still `session_id`.
+    // The slot is retired until collect() finds the epoch has moved on.
+    bool erase_at(uint64_t index, uint32_t session_id)
+    {
+        uint64_t live = live_tag(session_id);
+        if (!slots_[index].tag.compare_exchange_strong(live, kRetired, std::memory_order_seq_cst))
+            return false;
+        size_.fetch_sub(1, std::memory_order_relaxed);
+        uint64_t epoch = Epoch::current();
+        std::lock_guard<std::mutex> guard(structure_);
+        retired_.push_back(std::make_pair(index, epoch));
+        return true;
+    }
+
+    // Frees the retired slots no guard can still be using.  Returns how
+    // many remain retired.
+    uint64_t collect()
+    {
+        std::lock_guard<std::mutex> guard(structure_);
+        size_t kept = 0;
+        for (size_t i = 0; i < retired_.size(); ++i) {
+            if (!Epoch::passed(retired_[i].second)) {
+                retired_[kept++] = retired_[i];
+                continue;
+            }
+            slots_[retired_[i].first].tag.store(kDeleted, std::memory_order_release);
+            sweep(retired_[i].first);
+        }
+        retired_.resize(kept);
+        return kept;
+    }
+
+    // Slots that are not empty: live sessions plus tombstones.  Walks the
+    // whole table.
+    uint64_t occupied() const
+    {
+        uint64_t n = 0;
+        for (uint64_t i = 0; i < capacity(); ++i)
+            n += slots_[i].tag.load(std::memory_order_relaxed) != kEmpty;
+        return n;
+    }
+
+    // Calls f(session_id, value) for every live session.  Intended for
+    // stats readers; values may be mid-update.
+    template <typename F>
+    void for_each(F f)
+    {
+        for (uint64_t i = 0; i < capacity(); ++i) {
+            uint64_t tag = slots_[i].tag.load(std::memory_order_acquire);
+            if ((tag & 0xffffffffu) == kLive)
+                f(uint32_t(tag >> 32), slots_[i].value);
+        }
+    }
+
+private:
+    static uint64_t live_tag(uint32_t session_id) { return uint64_t(session_id) << 32 | kLive; }
+
+    // Fibonacci hashing: session ids are often sequential, and the
+    // multiply spreads them over the whole table.
+    uint64_t home(uint32_t session_id) const { return uint32_t(session_id * 0x9e3779b1u) >> shift_; }
+
+    // Takes an empty slot or a tombstone for session_id.  The structure
+    // mutex is held, so nothing else can claim it.
+    V* fresh(Slot& slot, uint32_t session_id, bool* inserted)
+    {
+        new (&slot.value) V();
+        slot.tag.store(live_tag(session_id), std::memory_order_release);
+        size_.fetch_add(1, std::memory_order_relaxed);
+        if (inserted)
+            *inserted = true;
+        return &slot.value;
+    }
+
+    // Empties the tombstones of the probe run through slot `i` that no
+    // live session after them needs.  Walking back from the run's end,
+    // `need` is the furthest back any session seen so far probed from;
+    // a tombstone beyond it is on nobody's path.  A session erased while
+    // the sweep runs only keeps its path a little longer, and a retired
+    // slot is kept whatever.  The structure mutex must be held.
+    void sweep(uint64_t i)
+    {
+        uint64_t end = i;
+        for (uint64_t n = 0; slots_[end].tag.load(std::memory_order_acquire) != kEmpty; ++n) {
+            if (n == mask_)
+                return;
+            end = (end + 1) & mask_;
+        }
+        uint64_t need = 0;
+        for (uint64_t back = 1; back <= mask_; ++back) {
+            uint64_t p = (end - back) & mask_;
+            uint64_t tag = slots_[p].tag.load(std::memory_order_acquire);
+            if (tag == kEmpty)
+                return;
+            if ((tag & 0xffffffffu) == kLive) {
+                uint64_t from = (end - home(uint32_t(tag >> 32))) & mask_;
+                if (from > need)
+                    need = from;
+            } else if (tag == kDeleted && back > need) {
+                slots_[p].tag.store(kEmpty, std::memory_order_release);
+            }
+        }
+    }
+
+    Slot* slots_;
+    uint64_t mask_;
+    unsigned shift_;
+    std::atomic<uint64_t> size_;
+    std::mutex structure_;
+    // Slots erase_at() retired and the epoch it happened in.
+    std::vector<std::pair<uint64_t, uint64_t>> retired_;
+};
+
+}
+
+#endif
@@ -0,0 +1,110 @@
+// Response payload shaping for capacity tests (LR_SHAPE).
+//
+// Instead of echoing a request, the responder can answer with:
+//   truncate:N  the first N bytes of the request
+//   pad:N       exactly N bytes, whatever the request's size, N > 0
+//   amplify:R   R times the request's size, R > 0
+// No mode copies or clears memory per event.  Responses no longer than
+// the request are a prefix of it.  Longer ones are a prefix of one
+// read-only buffer filled with a fixed pattern when the plugin loads;
+// ENSUserData is a single buffer, so they cannot carry the request in
+// front of the padding.
+
+#ifndef LR_SHAPER_H
+#define LR_SHAPER_H
+
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include "ens.h"
+
+namespace lr {
+
+class Shaper {
+public:
+    enum Mode { kEcho, kTruncate, kPad, kAmplify };
+
+    // Largest response amplify produces; larger ones are clipped, but
+    // never below the request: requests at least this long are echoed.
+    static const uint32_t kMaxAmplified = 1u << 20;
+
+    // `bytes` is N for truncate and pad, `ratio` R for amplify.
+    Shaper(Mode mode, uint32_t bytes, double ratio)
+        : mode_(mode)
+        , bytes_(bytes)
+        // 16.16 fixed point: one multiply per event, no floating point.
+        , ratio_(uint64_t(ratio * 65536.0 + 0.5))
+        , fill_(nullptr)
+        , fill_size_(0)
+    {
+        uint32_t size = mode == kPad ? bytes : mode == kAmplify && ratio_ > 65536 ? kMaxAmplified : 0;
+        if (size == 0)
+            return;
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            return;
+        uint8_t* b = static_cast<uint8_t*>(p);
+        for (uint32_t i = 0; i < size; ++i)
+            b[i] = uint8_t(i);
+        mprotect(p, size, PROT_READ);
+        fill_ = b;
+        fill_size_ = size;
+    }
+
+    ~Shaper()
+    {
+        if (fill_)
+            munmap(fill_, fill_size_);
+    }
+
+    Shaper(const Shaper&) = delete;
+    Shaper& operator=(const Shaper&) = delete;
+
+    // Whether every mode that needs the read-only buffer got one.
+    bool ok() const { return fill_ || (mode_ != kPad && !(mode_ == kAmplify && ratio_ > 65536)); }
+    Mode mode() const { return mode_; }
+
+    // The response to `in`, described by `out` when it differs from `in`.
+    // The result must not be written to: it may be read-only.
+    ENSUserData* shape(ENSUserData* in, ENSUserData& out) const
+    {
+        uint32_t len = in ? in->length : 0;
+        uint64_t want;
+        switch (mode_) {
+        case kTruncate:
+            want = len < bytes_ ? len : bytes_;
+            break;
+        case kPad:
+            want = bytes_;
+            break;
+        case kAmplify:
+            want = uint64_t(len) * ratio_ >> 16;
+            break;
+        default:
+            return in;
+        }
+        if (want <= len) {
+            if (!in || want == len)
+                return in;
+            out.length = uint32_t(want);
+            out.p = in->p;
+        } else {
+            if (len >= fill_size_)
+                return in;
+            out.length = uint32_t(want < fill_size_ ? want : fill_size_);
+            out.p = fill_;
+        }
+        return &out;
+    }
+
+private:
+    Mode mode_;
+    uint32_t bytes_;
+    uint64_t ratio_;
+    uint8_t* fill_;
+    uint32_t fill_size_;
+};
+
+}
+
+#endif
@@ -0,0 +1,126 @@
+// Lock-free single-producer single-consumer ring of variable-sized
+// records.
+//
+// Records are laid out back to back in one power-of-two byte array, each
+// behind an 8-byte header and padded to a cache line, so the producer
+// writing one record and the consumer reading an earlier one never share
+// a line.  A record that would straddle the end of the array is preceded
+// by a wrap marker and starts again at offset 0.
+//
+// head_ and tail_ are byte positions that only grow.  Each side keeps a
+// cached copy of the other's position on its own cache line and reloads
+// it only when the ring looks full (producer) or empty (consumer), so in
+// steady state neither side touches the other's line.
+
+#ifndef LR_SPSC_RING_H
+#define LR_SPSC_RING_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <atomic>
+
+namespace lr {
+
+class SpscRing {
+public:
+    // `bytes` must be a power of two of at least 4096.
+    explicit SpscRing(uint32_t bytes)
+        : buf_(static_cast<uint8_t*>(aligned_alloc(64, bytes)))
+        , mask_(bytes - 1)
+        , head_(0)
+        , tail_cache_(0)
+        , pending_(0)
+        , tail_(0)
+        , head_cache_(0)
+        , release_(0)
+    {
+    }
+
+    ~SpscRing() { free(buf_); }
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    bool ok() const { return buf_ != nullptr; }
+
+    // Largest record try_reserve() can ever satisfy.
+    uint32_t max_record() const { return (mask_ + 1) / 2 - kHeader; }
+
+    // Producer: returns room for a `size`-byte record, or nullptr while
+    // the ring is too full.  The record becomes visible on commit().
+    void* try_reserve(uint32_t size)
+    {
+        uint64_t head = head_.load(std::memory_order_relaxed);
+        uint64_t need = padded(size);
+        uint64_t off = head & mask_;
+        uint64_t to_end = mask_ + 1 - off;
+        uint64_t total = need <= to_end ? need : to_end + need;
+        if (head + total - tail_cache_ > mask_ + 1) {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+            if (head + total - tail_cache_ > mask_ + 1)
+                return nullptr;
+        }
+        if (need > to_end) {
+            header(off) = kWrap;
+            off = 0;
+        }
+        header(off) = size;
+        pending_ = head + total;
+        return buf_ + off + kHeader;
+    }
+
+    void commit() { head_.store(pending_, std::memory_order_release); }
+
+    // Consumer: returns the oldest record and its size, or nullptr when
+    // the ring is empty.  The record stays valid, and writable, until
+    // release().
+    void* peek(uint32_t* size)
+    {
+        uint64_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == head_cache_) {
+            head_cache_ = head_.load(std::memory_order_acquire);
+            if (tail == head_cache_)
+                return nullptr;
+        }
+        uint64_t off = tail & mask_;
+        if (header(off) == kWrap) {
+            // The producer published the wrap marker and the record after
+            // it with one commit.
+            tail += mask_ + 1 - off;
+            off = 0;
+        }
+        *size = header(off);
+        release_ = tail + padded(*size);
+        return buf_ + off + kHeader;
+    }
+
+    void release() { tail_.store(release_, std::memory_order_release); }
+
+    // Whether the consumer has released everything committed so far.
+    // Callable from any thread.
+    bool empty() const { return tail_.load(std::memory_order_acquire) == head_.load(std::memory_order_acquire); }
+
+private:
+    static const uint32_t kHeader = 8;
+    static const uint32_t kWrap = ~0u;
+
+    static uint64_t padded(uint32_t size) { return (uint64_t(size) + kHeader + 63) & ~uint64_t(63); }
+
+    uint32_t& header(uint64_t off) { return *reinterpret_cast<uint32_t*>(buf_ + off); }
+
+    uint8_t* const buf_;
+    const uint64_t mask_;
+
+    alignas(64) std::atomic<uint64_t> head_;
+    uint64_t tail_cache_;
+    uint64_t pending_;
+
+    alignas(64) std::atomic<uint64_t> tail_;
+    uint64_t head_cache_;
+    uint64_t release_;
+};
+
+}
+
+#endif
@@ -0,0 +1,84 @@
+#include "stats_segment.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <chrono>
+
+#include "tsc.h"
+
+namespace lr {
+
+StatsPublisher::StatsPublisher(const char* name, unsigned interval_ms, double tsc_hz, Collect collect)
+    : name_(name)
+    , interval_ms_(interval_ms)
+    , collect_(collect)
+    , seg_(nullptr)
+    , stop_(false)
+{
+    int fd = shm_open(name, O_CREAT | O_RDWR, 0644);
+    if (fd < 0)
+        return;
+    void* p = MAP_FAILED;
+    if (ftruncate(fd, sizeof(LRStatsSegment)) == 0)
+        p = mmap(nullptr, sizeof(LRStatsSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        shm_unlink(name);
+        return;
+    }
+    seg_ = static_cast<LRStatsSegment*>(p);
+    memset(seg_, 0, sizeof(*seg_));
+    seg_->version = LR_STATS_VERSION;
+    seg_->size = sizeof(LRStatsSegment);
+    seg_->pid = uint32_t(getpid());
+    seg_->snapshot.load_ns = realtime_ns();
+    seg_->snapshot.tsc_hz = tsc_hz;
+    // Readers check the magic last, so publish it after the rest.
+    __atomic_store_n(&seg_->magic, LR_STATS_MAGIC, __ATOMIC_RELEASE);
+    scratch_ = seg_->snapshot;
+    thread_ = std::thread(&StatsPublisher::run, this);
+}
+
+StatsPublisher::~StatsPublisher()
+{
+    if (!seg_)
+        return;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        stop_ = true;
+    }
+    wake_.notify_one();
+    thread_.join();
+    publish();
+    munmap(seg_, sizeof(*seg_));
+    shm_unlink(name_.c_str());
+}
+
+void StatsPublisher::run()
+{
+    std::unique_lock<std::mutex> guard(lock_);
+    while (!stop_) {
+        guard.unlock();
+        publish();
+        guard.lock();
+        wake_.wait_for(guard, std::chrono::milliseconds(interval_ms_), [this] { return stop_; });
+    }
+}
+
+// Collects into scratch_ first, so the segment stays odd only for the
+// copy, not for the walk over every thread's counters.
+void StatsPublisher::publish()
+{
+    collect_(scratch_);
+    scratch_.updates = seg_->snapshot.updates + 1;
+    scratch_.publish_ns = realtime_ns();
+    uint64_t seq = seg_->seq;
+    __atomic_store_n(&seg_->seq, seq + 1, __ATOMIC_RELAXED);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(&seg_->snapshot, &scratch_, sizeof(scratch_));
+    __atomic_store_n(&seg_->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+}
@@ -0,0 +1,154 @@
+// Layout of the shared-memory statistics segment latencyresponder.so
+// publishes, and the seqlock protocol for reading it.
+//
+// The plugin creates the POSIX shared-memory object LR_SHM_NAME (default
+// "/latencyresponder.<pid>") at load and, from a thread of its own,
+// rewrites the snapshot in it every LR_SHM_INTERVAL_MS.  event_handler
+// does nothing for it: the publisher sums the per-thread counters and
+// histograms the event path keeps anyway.  The object is unlinked when
+// the plugin unloads.
+//
+// seq is even while the snapshot is stable and odd while it is being
+// rewritten.  A reader loads seq, copies the snapshot, loads seq again
+// and retries unless both loads returned the same even value;
+// lr::read_stats() does exactly that.  The layout is plain C so sidecars
+// in other languages can map it; version changes whenever it does.
+
+#ifndef LR_STATS_SEGMENT_H
+#define LR_STATS_SEGMENT_H
+
+#include <stdint.h>
+
+#define LR_STATS_MAGIC 0x5453524cu /* "LRST" */
+#define LR_STATS_VERSION 3
+// Latency buckets, laid out as lr::Histogram: values below 64 get a bucket
+// each, above that every power of two is split into 64 linear buckets.
+#define LR_STATS_BUCKETS 2304
+
+typedef struct {
+    uint64_t updates;
+    // CLOCK_REALTIME of this snapshot and of the plugin load.
+    uint64_t publish_ns;
+    uint64_t load_ns;
+    // Latency buckets count TSC cycles at this rate.
+    double tsc_hz;
+
+    uint64_t data_events;
+    uint64_t notifies;
+    uint64_t opens;
+    uint64_t closes;
+    uint64_t keepalives;
+    uint64_t unknown_events;
+
+    uint64_t sessions;
+    // Events that found the session table full and went untracked.
+    uint64_t table_full;
+    uint64_t seq_gaps;
+    uint64_t seq_reordered;
+    uint64_t seq_duplicates;
+    // Responses sent without a stamp, response buffers that fell back to
+    // malloc, and events that waited for room in a worker ring.  None of
+    // them loses a response.
+    uint64_t stamp_skipped;
+    uint64_t pool_overflows;
+    uint64_t ring_full_waits;
+    // Data events left unanswered: dropped by the rate limiter,
+    // retransmits suppressed by the dedup cache, and key-value commands
+    // whose reply got no buffer.
+    uint64_t rate_dropped;
+    uint64_t dedup_suppressed;
+    uint64_t kv_dropped;
+    // Key-value PUTs answered LR_KV_FULL.
+    uint64_t kv_full;
+
+    // Interarrival jitter of live sessions (LR_JITTER), as
+    // lr_jitter_stats() reports it: the sessions with an estimate, and the
+    // mean, p99 and max over them.  The walk reads every slot of the
+    // session table, so it is refreshed about once a second, not on every
+    // update.  All 0 while jitter is not tracked.
+    uint64_t jitter_sessions;
+    double jitter_mean_ns;
+    double jitter_p99_ns;
+    double jitter_max_ns;
+
+    // Responder latency, as lr_latency_summary() reports it.
+    uint64_t latency_count;
+    uint64_t latency_sum;
+    uint64_t latency_max;
+    uint64_t latency_buckets[LR_STATS_BUCKETS];
+} LRStatsSnapshot;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    uint32_t pid;
+    uint64_t seq;
+    uint64_t reserved[5];
+    LRStatsSnapshot snapshot;
+} LRStatsSegment;
+
+#ifdef __cplusplus
+
+#include <string.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace lr {
+
+// Copies a consistent snapshot out of a mapped segment.  Returns false if
+// the writer kept it busy for `attempts` tries.
+inline bool read_stats(const LRStatsSegment* seg, LRStatsSnapshot* out, unsigned attempts = 1000)
+{
+    for (unsigned i = 0; i < attempts; ++i) {
+        uint64_t before = __atomic_load_n(&seg->seq, __ATOMIC_ACQUIRE);
+        if (before & 1)
+            continue;
+        memcpy(out, &seg->snapshot, sizeof(*out));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (__atomic_load_n(&seg->seq, __ATOMIC_RELAXED) == before)
+            return true;
+    }
+    return false;
+}
+
+// Creates the segment and keeps it up to date from its own thread.
+class StatsPublisher {
+public:
+    // Fills a snapshot's counters; updates, publish_ns, load_ns and
+    // tsc_hz are the publisher's.
+    typedef void (*Collect)(LRStatsSnapshot& out);
+
+    StatsPublisher(const char* name, unsigned interval_ms, double tsc_hz, Collect collect);
+    // Stops the thread and unlinks the segment.
+    ~StatsPublisher();
+
+    StatsPublisher(const StatsPublisher&) = delete;
+    StatsPublisher& operator=(const StatsPublisher&) = delete;
+
+    bool ok() const { return seg_ != nullptr; }
+
+private:
+    void run();
+    void publish();
+
+    std::string name_;
+    unsigned interval_ms_;
+    Collect collect_;
+    LRStatsSegment* seg_;
+    LRStatsSnapshot scratch_;
+    std::mutex lock_;
+    std::condition_variable wake_;
+    bool stop_;
+    std::thread thread_;
+};
+
+}
+
+#endif
+
+#endif
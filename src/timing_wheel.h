@@ -0,0 +1,264 @@
+// Hierarchical timing wheel over the slots of a table.
+//
+// Four levels of 64 lists each: level 0 holds timers due within 64
+// ticks, one list per tick, and level L one list per 64^L ticks, which
+// is spread over the level below when the wheel reaches it.  Arming,
+// firing and each cascade step are O(1) per timer.  Ticks are 32-bit and
+// compared as differences, so the clock may wrap.
+//
+// Moving the clock and running timers are separate steps.  advance()
+// only splices the lists that come up onto a backlog, and expire() works
+// through the backlog a bounded number of timers at a time, so a cascade
+// of tens of thousands of timers never lands on one caller.
+//
+// Timers are identified by the index of a table slot and linked through
+// an array parallel to the table, so the wheel never allocates.  Each
+// slot has at most one timer.  The wheel does not store due times:
+// whenever a timer comes up, expire() asks the caller when the slot is
+// due now, which lets a slot be pushed back any number of times between
+// firings without touching the wheel.  That keeps the cost per event at
+// zero and moves it to at most one re-arm per slot per timeout.
+//
+// arm() and the read-only accessors may be called from any thread;
+// advance() and expire() from one thread at a time.
+
+#ifndef LR_TIMING_WHEEL_H
+#define LR_TIMING_WHEEL_H
+
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include <atomic>
+
+namespace lr {
+
+class TimingWheel {
+public:
+    static const unsigned kLevels = 4;
+    static const unsigned kBits = 6;
+    static const uint32_t kSlots = 1u << kBits;
+    // Timers further out are placed at the horizon and re-armed from
+    // there.
+    static const uint32_t kHorizon = (1u << (kLevels * kBits)) - 1;
+
+    TimingWheel(uint64_t slots, uint32_t now, bool prefault)
+        : links_(nullptr)
+        , slots_(slots)
+        , now_(now)
+        , pending_(kNil)
+        , claimed_(kNil)
+        , armed_(0)
+        , backlog_(0)
+        , backlog_head_(kNil)
+        , backlog_tail_(kNil)
+    {
+        for (unsigned l = 0; l < kLevels; ++l) {
+            occupied_[l] = 0;
+            for (uint32_t i = 0; i < kSlots; ++i) {
+                heads_[l][i] = kNil;
+                tails_[l][i] = kNil;
+                counts_[l][i] = 0;
+            }
+        }
+        if (slots == 0 || slots > kNil)
+            return;
+        void* p = mmap(nullptr, slots * sizeof(Link), PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | (prefault ? MAP_POPULATE : 0), -1, 0);
+        if (p != MAP_FAILED)
+            links_ = static_cast<Link*>(p);
+    }
+
+    ~TimingWheel()
+    {
+        if (links_)
+            munmap(links_, slots_ * sizeof(Link));
+    }
+
+    TimingWheel(const TimingWheel&) = delete;
+    TimingWheel& operator=(const TimingWheel&) = delete;
+
+    bool ok() const { return links_ != nullptr; }
+    // The tick the wheel has advanced to.
+    uint32_t now() const { return now_.load(std::memory_order_relaxed); }
+    // Timers in the wheel, or waiting to be placed.
+    uint64_t armed() const { return armed_.load(std::memory_order_relaxed); }
+
+    // Gives `slot` a timer unless it has one.  The timer is placed by a
+    // later expire(), which asks when it is due.
+    void arm(uint64_t slot)
+    {
+        if (links_[slot].armed.exchange(1, std::memory_order_acq_rel))
+            return;
+        armed_.fetch_add(1, std::memory_order_relaxed);
+        push_pending(uint32_t(slot));
+    }
+
+    // Timers that have come up and wait for expire().
+    uint64_t backlog() const { return backlog_.load(std::memory_order_relaxed); }
+    // Whether expire() has anything to do.
+    bool busy() const
+    {
+        return backlog_.load(std::memory_order_relaxed) || claimed_.load(std::memory_order_relaxed) != kNil ||
+               pending_.load(std::memory_order_relaxed) != kNil;
+    }
+
+    // Moves the wheel to tick `to`, no further than kHorizon ticks in one
+    // call.  The lists that come up, due or cascading, join the backlog
+    // whole; no timer is looked at, so a step costs O(levels).
+    void advance(uint32_t to)
+    {
+        uint32_t now = now_.load(std::memory_order_relaxed);
+        if (int32_t(to - now) > int32_t(kHorizon))
+            to = now + kHorizon;
+        while (int32_t(to - now) > 0) {
+            if (occupied_[0] == 0) {
+                // Nothing on level 0: skip to its next wrap, where a
+                // cascade may refill it.
+                uint32_t wrap = (now | (kSlots - 1)) + 1;
+                now = int32_t(wrap - to) > 0 ? to : wrap;
+            } else {
+                ++now;
+            }
+            now_.store(now, std::memory_order_relaxed);
+            if ((now & (kSlots - 1)) == 0)
+                cascade(1, now);
+            take(0, now & (kSlots - 1));
+        }
+    }
+
+    // Runs up to `budget` timers from the backlog, then newly armed ones:
+    // due(slot, now, &when) returns false if the slot no longer needs a
+    // timer, or true and sets `when` to the tick it is due.  A timer due
+    // by `now` must be dealt with by the callback, which then returns
+    // false.  Timers that come up late are simply handled late; one that
+    // is not due yet is placed again.  Returns the number run.
+    template <typename Due>
+    uint64_t expire(Due due, uint64_t budget)
+    {
+        uint32_t now = now_.load(std::memory_order_relaxed);
+        uint64_t n = 0;
+        while (n < budget) {
+            uint32_t slot = backlog_head_;
+            if (slot != kNil) {
+                backlog_head_ = links_[slot].next;
+                backlog_.store(backlog_.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+            } else {
+                slot = claimed_.load(std::memory_order_relaxed);
+                if (slot == kNil) {
+                    slot = pending_.exchange(kNil, std::memory_order_acquire);
+                    if (slot == kNil)
+                        break;
+                }
+                claimed_.store(links_[slot].next, std::memory_order_relaxed);
+            }
+            fire(slot, now, due);
+            ++n;
+        }
+        return n;
+    }
+
+private:
+    static const uint32_t kNil = UINT32_MAX;
+
+    struct Link {
+        uint32_t next;
+        std::atomic<uint32_t> armed;
+    };
+
+    void push_pending(uint32_t slot)
+    {
+        uint32_t head = pending_.load(std::memory_order_relaxed);
+        do
+            links_[slot].next = head;
+        while (!pending_.compare_exchange_weak(head, slot, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    // Takes level l's current list after the level above has done the
+    // same, if it wrapped too.
+    void cascade(unsigned l, uint32_t now)
+    {
+        uint32_t i = (now >> (l * kBits)) & (kSlots - 1);
+        if (i == 0 && l + 1 < kLevels)
+            cascade(l + 1, now);
+        take(l, i);
+    }
+
+    // Appends list (l, i) to the backlog.
+    void take(unsigned l, uint32_t i)
+    {
+        uint32_t head = heads_[l][i];
+        if (head == kNil)
+            return;
+        if (backlog_head_ == kNil)
+            backlog_head_ = head;
+        else
+            links_[backlog_tail_].next = head;
+        backlog_tail_ = tails_[l][i];
+        backlog_.store(backlog_.load(std::memory_order_relaxed) + counts_[l][i], std::memory_order_relaxed);
+        heads_[l][i] = kNil;
+        counts_[l][i] = 0;
+        occupied_[l] &= ~(uint64_t(1) << i);
+    }
+
+    template <typename Due>
+    void fire(uint32_t slot, uint32_t now, Due due)
+    {
+        uint32_t when = 0;
+        if (due(slot, now, &when)) {
+            place(slot, when, now);
+            return;
+        }
+        links_[slot].armed.store(0, std::memory_order_seq_cst);
+        armed_.fetch_sub(1, std::memory_order_relaxed);
+        // An arm() that saw the old timer skipped adding one; take over
+        // for it if the slot got a new occupant meanwhile.
+        if (due(slot, now, &when) && !links_[slot].armed.exchange(1, std::memory_order_acq_rel)) {
+            armed_.fetch_add(1, std::memory_order_relaxed);
+            place(slot, when, now);
+        }
+    }
+
+    void place(uint32_t slot, uint32_t when, uint32_t now)
+    {
+        int32_t delta = int32_t(when - now);
+        if (delta <= 0) {
+            when = now + 1;
+            delta = 1;
+        } else if (uint32_t(delta) > kHorizon) {
+            when = now + kHorizon;
+            delta = int32_t(kHorizon);
+        }
+        unsigned l = 0;
+        while (l + 1 < kLevels && uint32_t(delta) >= (1u << ((l + 1) * kBits)))
+            ++l;
+        uint32_t i = (when >> (l * kBits)) & (kSlots - 1);
+        links_[slot].next = heads_[l][i];
+        if (heads_[l][i] == kNil)
+            tails_[l][i] = slot;
+        heads_[l][i] = slot;
+        ++counts_[l][i];
+        occupied_[l] |= uint64_t(1) << i;
+    }
+
+    Link* links_;
+    uint64_t slots_;
+    std::atomic<uint32_t> now_;
+    // Newly armed slots, pushed by any thread, and the part of them
+    // expire() has taken over but not run yet.
+    std::atomic<uint32_t> pending_;
+    std::atomic<uint32_t> claimed_;
+    std::atomic<uint64_t> armed_;
+    // Timers that came up, in order.  The owner writes backlog_ and
+    // claimed_; they are atomic only so busy() can be asked anywhere.
+    std::atomic<uint64_t> backlog_;
+    uint32_t backlog_head_;
+    uint32_t backlog_tail_;
+    uint32_t heads_[kLevels][kSlots];
+    uint32_t tails_[kLevels][kSlots];
+    uint32_t counts_[kLevels][kSlots];
+    uint64_t occupied_[kLevels];
+};
+
+}
+
+#endif
@@ -0,0 +1,117 @@
+#include "trace_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace lr {
+
+TraceRecorder::TraceRecorder(const char* path, uint64_t bytes, uint32_t prefix, uint32_t regions,
+                             const TscClock& clock)
+    : clock_(clock)
+    , base_(nullptr)
+    , bytes_(0)
+    , record_bytes_(0)
+    , prefix_bytes_(0)
+    , regions_(0)
+    , mask_(0)
+    , next_region_(0)
+{
+    if (prefix > LR_TRACE_MAX_PREFIX)
+        prefix = LR_TRACE_MAX_PREFIX;
+    prefix = (prefix + 31) & ~31u;
+    if (regions == 0 || regions > LR_TRACE_MAX_REGIONS)
+        regions = regions ? LR_TRACE_MAX_REGIONS : 1;
+    uint32_t record_bytes = uint32_t(sizeof(LRTraceRecord)) + prefix;
+    // Largest power of two of records per ring that fits in `bytes`.
+    uint64_t per_region = bytes > LR_TRACE_HEADER_BYTES ? (bytes - LR_TRACE_HEADER_BYTES) / regions / record_bytes : 0;
+    if (per_region < 2)
+        return;
+    uint64_t records = 1;
+    while (records * 2 <= per_region)
+        records *= 2;
+    uint64_t total = LR_TRACE_HEADER_BYTES + uint64_t(regions) * records * record_bytes;
+
+    int fd = open(path, O_CREAT | O_RDWR | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return;
+    void* p = MAP_FAILED;
+    // Allocate the blocks now: a store into a hole the filesystem cannot
+    // fill would be a SIGBUS on the event path.
+    if (posix_fallocate(fd, 0, off_t(total)) == 0)
+        p = mmap(nullptr, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        unlink(path);
+        return;
+    }
+    base_ = static_cast<uint8_t*>(p);
+    bytes_ = total;
+    record_bytes_ = record_bytes;
+    prefix_bytes_ = prefix;
+    regions_ = regions;
+    mask_ = records - 1;
+    // Fault the mapping in now rather than on the event path.
+    for (uint64_t i = 0; i < total; i += 4096)
+        base_[i] = 0;
+
+    LRTraceHeader* h = reinterpret_cast<LRTraceHeader*>(base_);
+    h->version = LR_TRACE_VERSION;
+    h->header_bytes = LR_TRACE_HEADER_BYTES;
+    h->record_bytes = record_bytes;
+    h->prefix_bytes = prefix;
+    h->regions = regions;
+    h->region_records = records;
+    h->pid = uint32_t(getpid());
+    h->tsc_hz = clock_.hz();
+    h->load_tsc = rdtsc();
+    h->load_ns = realtime_ns();
+    // Readers check the magic last, so publish it after the rest.
+    __atomic_store_n(&h->magic, LR_TRACE_MAGIC, __ATOMIC_RELEASE);
+}
+
+TraceRecorder::~TraceRecorder()
+{
+    if (!base_)
+        return;
+    reinterpret_cast<LRTraceHeader*>(base_)->tsc_hz = clock_.hz();
+    munmap(base_, bytes_);
+}
+
+void TraceRecorder::claim(Writer& w)
+{
+    w.recorder = this;
+    w.region = nullptr;
+    w.records = nullptr;
+    w.head = 0;
+    if (!base_)
+        return;
+    uint32_t i = next_region_.fetch_add(1, std::memory_order_relaxed);
+    if (i >= regions_)
+        return;
+    LRTraceRegion* regions = reinterpret_cast<LRTraceRegion*>(base_ + 64);
+    w.region = &regions[i];
+    w.region->tid = uint32_t(syscall(SYS_gettid));
+    w.records = base_ + LR_TRACE_HEADER_BYTES + uint64_t(i) * (mask_ + 1) * record_bytes_;
+}
+
+TraceRecorder::Stats TraceRecorder::stats() const
+{
+    Stats s;
+    PerThread<Writer>::for_each([&](const Writer& w) {
+        if (w.recorder != this)
+            return;
+        s.unrecorded += w.unrecorded.get();
+        if (!w.region)
+            return;
+        uint64_t head = __atomic_load_n(&w.region->head, __ATOMIC_ACQUIRE);
+        s.records += head;
+        if (head > mask_)
+            s.overwritten += head - mask_;
+        ++s.threads;
+    });
+    return s;
+}
+
+}
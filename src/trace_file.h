@@ -0,0 +1,170 @@
+// Layout of the event trace file latencyresponder.so records into, and
+// the recorder that writes it.
+//
+// With LR_TRACE=<path> the plugin creates a file of LR_TRACE_BYTES at
+// load, maps it shared and appends one fixed-size record per event
+// event_handler sees, before anything else happens to the event.  The
+// file is split into one ring per calling thread, so recording is a
+// few plain stores into that thread's ring and a release store of its
+// head: no lock, no atomic read-modify-write, no system call.  The
+// oldest records are overwritten once a ring is full.  Threads beyond
+// the number of rings are counted, not recorded.  The file is left in
+// place when the plugin unloads; put it on tmpfs to keep page cache
+// writeback out of the picture entirely.
+//
+// Ring i holds region_records records starting at
+// header_bytes + i * region_records * record_bytes.  Its head counts
+// records ever written to it; record n lives in slot n % region_records.
+// The slot at head % region_records may be half rewritten if the
+// process died while writing it, so readers take at most
+// region_records - 1 records, the ones before head.
+
+#ifndef LR_TRACE_FILE_H
+#define LR_TRACE_FILE_H
+
+#include <stdint.h>
+
+#define LR_TRACE_MAGIC 0x5254524cu /* "LRTR" */
+#define LR_TRACE_VERSION 1
+// Bytes before the first ring: the header, then one LRTraceRegion per
+// ring from offset 64.
+#define LR_TRACE_HEADER_BYTES 4096
+#define LR_TRACE_MAX_REGIONS 63
+// Payload bytes a record can carry, in steps of 32.
+#define LR_TRACE_MAX_PREFIX 224
+
+// LRTraceRecord.flags: the event came with NULL data.
+#define LR_TRACE_NO_DATA 1u
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_bytes;
+    uint32_t record_bytes;
+    uint32_t prefix_bytes;
+    uint32_t regions;
+    uint64_t region_records;
+    uint32_t pid;
+    uint32_t reserved;
+    // TSC rate, rewritten with a longer measurement at unload, and the
+    // TSC and CLOCK_REALTIME at load.
+    double tsc_hz;
+    uint64_t load_tsc;
+    uint64_t load_ns;
+} LRTraceHeader;
+
+typedef struct {
+    uint64_t head;
+    // Thread that owns the ring, 0 while unclaimed.
+    uint32_t tid;
+    uint32_t reserved[13];
+} LRTraceRegion;
+
+typedef struct {
+    uint64_t tsc;
+    uint32_t session_id;
+    uint32_t event_type;
+    uint32_t sqn;
+    // Full payload length; the first min(length, prefix_bytes) payload
+    // bytes follow the record header.
+    uint32_t length;
+    uint32_t flags;
+    uint32_t reserved;
+} LRTraceRecord;
+
+#ifdef __cplusplus
+
+#include <string.h>
+
+#include <atomic>
+
+#include "counter.h"
+#include "ens.h"
+#include "per_thread.h"
+#include "tsc.h"
+
+namespace lr {
+
+static_assert(sizeof(LRTraceHeader) <= 64, "the header must end where the regions start");
+static_assert(sizeof(LRTraceRegion) == 64, "each ring head gets its own cache line");
+static_assert(sizeof(LRTraceRecord) == 32, "records are 32 bytes plus the payload prefix");
+
+class TraceRecorder {
+public:
+    struct Stats {
+        uint64_t records = 0;
+        uint64_t overwritten = 0;
+        uint64_t unrecorded = 0;
+        uint32_t threads = 0;
+    };
+
+    // A file of about `bytes` at `path`, its rings split among `regions`
+    // threads, with room for `prefix` payload bytes (rounded up to 32,
+    // at most LR_TRACE_MAX_PREFIX) in each record.
+    TraceRecorder(const char* path, uint64_t bytes, uint32_t prefix, uint32_t regions, const TscClock& clock);
+    // Records the final TSC rate and unmaps the file.
+    ~TraceRecorder();
+
+    TraceRecorder(const TraceRecorder&) = delete;
+    TraceRecorder& operator=(const TraceRecorder&) = delete;
+
+    bool ok() const { return base_ != nullptr; }
+
+    void record(uint64_t tsc, uint32_t session_id, uint32_t event_type, uint32_t sqn, const ENSUserData* data)
+    {
+        Writer& w = writer();
+        if (__builtin_expect(w.region == nullptr, 0)) {
+            w.unrecorded.add();
+            return;
+        }
+        uint8_t* at = w.records + (w.head & mask_) * record_bytes_;
+        LRTraceRecord r;
+        r.tsc = tsc;
+        r.session_id = session_id;
+        r.event_type = event_type;
+        r.sqn = sqn;
+        r.length = data ? data->length : 0;
+        r.flags = data ? 0 : LR_TRACE_NO_DATA;
+        r.reserved = 0;
+        memcpy(at, &r, sizeof(r));
+        if (prefix_bytes_ && r.length)
+            memcpy(at + sizeof(r), data->p, r.length < prefix_bytes_ ? r.length : prefix_bytes_);
+        __atomic_store_n(&w.region->head, ++w.head, __ATOMIC_RELEASE);
+    }
+
+    Stats stats() const;
+
+private:
+    struct Writer {
+        const TraceRecorder* recorder = nullptr;
+        LRTraceRegion* region = nullptr;
+        uint8_t* records = nullptr;
+        uint64_t head = 0;
+        Counter unrecorded;
+    };
+
+    Writer& writer()
+    {
+        Writer& w = PerThread<Writer>::local();
+        if (__builtin_expect(w.recorder != this, 0))
+            claim(w);
+        return w;
+    }
+
+    void claim(Writer& w);
+
+    const TscClock& clock_;
+    uint8_t* base_;
+    uint64_t bytes_;
+    uint32_t record_bytes_;
+    uint32_t prefix_bytes_;
+    uint32_t regions_;
+    uint64_t mask_;
+    std::atomic<uint32_t> next_region_;
+};
+
+}
+
+#endif
+
+#endif
@@ -0,0 +1,261 @@
+// Time stamp counter access and conversion to nanoseconds.
+
+#ifndef LR_TSC_H
+#define LR_TSC_H
+
+#include <stdint.h>
+#include <time.h>
+#include <x86intrin.h>
+
+#include <atomic>
+
+namespace lr {
+
+inline uint64_t rdtsc()
+{
+    return __rdtsc();
+}
+
+// For end stamps: RDTSCP waits until every earlier instruction, loads
+// included, has executed, so it cannot run ahead of a cache miss in the
+// work being measured the way a plain RDTSC can.
+inline uint64_t rdtscp()
+{
+    unsigned aux;
+    return __rdtscp(&aux);
+}
+
+inline uint64_t monotonic_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000u + uint64_t(ts.tv_nsec);
+}
+
+inline uint64_t realtime_ns()
+{
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return uint64_t(ts.tv_sec) * 1000000000u + uint64_t(ts.tv_nsec);
+}
+
+// Measures the TSC frequency against CLOCK_MONOTONIC by spinning for
+// roughly `ms` milliseconds.  Assumes an invariant TSC.
+inline double calibrate_tsc_hz(unsigned ms = 50)
+{
+    uint64_t ns0 = monotonic_ns();
+    uint64_t tsc0 = rdtsc();
+    uint64_t ns1;
+    do {
+        ns1 = monotonic_ns();
+    } while (ns1 - ns0 < uint64_t(ms) * 1000000u);
+    uint64_t tsc1 = rdtsc();
+    return double(tsc1 - tsc0) * 1e9 / double(ns1 - ns0);
+}
+
+// Converts TSC readings to nanoseconds without spinning at startup: the
+// frequency is derived from how far the TSC and CLOCK_MONOTONIC have both
+// moved since start(), which gets more precise the longer it runs.
+class TscClock {
+public:
+    // The shortest baseline hz() measures over.
+    static const uint64_t kMinNs = 10000000;
+
+    void start()
+    {
+        ns0_ = monotonic_ns();
+        tsc0_ = rdtsc();
+    }
+
+    // Asked within kMinNs of start(), sleeps out the rest of it first, so
+    // only the first caller at load can wait, and without burning a CPU.
+    double hz() const
+    {
+        uint64_t ns = monotonic_ns();
+        if (ns - ns0_ < kMinNs) {
+            uint64_t until = ns0_ + kMinNs;
+            timespec ts;
+            ts.tv_sec = time_t(until / 1000000000);
+            ts.tv_nsec = long(until % 1000000000);
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) != 0) {
+            }
+            ns = monotonic_ns();
+        }
+        uint64_t tsc = rdtsc();
+        return double(tsc - tsc0_) * 1e9 / double(ns - ns0_);
+    }
+
+private:
+    uint64_t ns0_ = 0;
+    uint64_t tsc0_ = 0;
+};
+
+// TSC to CLOCK_REALTIME nanoseconds for timestamps that leave the
+// process: the wall time at an anchor plus the TSC delta since, scaled
+// by a 32.32 fixed-point ns-per-tick factor.  One multiply per call.
+//
+// calibrate() takes the rate measured at load.  From then on sync() may
+// be called as often as convenient: once every kSyncPeriodNs it reads
+// CLOCK_REALTIME (from the vDSO, no system call) and re-anchors.  The
+// rate is re-measured over everything since calibration, so it keeps
+// getting better, and the remaining offset is worked off by running
+// that much faster or slower over the next period rather than stepped,
+// so successive readings never go backwards.  The slew ends with the
+// period even when no sync follows, so a clock that is read rarely runs
+// on at the measured rate instead of drifting by the slew.  Offsets over
+// kMaxSlewNs, as when the wall clock itself was set, are stepped.
+//
+// Any thread may read; anchor and rate are published under a sequence
+// count.  One thread at a time syncs, the others skip.
+class TscWallClock {
+public:
+    static const uint64_t kSyncPeriodNs = 1000000000;
+    static const int64_t kMaxSlewNs = 1000000;
+
+    struct Stats {
+        uint64_t syncs = 0;
+        uint64_t steps = 0;
+        // CLOCK_REALTIME minus this clock at the last sync.
+        int64_t last_offset_ns = 0;
+        // Ticks per second as last measured.
+        double hz = 0;
+    };
+
+    // Anchors, starting at `hz` ticks per second (TscClock::hz()).
+    void calibrate(double hz)
+    {
+        uint64_t tsc, real;
+        sample(&tsc, &real);
+        base_tsc_ = tsc;
+        base_real_ = real;
+        rate_ = uint64_t(1e9 / hz * 4294967296.0);
+        period_ticks_ = uint64_t(hz * double(kSyncPeriodNs) / 1e9);
+        publish(tsc, real, rate_, 0);
+        next_sync_.store(tsc + period_ticks_, std::memory_order_relaxed);
+    }
+
+    // Re-anchors if a period has passed by `tsc`; a compare otherwise.
+    void sync(uint64_t tsc)
+    {
+        if (int64_t(tsc - next_sync_.load(std::memory_order_relaxed)) < 0 || period_ticks_ == 0)
+            return;
+        if (syncing_.exchange(true, std::memory_order_acquire))
+            return;
+        if (int64_t(tsc - next_sync_.load(std::memory_order_relaxed)) >= 0)
+            resync();
+        syncing_.store(false, std::memory_order_release);
+    }
+
+    uint64_t to_ns(uint64_t tsc) const
+    {
+        for (;;) {
+            uint32_t seq = seq_.load(std::memory_order_acquire);
+            uint64_t tsc0 = tsc0_.load(std::memory_order_relaxed);
+            uint64_t real0 = realtime0_.load(std::memory_order_relaxed);
+            uint64_t mult = mult_.load(std::memory_order_relaxed);
+            int64_t slew = slew_.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if ((seq & 1) == 0 && seq_.load(std::memory_order_relaxed) == seq)
+                return convert(tsc, tsc0, real0, mult, slew, period_ticks_);
+            _mm_pause();
+        }
+    }
+
+    Stats stats() const
+    {
+        Stats s;
+        s.syncs = syncs_.load(std::memory_order_relaxed);
+        s.steps = steps_.load(std::memory_order_relaxed);
+        s.last_offset_ns = last_offset_.load(std::memory_order_relaxed);
+        s.hz = 4294967296e9 / double(rate_ ? rate_ : 1);
+        return s;
+    }
+
+private:
+    // `slew` is added to `mult` for the first `span` ticks only.
+    static uint64_t convert(uint64_t tsc, uint64_t tsc0, uint64_t real0, uint64_t mult, int64_t slew,
+                            uint64_t span)
+    {
+        int64_t delta = int64_t(tsc - tsc0);
+        if (delta < 0)
+            delta = 0;
+        uint64_t slewed = uint64_t(delta) < span ? uint64_t(delta) : span;
+        return real0 + uint64_t((unsigned __int128)uint64_t(delta) * mult >> 32) +
+               uint64_t(int64_t((__int128)slew * int64_t(slewed) >> 32));
+    }
+
+    // The closest pair of readings out of a few tries.
+    static void sample(uint64_t* tsc, uint64_t* real)
+    {
+        uint64_t best = UINT64_MAX;
+        *tsc = 0;
+        *real = 0;
+        for (int i = 0; i < 5; ++i) {
+            uint64_t a = rdtsc();
+            uint64_t r = realtime_ns();
+            uint64_t b = rdtscp();
+            if (b - a < best) {
+                best = b - a;
+                *tsc = a + (b - a) / 2;
+                *real = r;
+            }
+        }
+    }
+
+    void publish(uint64_t tsc0, uint64_t real0, uint64_t mult, int64_t slew)
+    {
+        uint32_t seq = seq_.load(std::memory_order_relaxed);
+        seq_.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        tsc0_.store(tsc0, std::memory_order_relaxed);
+        realtime0_.store(real0, std::memory_order_relaxed);
+        mult_.store(mult, std::memory_order_relaxed);
+        slew_.store(slew, std::memory_order_relaxed);
+        seq_.store(seq + 2, std::memory_order_release);
+    }
+
+    void resync()
+    {
+        uint64_t tsc, real;
+        sample(&tsc, &real);
+        uint64_t now = to_ns(tsc);
+        int64_t offset = int64_t(real - now);
+        syncs_.store(syncs_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        last_offset_.store(offset, std::memory_order_relaxed);
+        if (offset > kMaxSlewNs || offset < -kMaxSlewNs) {
+            steps_.store(steps_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            base_tsc_ = tsc;
+            base_real_ = real;
+            publish(tsc, real, rate_, 0);
+        } else {
+            if (tsc - base_tsc_ >= period_ticks_)
+                rate_ = uint64_t(((unsigned __int128)(real - base_real_) << 32) / (tsc - base_tsc_));
+            // Over the next period, run fast or slow by the offset.
+            int64_t slew = int64_t((__int128)int64_t(rate_) * offset / int64_t(kSyncPeriodNs));
+            publish(tsc, now, rate_, slew);
+        }
+        next_sync_.store(tsc + period_ticks_, std::memory_order_relaxed);
+    }
+
+    std::atomic<uint32_t> seq_{0};
+    std::atomic<uint64_t> realtime0_{0};
+    std::atomic<uint64_t> tsc0_{0};
+    std::atomic<uint64_t> mult_{0};
+    // Added to mult_ for the first period after the anchor.
+    std::atomic<int64_t> slew_{0};
+    std::atomic<uint64_t> next_sync_{0};
+    std::atomic<bool> syncing_{false};
+    std::atomic<uint64_t> syncs_{0};
+    std::atomic<uint64_t> steps_{0};
+    std::atomic<int64_t> last_offset_{0};
+    // Owned by whoever syncs: the reference point of the rate and the
+    // rate itself, 32.32 ns per tick.
+    uint64_t base_tsc_ = 0;
+    uint64_t base_real_ = 0;
+    uint64_t rate_ = 0;
+    uint64_t period_ticks_ = 0;
+};
+
+}
+
+#endif
@@ -0,0 +1,198 @@
+#include "worker_pool.h"
+
+#include <immintrin.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <new>
+
+#include "per_thread.h"
+
+namespace lr {
+
+namespace {
+
+// Records a worker handles from one ring before moving to the next.
+const unsigned kPollBatch = 64;
+// Idle passes a worker spins, then yields, before it starts sleeping
+// kIdleSleepNs between passes.
+const unsigned kIdleSpins = 1024;
+const unsigned kIdleYields = 1024;
+const long kIdleSleepNs = 50000;
+// Pauses a producer spins on a full ring before it yields.
+const unsigned kWaitSpins = 256;
+
+void backoff(unsigned idle)
+{
+    if (idle < kIdleSpins) {
+        _mm_pause();
+    } else if (idle < kIdleSpins + kIdleYields) {
+        sched_yield();
+    } else {
+        timespec ts = {0, kIdleSleepNs};
+        nanosleep(&ts, nullptr);
+    }
+}
+
+// Producer waiting on a worker: spin briefly, then give up the CPU in
+// case the worker needs it.
+void wait_for_worker(unsigned& spins)
+{
+    if (++spins < kWaitSpins)
+        _mm_pause();
+    else
+        sched_yield();
+}
+
+}
+
+WorkerPool::WorkerPool(unsigned workers, uint32_t ring_bytes, Handler handler)
+    : ring_bytes_(ring_bytes)
+    , handler_(handler)
+    , stop_(false)
+{
+    if (workers > kMaxWorkers)
+        workers = kMaxWorkers;
+    for (unsigned i = 0; i < workers; ++i) {
+        void* mem = nullptr;
+        if (posix_memalign(&mem, alignof(Worker), sizeof(Worker)) != 0)
+            throw std::bad_alloc();
+        workers_.push_back(new (mem) Worker);
+    }
+    for (Worker* w : workers_)
+        w->thread = std::thread(&WorkerPool::run, this, std::ref(*w));
+}
+
+WorkerPool::~WorkerPool()
+{
+    stop_.store(true, std::memory_order_release);
+    for (Worker* w : workers_) {
+        w->thread.join();
+        for (RingNode* n = w->rings.load(std::memory_order_acquire); n;) {
+            RingNode* next = n->next;
+            n->~RingNode();
+            free(n);
+            n = next;
+        }
+        w->~Worker();
+        free(w);
+    }
+}
+
+WorkerPool::Producer& WorkerPool::producer()
+{
+    Producer& p = PerThread<Producer>::local();
+    if (__builtin_expect(p.pool == this, 1))
+        return p;
+    for (unsigned i = 0; i < workers_.size(); ++i) {
+        void* mem = nullptr;
+        if (posix_memalign(&mem, 64, sizeof(RingNode)) != 0)
+            throw std::bad_alloc();
+        RingNode* n = new (mem) RingNode(ring_bytes_);
+        if (!n->ring.ok())
+            throw std::bad_alloc();
+        n->next = workers_[i]->rings.load(std::memory_order_relaxed);
+        while (!workers_[i]->rings.compare_exchange_weak(n->next, n, std::memory_order_release,
+                                                         std::memory_order_relaxed))
+            ;
+        p.rings[i] = n;
+    }
+    p.pool = this;
+    return p;
+}
+
+void WorkerPool::submit(uint32_t session_id, uint32_t event_type, uint32_t sqn, const ENSUserData* data,
+                        uint64_t rx_tsc, uint32_t flags)
+{
+    Producer& p = producer();
+    SpscRing& ring = p.rings[shard(session_id)]->ring;
+    AsyncEvent e;
+    e.session_id = session_id;
+    e.event_type = event_type;
+    e.sqn = sqn;
+    e.length = data ? data->length : 0;
+    e.rx_tsc = rx_tsc;
+    e.flags = flags | (data ? kHasData : 0);
+    e.reserved = 0;
+    p.submitted.add();
+
+    uint32_t size = uint32_t(sizeof(e)) + e.length;
+    if (size > ring.max_record() || size < e.length) {
+        p.inline_events.add();
+        unsigned spins = 0;
+        while (!ring.empty())
+            wait_for_worker(spins);
+        handler_(e, const_cast<ENSUserData*>(data));
+        return;
+    }
+    void* at = ring.try_reserve(size);
+    if (!at) {
+        p.ring_full_waits.add();
+        unsigned spins = 0;
+        while (!(at = ring.try_reserve(size)))
+            wait_for_worker(spins);
+    }
+    memcpy(at, &e, sizeof(e));
+    if (e.length)
+        memcpy(static_cast<uint8_t*>(at) + sizeof(e), data->p, e.length);
+    ring.commit();
+}
+
+void WorkerPool::drain()
+{
+    for (Worker* w : workers_)
+        for (RingNode* n = w->rings.load(std::memory_order_acquire); n; n = n->next)
+            while (!n->ring.empty())
+                sched_yield();
+}
+
+WorkerPool::Stats WorkerPool::stats() const
+{
+    Stats s;
+    PerThread<Producer>::for_each([&](const Producer& p) {
+        if (p.pool != this)
+            return;
+        s.submitted += p.submitted.get();
+        s.ring_full_waits += p.ring_full_waits.get();
+        s.inline_events += p.inline_events.get();
+    });
+    for (const Worker* w : workers_)
+        s.handled += w->handled.get();
+    return s;
+}
+
+void WorkerPool::run(Worker& w)
+{
+    unsigned idle = 0;
+    for (;;) {
+        // Read stop_ before polling, so a pass that finds nothing after
+        // stop_ was set has drained everything submitted before it.
+        bool stopping = stop_.load(std::memory_order_acquire);
+        uint64_t handled = 0;
+        for (RingNode* n = w.rings.load(std::memory_order_acquire); n; n = n->next) {
+            uint32_t size;
+            void* rec;
+            for (unsigned i = 0; i < kPollBatch && (rec = n->ring.peek(&size)); ++i) {
+                AsyncEvent* e = static_cast<AsyncEvent*>(rec);
+                ENSUserData data;
+                data.length = e->length;
+                data.p = reinterpret_cast<uint8_t*>(e + 1);
+                handler_(*e, e->flags & kHasData ? &data : nullptr);
+                n->ring.release();
+                ++handled;
+            }
+        }
+        if (handled) {
+            w.handled.add(handled);
+            idle = 0;
+        } else if (stopping) {
+            return;
+        } else {
+            backoff(idle++);
+        }
+    }
+}
+
+}
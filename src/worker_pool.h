@@ -0,0 +1,120 @@
+// Worker threads that take events off event_handler's calling thread.
+//
+// Every producer thread (a runtime thread calling submit()) gets one
+// SpscRing per worker on first use, and each worker polls the rings of
+// all producers.  Events are sharded by session_id, so every event of a
+// session goes to the same worker; as long as the runtime delivers a
+// session from one thread at a time, as it does, the worker sees the
+// session's events in the order they were submitted.
+//
+// The runtime owns an event's data only for the duration of the call, so
+// submit() copies the payload into the ring.  Events too large for a
+// ring are handled on the producer thread once the worker has caught up
+// with it, which keeps the session's order.
+
+#ifndef LR_WORKER_POOL_H
+#define LR_WORKER_POOL_H
+
+#include <stdint.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "counter.h"
+#include "ens.h"
+#include "spsc_ring.h"
+
+namespace lr {
+
+// The fixed part of a queued event; length bytes of payload follow.
+struct AsyncEvent {
+    uint32_t session_id;
+    uint32_t event_type;
+    uint32_t sqn;
+    uint32_t length;
+    uint64_t rx_tsc;
+    uint32_t flags;
+    uint32_t reserved;
+};
+
+class WorkerPool {
+public:
+    static const uint32_t kMaxWorkers = 64;
+    // AsyncEvent::flags
+    static const uint32_t kHasData = 1;
+    static const uint32_t kSampled = 2;
+
+    // Called on a worker, or on the producer for oversized events, with
+    // the event and a copy of its data (nullptr if it had none).
+    typedef void (*Handler)(const AsyncEvent& event, ENSUserData* data);
+
+    struct Stats {
+        uint64_t submitted = 0;
+        uint64_t handled = 0;
+        uint64_t ring_full_waits = 0;
+        uint64_t inline_events = 0;
+    };
+
+    // Starts `workers` threads (at most kMaxWorkers) whose rings hold
+    // `ring_bytes` each, a power of two.
+    WorkerPool(unsigned workers, uint32_t ring_bytes, Handler handler);
+    // Handles everything still queued, then joins the workers.
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    unsigned workers() const { return unsigned(workers_.size()); }
+
+    void submit(uint32_t session_id, uint32_t event_type, uint32_t sqn, const ENSUserData* data, uint64_t rx_tsc,
+                uint32_t flags);
+
+    // Returns once every event submitted before the call has been handled.
+    void drain();
+
+    Stats stats() const;
+
+private:
+    struct RingNode {
+        SpscRing ring;
+        RingNode* next;
+
+        explicit RingNode(uint32_t bytes)
+            : ring(bytes)
+            , next(nullptr)
+        {
+        }
+    };
+
+    struct alignas(64) Worker {
+        std::atomic<RingNode*> rings{nullptr};
+        Counter handled;
+        std::thread thread;
+    };
+
+    // A producer thread's ring to each worker.
+    struct Producer {
+        WorkerPool* pool = nullptr;
+        RingNode* rings[kMaxWorkers];
+        Counter submitted;
+        Counter ring_full_waits;
+        Counter inline_events;
+    };
+
+    Producer& producer();
+    unsigned shard(uint32_t session_id) const
+    {
+        return unsigned((uint64_t(uint32_t(session_id * 0x9e3779b1u)) * workers_.size()) >> 32);
+    }
+    void run(Worker& w);
+
+    std::vector<Worker*> workers_;
+    uint32_t ring_bytes_;
+    Handler handler_;
+    std::atomic<bool> stop_;
+};
+
+}
+
+#endif
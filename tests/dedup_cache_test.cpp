@@ -0,0 +1,112 @@
+#include "dedup_cache.h"
+
+#include <string>
+
+#include "test.h"
+
+namespace {
+
+typedef lr::DedupCache Cache;
+
+ENSUserData bytes(const std::string& s)
+{
+    ENSUserData d = {uint32_t(s.size()), reinterpret_cast<uint8_t*>(const_cast<char*>(s.data()))};
+    return d;
+}
+
+// The cached response of a pair: "-" for a miss, "null" for none, and
+// "hit" in suppress mode.
+std::string cached(Cache& c, uint32_t session_id, uint32_t sqn)
+{
+    std::string out = "hit";
+    bool hit = c.lookup(session_id, sqn, [&](const ENSUserData* d) {
+        out = d ? std::string(reinterpret_cast<const char*>(d->p), d->length) : "null";
+    });
+    return hit ? out : "-";
+}
+
+bool insert(Cache& c, uint32_t session_id, uint32_t sqn, const std::string& s, bool* evicted)
+{
+    ENSUserData d = bytes(s);
+    return c.insert(session_id, sqn, &d, evicted);
+}
+
+}
+
+TEST(replay_keeps_responses)
+{
+    Cache c(Cache::kReplay, 1024, 16);
+    CHECK(c.ok());
+    bool evicted = true;
+    CHECK(insert(c, 1, 10, "hello", &evicted) && !evicted);
+    CHECK(c.insert(1, 11, nullptr, &evicted));
+    std::string a = "ab", b = "cde";
+    ENSUserData segments[2] = {bytes(a), bytes(b)};
+    CHECK(c.insert(2, 10, segments, 2, &evicted));
+    // Too long to keep.
+    CHECK(!insert(c, 3, 10, "seventeen bytes!!", &evicted));
+    CHECK(cached(c, 1, 10) == "hello");
+    CHECK(cached(c, 1, 11) == "null");
+    CHECK(cached(c, 2, 10) == "abcde");
+    CHECK(cached(c, 3, 10) == "-");
+    CHECK(cached(c, 1, 12) == "-");
+    // Answering the pair again replaces its response in place.
+    CHECK(insert(c, 1, 10, "again", &evicted) && !evicted);
+    CHECK(cached(c, 1, 10) == "again");
+}
+
+TEST(suppress_keeps_pairs_only)
+{
+    Cache c(Cache::kSuppress, 64, 1024);
+    CHECK_EQ(c.bytes(), 0);
+    bool evicted = false;
+    CHECK(insert(c, 5, 1, std::string(4000, 'x'), &evicted));
+    bool copied = false;
+    CHECK(c.lookup(5, 1, [&](const ENSUserData*) { copied = true; }));
+    CHECK(!copied);
+    CHECK(!c.lookup(5, 2, [&](const ENSUserData*) {}));
+}
+
+// One set of four ways: CLOCK evicts unreferenced pairs first, and a hit
+// buys a pair one more pass of the hand.
+TEST(clock_eviction)
+{
+    Cache c(Cache::kReplay, 1, 8);
+    CHECK_EQ(c.entries(), Cache::kWays);
+    bool evicted = true;
+    for (uint32_t sqn = 1; sqn <= 4; ++sqn) {
+        CHECK(insert(c, 1, sqn, "r" + std::to_string(sqn), &evicted));
+        CHECK(!evicted);
+    }
+    CHECK(cached(c, 1, 1) == "r1");
+    // The hand passes 1, clearing its bit, and takes 2, then 3 and 4.
+    CHECK(insert(c, 1, 5, "r5", &evicted) && evicted);
+    CHECK(cached(c, 1, 2) == "-");
+    CHECK(insert(c, 1, 6, "r6", &evicted) && evicted);
+    CHECK(insert(c, 1, 7, "r7", &evicted) && evicted);
+    CHECK(cached(c, 1, 3) == "-");
+    CHECK(cached(c, 1, 4) == "-");
+    // 5, 6 and 7 have been looked up, or were just now; 1 has not since
+    // its bit was cleared, so it goes next.
+    CHECK(cached(c, 1, 5) == "r5");
+    CHECK(cached(c, 1, 6) == "r6");
+    CHECK(cached(c, 1, 7) == "r7");
+    CHECK(insert(c, 1, 8, "r8", &evicted) && evicted);
+    CHECK(cached(c, 1, 1) == "-");
+    CHECK(cached(c, 1, 5) == "r5");
+}
+
+// A pair retransmitted over and over survives a stream of responses
+// nobody asks for again.
+TEST(hot_pair_survives_a_stream)
+{
+    Cache c(Cache::kSuppress, 1, 0);
+    bool evicted = false;
+    insert(c, 9, 0, "", &evicted);
+    for (uint32_t sqn = 1; sqn < 1000; ++sqn) {
+        CHECK(cached(c, 9, 0) == "hit");
+        insert(c, 9, sqn, "", &evicted);
+    }
+    CHECK(cached(c, 9, 0) == "hit");
+    CHECK(cached(c, 9, 1) == "-");
+}
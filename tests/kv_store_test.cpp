@@ -0,0 +1,138 @@
+#include "kv_store.h"
+
+#include <string.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "test.h"
+
+namespace {
+
+const uint8_t* bytes(const std::string& s)
+{
+    return reinterpret_cast<const uint8_t*>(s.data());
+}
+
+lr::KvStore::Result put(lr::KvStore& kv, const std::string& key, const std::string& value)
+{
+    return kv.put(bytes(key), uint32_t(key.size()), bytes(value), uint32_t(value.size()));
+}
+
+// The value of `key`, or "-" if it has none.
+std::string get(const lr::KvStore& kv, const std::string& key)
+{
+    std::string out = "-";
+    kv.get(bytes(key), uint32_t(key.size()), [&](const uint8_t* v, uint32_t n) {
+        out.assign(reinterpret_cast<const char*>(v), n);
+    });
+    return out;
+}
+
+}
+
+TEST(put_get_erase)
+{
+    lr::KvStore kv(4, true);
+    CHECK(kv.ok());
+    CHECK_EQ(put(kv, "a", "1"), lr::KvStore::kOk);
+    CHECK_EQ(put(kv, "bb", ""), lr::KvStore::kOk);
+    CHECK(get(kv, "a") == "1");
+    CHECK(get(kv, "bb") == "");
+    CHECK(get(kv, "c") == "-");
+    CHECK_EQ(put(kv, "a", "one"), lr::KvStore::kOk);
+    CHECK(get(kv, "a") == "one");
+    CHECK_EQ(kv.size(), 2);
+    CHECK_EQ(kv.erase(bytes("a"), 1), lr::KvStore::kOk);
+    CHECK_EQ(kv.erase(bytes("a"), 1), lr::KvStore::kNotFound);
+    CHECK(get(kv, "a") == "-");
+    CHECK_EQ(kv.size(), 1);
+}
+
+// New keys past capacity() are refused; replacing a value is not.
+TEST(full)
+{
+    lr::KvStore kv(3, false);
+    for (int i = 0; i < 3; ++i)
+        CHECK_EQ(put(kv, "k" + std::to_string(i), "v"), lr::KvStore::kOk);
+    CHECK_EQ(put(kv, "k3", "v"), lr::KvStore::kFull);
+    CHECK_EQ(put(kv, "k1", "w"), lr::KvStore::kOk);
+    CHECK(get(kv, "k1") == "w");
+    CHECK_EQ(kv.erase(bytes("k0"), 2), lr::KvStore::kOk);
+    CHECK_EQ(put(kv, "k3", "v"), lr::KvStore::kOk);
+    CHECK_EQ(kv.size(), 3);
+}
+
+// A value replaced while a reader's guard is open is not freed until the
+// guard closes, however many nodes are retired meanwhile.
+TEST(retired_nodes_wait_for_guards)
+{
+    lr::KvStore kv(16, true);
+    put(kv, "key", std::string(200, 'x'));
+    lr::Epoch::Stats before = lr::Epoch::stats();
+    {
+        lr::Epoch::Guard guard;
+        const uint8_t* held = nullptr;
+        kv.get(bytes("key"), 3, [&](const uint8_t* v, uint32_t) { held = v; });
+        for (int i = 0; i < 1000; ++i)
+            put(kv, "key", std::string(200, char('a' + i % 26)));
+        lr::Epoch::Stats during = lr::Epoch::stats();
+        CHECK_EQ(during.retired - before.retired, 1000);
+        CHECK(during.reclaimed - before.reclaimed < 1000);
+        CHECK(std::string(reinterpret_cast<const char*>(held), 200) == std::string(200, 'x'));
+    }
+    for (int i = 0; i < 1000; ++i)
+        put(kv, "key", std::string(200, 'z'));
+    lr::Epoch::Stats after = lr::Epoch::stats();
+    CHECK(after.reclaimed - before.reclaimed >= 1000);
+    lr::Epoch::reclaim_all();
+    CHECK_EQ(lr::Epoch::stats().pending_bytes, 0);
+}
+
+// Readers never see a torn or freed value while writers replace and
+// erase keys under them.
+TEST(concurrent_readers_and_writers)
+{
+    const unsigned kKeys = 64;
+    lr::KvStore kv(kKeys, true);
+    std::atomic<bool> stop(false);
+    std::atomic<bool> failed(false);
+    std::vector<std::thread> readers;
+    for (unsigned r = 0; r < 2; ++r) {
+        readers.emplace_back([&, r] {
+            uint32_t i = r;
+            while (!stop.load(std::memory_order_relaxed)) {
+                uint32_t k = i++ % kKeys;
+                kv.get(reinterpret_cast<const uint8_t*>(&k), sizeof(k), [&](const uint8_t* v, uint32_t n) {
+                    // Every value is n copies of one byte.
+                    for (uint32_t j = 1; j < n; ++j)
+                        if (v[j] != v[0])
+                            failed = true;
+                });
+            }
+        });
+    }
+    std::vector<std::thread> writers;
+    for (unsigned w = 0; w < 2; ++w) {
+        writers.emplace_back([&, w] {
+            for (uint32_t i = 0; i < 200000; ++i) {
+                uint32_t k = (i * 7 + w) % kKeys;
+                if (i % 5 == 4) {
+                    kv.erase(reinterpret_cast<const uint8_t*>(&k), sizeof(k));
+                    continue;
+                }
+                std::string v(16 + i % 100, char(i));
+                kv.put(reinterpret_cast<const uint8_t*>(&k), sizeof(k), bytes(v), uint32_t(v.size()));
+            }
+        });
+    }
+    for (std::thread& t : writers)
+        t.join();
+    stop = true;
+    for (std::thread& t : readers)
+        t.join();
+    CHECK(!failed);
+    CHECK(kv.size() <= kKeys);
+}
@@ -0,0 +1,77 @@
+#include "seq_window.h"
+
+#include "test.h"
+
+namespace {
+
+typedef lr::SeqWindow W;
+
+}
+
+TEST(in_order_gaps_and_reordering)
+{
+    W w = W();
+    CHECK_EQ(w.update(10), W::kFirst);
+    CHECK_EQ(w.update(11), W::kInOrder);
+    CHECK_EQ(w.update(15), W::kGap);
+    CHECK_EQ(w.gaps, 3);
+    CHECK_EQ(w.update(13), W::kReordered);
+    CHECK_EQ(w.update(13), W::kDuplicate);
+    CHECK_EQ(w.update(15), W::kDuplicate);
+    CHECK_EQ(w.update(15 - 64), W::kStale);
+    CHECK_EQ(w.update(15 - 63), W::kReordered);
+    CHECK_EQ(w.reordered, 2);
+    CHECK_EQ(w.duplicates, 2);
+    CHECK_EQ(w.stale, 1);
+    CHECK_EQ(w.resyncs, 0);
+}
+
+// The sqn wraps through zero as if nothing happened.
+TEST(wraparound)
+{
+    W w = W();
+    CHECK_EQ(w.update(UINT32_MAX - 1), W::kFirst);
+    CHECK_EQ(w.update(UINT32_MAX), W::kInOrder);
+    CHECK_EQ(w.update(0), W::kInOrder);
+    CHECK_EQ(w.update(2), W::kGap);
+    CHECK_EQ(w.update(1), W::kReordered);
+    CHECK_EQ(w.update(UINT32_MAX), W::kDuplicate);
+    CHECK_EQ(w.update(uint32_t(2 - 64)), W::kStale);
+    CHECK_EQ(w.highest, 2);
+    CHECK_EQ(w.gaps, 1);
+    CHECK_EQ(w.resyncs, 0);
+}
+
+// A sender that restarts from a low sqn resyncs instead of having every
+// later event called stale.
+TEST(backward_restart_resyncs)
+{
+    W w = W();
+    for (uint32_t sqn = 1000000; sqn < 1000100; ++sqn)
+        w.update(sqn);
+    CHECK_EQ(w.update(1), W::kResync);
+    CHECK_EQ(w.highest, 1);
+    CHECK_EQ(w.update(2), W::kInOrder);
+    CHECK_EQ(w.update(1), W::kDuplicate);
+    CHECK_EQ(w.stale, 0);
+    CHECK_EQ(w.resyncs, 1);
+}
+
+// Forward jumps resync at kResyncDistance, backward ones too; anything
+// short of it either way is a gap or stale.
+TEST(resync_distance)
+{
+    const uint32_t d = W::kResyncDistance;
+    W w = W();
+    w.update(0);
+    CHECK_EQ(w.update(d - 1), W::kGap);
+    CHECK_EQ(w.update(2 * d - 1), W::kResync);
+    CHECK_EQ(w.gaps, d - 2);
+    CHECK_EQ(w.update(d), W::kStale);
+    CHECK_EQ(w.update(d - 1), W::kResync);
+    CHECK_EQ(w.highest, d - 1);
+    CHECK_EQ(w.resyncs, 2);
+    // Half the sqn space away, which is the furthest back there is.
+    CHECK_EQ(w.update(d - 1 + 0x80000000u), W::kResync);
+    CHECK_EQ(w.resyncs, 3);
+}
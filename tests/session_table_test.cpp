@@ -0,0 +1,222 @@
+#include "session_table.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "test.h"
+
+namespace {
+
+struct Value {
+    uint32_t id;
+    uint32_t events;
+};
+
+typedef lr::SessionTable<Value> Table;
+
+uint64_t xorshift(uint64_t& s)
+{
+    s ^= s << 13;
+    s ^= s >> 7;
+    s ^= s << 17;
+    return s;
+}
+
+}
+
+TEST(insert_find_erase)
+{
+    Table t(1000);
+    CHECK(t.ok());
+    bool inserted = false;
+    Value* v = t.find_or_insert(7, &inserted);
+    CHECK(v && inserted);
+    v->id = 7;
+    CHECK(t.find_or_insert(7, &inserted) == v && !inserted);
+    CHECK(t.find(7) == v);
+    CHECK(t.find(8) == nullptr);
+    CHECK_EQ(t.size(), 1);
+    CHECK(t.erase(7));
+    CHECK(!t.erase(7));
+    CHECK(t.find(7) == nullptr);
+    CHECK_EQ(t.size(), 0);
+    // The tombstone ended its probe run, so it is gone.
+    CHECK_EQ(t.occupied(), 0);
+    v = t.find_or_insert(7, &inserted);
+    CHECK(v && inserted && v->id == 0);
+}
+
+TEST(erase_at_checks_the_session)
+{
+    Table t(16);
+    Value* v = t.find_or_insert(42);
+    uint64_t slot = t.index(v);
+    uint32_t id = 0;
+    CHECK(t.at(slot, &id) == v && id == 42);
+    CHECK(!t.erase_at(slot, 43));
+    CHECK(t.erase_at(slot, 42));
+    CHECK(t.at(slot, &id) == nullptr);
+    CHECK(!t.erase_at(slot, 42));
+}
+
+TEST(full_table)
+{
+    Table t(4);
+    uint64_t n = t.capacity();
+    for (uint32_t id = 1; id <= n; ++id)
+        CHECK(t.find_or_insert(id) != nullptr);
+    CHECK(t.find_or_insert(uint32_t(n + 1)) == nullptr);
+    CHECK(t.erase(3));
+    CHECK(t.find_or_insert(uint32_t(n + 1)) != nullptr);
+    for (uint32_t id = 1; id <= n; ++id)
+        CHECK((t.find(id) != nullptr) == (id != 3));
+}
+
+// 50k of 65536 sessions replaced round after round: without cleanup the
+// tombstones pile up until every miss walks the whole table.
+TEST(churn_keeps_tombstones_bounded)
+{
+    const uint32_t kLive = 50000;
+    Table t(65536);
+    std::vector<uint32_t> live;
+    uint32_t next = 1;
+    for (; next <= kLive; ++next) {
+        t.find_or_insert(next)->id = next;
+        live.push_back(next);
+    }
+    uint64_t rng = 88172645463325252ull;
+    for (int round = 0; round < 40; ++round) {
+        for (uint32_t i = 0; i < kLive; ++i) {
+            uint32_t& id = live[xorshift(rng) % kLive];
+            CHECK(t.erase(id));
+            id = next++;
+            bool inserted = false;
+            Value* v = t.find_or_insert(id, &inserted);
+            CHECK(v && inserted);
+            v->id = id;
+        }
+        CHECK_EQ(t.size(), kLive);
+        // Only tombstones inside some live session's probe run remain.
+        CHECK(t.occupied() < kLive + kLive / 4);
+    }
+    for (uint32_t id : live)
+        CHECK(t.find(id) && t.find(id)->id == id);
+    CHECK(t.find(next) == nullptr);
+}
+
+// Threads churning disjoint sessions: nobody loses or duplicates one,
+// whatever tombstones the others leave or clean up around it.
+TEST(concurrent_churn)
+{
+    const unsigned kThreads = 4;
+    const uint32_t kPerThread = 2000;
+    Table t(kThreads * kPerThread);
+    std::atomic<bool> failed(false);
+    std::vector<std::thread> threads;
+    for (unsigned w = 0; w < kThreads; ++w) {
+        threads.emplace_back([&, w] {
+            uint64_t rng = 0x2545f4914f6cdd1dull + w;
+            std::vector<bool> live(kPerThread);
+            for (int op = 0; op < 400000; ++op) {
+                uint32_t k = uint32_t(xorshift(rng) % kPerThread);
+                uint32_t id = k * kThreads + w + 1;
+                if (live[k]) {
+                    Value* v = t.find(id);
+                    if (!v || v->id != id || !t.erase(id))
+                        failed = true;
+                    live[k] = false;
+                } else {
+                    bool inserted = false;
+                    Value* v = t.find_or_insert(id, &inserted);
+                    if (!v || !inserted)
+                        failed = true;
+                    else
+                        v->id = id;
+                    live[k] = true;
+                }
+            }
+            for (uint32_t k = 0; k < kPerThread; ++k) {
+                Value* v = t.find(k * kThreads + w + 1);
+                if (live[k] != (v != nullptr) || (v && v->id != k * kThreads + w + 1))
+                    failed = true;
+            }
+        });
+    }
+    for (std::thread& th : threads)
+        th.join();
+    CHECK(!failed);
+}
+
+// A slot erase_at() frees is not handed to another session while a guard
+// that may still be using it is open.
+TEST(erase_at_holds_the_slot_for_open_guards)
+{
+    Table t(4);
+    uint64_t n = t.capacity();
+    for (uint32_t id = 1; id <= n; ++id)
+        CHECK(t.find_or_insert(id) != nullptr);
+    uint64_t slot = t.index(t.find(5));
+    {
+        // An event still using session 5.
+        lr::Epoch::Guard guard;
+        CHECK(t.erase_at(slot, 5));
+        for (int i = 0; i < 4; ++i) {
+            lr::Epoch::try_advance();
+            CHECK_EQ(t.collect(), 1);
+        }
+        CHECK(t.find_or_insert(100) == nullptr);
+    }
+    lr::Epoch::try_advance();
+    lr::Epoch::try_advance();
+    CHECK_EQ(t.collect(), 0);
+    Value* v = t.find_or_insert(100);
+    CHECK(v && t.index(v) == slot);
+}
+
+// Owners use their sessions inside guards while another thread evicts
+// at random: an owner never sees its value reset under it by a new
+// session placed in the same slot.
+TEST(eviction_never_reuses_a_slot_in_use)
+{
+    const unsigned kOwners = 3;
+    const uint32_t kPerOwner = 64;
+    Table t(kOwners * kPerOwner);
+    std::atomic<bool> stop(false);
+    std::atomic<bool> failed(false);
+    std::thread evictor([&] {
+        uint64_t rng = 12345;
+        while (!stop.load(std::memory_order_relaxed)) {
+            uint64_t slot = xorshift(rng) & (t.capacity() - 1);
+            uint32_t id = 0;
+            if (t.at(slot, &id))
+                t.erase_at(slot, id);
+            lr::Epoch::try_advance();
+            t.collect();
+            std::this_thread::yield();
+        }
+    });
+    std::vector<std::thread> owners;
+    for (unsigned w = 0; w < kOwners; ++w) {
+        owners.emplace_back([&, w] {
+            uint64_t rng = 777 + w;
+            for (int op = 0; op < 100000; ++op) {
+                uint32_t id = uint32_t(xorshift(rng) % kPerOwner) * kOwners + w + 1;
+                lr::Epoch::Guard guard;
+                Value* v = t.find_or_insert(id);
+                if (!v)
+                    continue;
+                v->id = id;
+                if (op % 64 == 0)
+                    std::this_thread::yield();
+                if (v->id != id)
+                    failed = true;
+            }
+        });
+    }
+    for (std::thread& th : owners)
+        th.join();
+    stop = true;
+    evictor.join();
+    CHECK(!failed);
+}
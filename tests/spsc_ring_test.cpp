@@ -0,0 +1,134 @@
+#include "spsc_ring.h"
+
+#include <string.h>
+
+#include <thread>
+#include <vector>
+
+#include "test.h"
+
+namespace {
+
+uint64_t xorshift(uint64_t& s)
+{
+    s ^= s << 13;
+    s ^= s >> 7;
+    s ^= s << 17;
+    return s;
+}
+
+// Writes record `n` of `size` bytes: its number, then bytes derived from it.
+bool push(lr::SpscRing& ring, uint32_t n, uint32_t size)
+{
+    uint8_t* p = static_cast<uint8_t*>(ring.try_reserve(size));
+    if (!p)
+        return false;
+    for (uint32_t i = 0; i < size; ++i)
+        p[i] = uint8_t(n + i);
+    if (size >= sizeof(n))
+        memcpy(p, &n, sizeof(n));
+    ring.commit();
+    return true;
+}
+
+bool pop(lr::SpscRing& ring, uint32_t n, uint32_t size)
+{
+    uint32_t got = 0;
+    const uint8_t* p = static_cast<const uint8_t*>(ring.peek(&got));
+    if (!p || got != size)
+        return false;
+    bool ok = true;
+    for (uint32_t i = size >= sizeof(n) ? sizeof(n) : 0; i < size; ++i)
+        ok = ok && p[i] == uint8_t(n + i);
+    if (size >= sizeof(n))
+        ok = ok && memcmp(p, &n, sizeof(n)) == 0;
+    ring.release();
+    return ok;
+}
+
+}
+
+// Records of every size class cross the end of the array, including
+// ones that end exactly on it, and come out whole and in order.
+TEST(records_wrap_around)
+{
+    lr::SpscRing ring(4096);
+    CHECK(ring.ok());
+    uint64_t rng = 42;
+    uint32_t n = 0;
+    for (int round = 0; round < 20000; ++round) {
+        // Up to three records in flight at a time, which with a wrap
+        // marker's skip always fit.
+        uint32_t sizes[3];
+        unsigned k = 1 + unsigned(xorshift(rng) % 3);
+        for (unsigned i = 0; i < k; ++i) {
+            sizes[i] = uint32_t(xorshift(rng) % 1000);
+            CHECK(push(ring, n + i, sizes[i]));
+        }
+        for (unsigned i = 0; i < k; ++i)
+            CHECK(pop(ring, n + i, sizes[i]));
+        n += k;
+        uint32_t size = 0;
+        CHECK(ring.peek(&size) == nullptr);
+        CHECK(ring.empty());
+    }
+}
+
+// An empty ring takes max_record() bytes wherever its positions are,
+// however much of it the wrap marker skips.
+TEST(max_record_fits_at_any_offset)
+{
+    lr::SpscRing ring(4096);
+    for (uint32_t lead = 0; lead < 64; ++lead) {
+        CHECK(push(ring, lead, lead * 28));
+        CHECK(pop(ring, lead, lead * 28));
+        CHECK(push(ring, 7, ring.max_record()));
+        CHECK(pop(ring, 7, ring.max_record()));
+    }
+}
+
+// A full ring refuses records until the consumer releases one.
+TEST(full_until_released)
+{
+    lr::SpscRing ring(4096);
+    uint32_t n = 0;
+    while (push(ring, n, 100))
+        ++n;
+    // 128-byte slots.
+    CHECK_EQ(n, 4096 / 128);
+    CHECK(!push(ring, n, 100));
+    CHECK(pop(ring, 0, 100));
+    CHECK(push(ring, n, 100));
+    for (uint32_t i = 1; i <= n; ++i)
+        CHECK(pop(ring, i, 100));
+    CHECK(ring.empty());
+}
+
+// A producer and a consumer thread: every record arrives once, intact
+// and in order.
+TEST(producer_consumer)
+{
+    const uint32_t kRecords = 500000;
+    lr::SpscRing ring(1 << 14);
+    bool failed = false;
+    std::thread consumer([&] {
+        uint64_t rng = 7;
+        for (uint32_t n = 0; n < kRecords; ++n) {
+            uint32_t size = uint32_t(xorshift(rng) % 600);
+            uint32_t got = 0;
+            while (!ring.peek(&got))
+                std::this_thread::yield();
+            if (!pop(ring, n, size))
+                failed = true;
+        }
+    });
+    uint64_t rng = 7;
+    for (uint32_t n = 0; n < kRecords; ++n) {
+        uint32_t size = uint32_t(xorshift(rng) % 600);
+        while (!push(ring, n, size))
+            std::this_thread::yield();
+    }
+    consumer.join();
+    CHECK(!failed);
+    CHECK(ring.empty());
+}
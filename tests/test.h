@@ -0,0 +1,46 @@
+// A minimal test harness: TEST(name) { ... } defines a test case that
+// test_main.cpp runs, and CHECK / CHECK_EQ record a failure and end the
+// case.  Each tests/*_test.cpp is linked with test_main.cpp into its own
+// executable and registered with ctest.
+
+#ifndef LR_TESTS_TEST_H
+#define LR_TESTS_TEST_H
+
+#include <stdint.h>
+
+namespace lr_test {
+
+typedef void (*TestFn)();
+
+struct Registrar {
+    Registrar(const char* name, TestFn fn);
+};
+
+void fail(const char* file, int line, const char* what);
+void fail_eq(const char* file, int line, const char* what, unsigned long long a, unsigned long long b);
+
+}
+
+#define TEST(name)                                                    \
+    static void name();                                               \
+    static lr_test::Registrar name##_registrar(#name, &name);         \
+    static void name()
+
+#define CHECK(cond)                                                   \
+    do {                                                              \
+        if (!(cond)) {                                                \
+            lr_test::fail(__FILE__, __LINE__, #cond);                 \
+            return;                                                   \
+        }                                                             \
+    } while (0)
+
+#define CHECK_EQ(a, b)                                                                                      \
+    do {                                                                                                    \
+        unsigned long long lr_test_a = (unsigned long long)(a), lr_test_b = (unsigned long long)(b);        \
+        if (lr_test_a != lr_test_b) {                                                                       \
+            lr_test::fail_eq(__FILE__, __LINE__, #a " == " #b, lr_test_a, lr_test_b);                       \
+            return;                                                                                         \
+        }                                                                                                   \
+    } while (0)
+
+#endif
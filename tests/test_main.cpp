@@ -0,0 +1,55 @@
+#include "test.h"
+
+#include <stdio.h>
+
+#include <vector>
+
+namespace lr_test {
+
+namespace {
+
+struct Case {
+    const char* name;
+    TestFn fn;
+};
+
+std::vector<Case>& cases()
+{
+    static std::vector<Case> all;
+    return all;
+}
+
+bool g_failed = false;
+
+}
+
+Registrar::Registrar(const char* name, TestFn fn)
+{
+    cases().push_back(Case{name, fn});
+}
+
+void fail(const char* file, int line, const char* what)
+{
+    fprintf(stderr, "%s:%d: CHECK(%s) failed\n", file, line, what);
+    g_failed = true;
+}
+
+void fail_eq(const char* file, int line, const char* what, unsigned long long a, unsigned long long b)
+{
+    fprintf(stderr, "%s:%d: CHECK_EQ(%s) failed: %llu != %llu\n", file, line, what, a, b);
+    g_failed = true;
+}
+
+}
+
+int main()
+{
+    int failures = 0;
+    for (const lr_test::Case& c : lr_test::cases()) {
+        lr_test::g_failed = false;
+        c.fn();
+        printf("%-4s %s\n", lr_test::g_failed ? "FAIL" : "ok", c.name);
+        failures += lr_test::g_failed;
+    }
+    return failures ? 1 : 0;
+}
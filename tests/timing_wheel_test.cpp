@@ -0,0 +1,138 @@
+#include "timing_wheel.h"
+
+#include <vector>
+
+#include "test.h"
+
+namespace {
+
+const uint32_t kNone = UINT32_MAX;
+
+// Slots with a due tick each, recording the tick every timer fired at.
+struct Timers {
+    std::vector<uint32_t> due;
+    std::vector<uint32_t> fired;
+
+    explicit Timers(size_t n)
+        : due(n, kNone)
+        , fired(n, kNone)
+    {
+    }
+
+    bool operator()(uint64_t slot, uint32_t now, uint32_t* when)
+    {
+        if (due[slot] == kNone)
+            return false;
+        if (int32_t(due[slot] - now) > 0) {
+            *when = due[slot];
+            return true;
+        }
+        fired[slot] = now;
+        due[slot] = kNone;
+        return false;
+    }
+};
+
+// Advances one tick at a time, expiring everything after each, as the
+// evictor does when it keeps up.
+void run(lr::TimingWheel& wheel, Timers& timers, uint32_t to)
+{
+    while (wheel.now() != to) {
+        wheel.advance(wheel.now() + 1);
+        wheel.expire([&](uint64_t slot, uint32_t now, uint32_t* when) { return timers(slot, now, when); },
+                     UINT64_MAX);
+    }
+}
+
+void check_fired_on_time(lr::TimingWheel& wheel, uint32_t start)
+{
+    const uint32_t deltas[] = {1, 2, 63, 64, 65, 100, 4095, 4096, 4097, 5000, 262143, 262144, 262145, 300000};
+    const size_t n = sizeof(deltas) / sizeof(deltas[0]);
+    Timers timers(n);
+    for (size_t i = 0; i < n; ++i) {
+        timers.due[i] = start + deltas[i];
+        wheel.arm(i);
+    }
+    // Place the new timers.
+    wheel.expire([&](uint64_t slot, uint32_t now, uint32_t* when) { return timers(slot, now, when); },
+                 UINT64_MAX);
+    CHECK_EQ(wheel.armed(), n);
+    run(wheel, timers, start + 300001);
+    for (size_t i = 0; i < n; ++i)
+        CHECK_EQ(timers.fired[i], start + deltas[i]);
+    CHECK_EQ(wheel.armed(), 0);
+    CHECK(!wheel.busy());
+}
+
+}
+
+// Timers at every level come down the cascade and fire on their tick,
+// never before.
+TEST(cascade_fires_on_time)
+{
+    lr::TimingWheel wheel(64, 0, false);
+    CHECK(wheel.ok());
+    check_fired_on_time(wheel, 0);
+}
+
+// The same from a start just short of the 32-bit tick wrapping.
+TEST(cascade_across_tick_wrap)
+{
+    const uint32_t start = UINT32_MAX - 1000;
+    lr::TimingWheel wheel(64, start, false);
+    check_fired_on_time(wheel, start);
+}
+
+// A timer pushed back while it waits fires once, at the latest due tick;
+// one further out than the horizon is re-placed from there.
+TEST(pushed_back_and_beyond_horizon)
+{
+    lr::TimingWheel wheel(4, 0, false);
+    Timers timers(2);
+    timers.due[0] = 100;
+    timers.due[1] = lr::TimingWheel::kHorizon + 5000;
+    wheel.arm(0);
+    wheel.arm(1);
+    wheel.arm(0);
+    CHECK_EQ(wheel.armed(), 2);
+    run(wheel, timers, 90);
+    timers.due[0] = 5000;
+    run(wheel, timers, 6000);
+    CHECK_EQ(timers.fired[0], 5000);
+    // Skipping ahead: the wheel jumps over empty ticks.
+    wheel.advance(lr::TimingWheel::kHorizon);
+    wheel.expire([&](uint64_t slot, uint32_t now, uint32_t* when) { return timers(slot, now, when); }, UINT64_MAX);
+    CHECK_EQ(timers.fired[1], kNone);
+    run(wheel, timers, lr::TimingWheel::kHorizon + 5000);
+    CHECK_EQ(timers.fired[1], lr::TimingWheel::kHorizon + 5000);
+    CHECK_EQ(wheel.armed(), 0);
+}
+
+// Advancing in big steps hands whole lists to a budgeted expire(): every
+// timer still comes up at the step that reaches it.
+TEST(big_steps_and_budget)
+{
+    const uint32_t n = 10000;
+    lr::TimingWheel wheel(n, 0, false);
+    Timers timers(n);
+    for (uint32_t i = 0; i < n; ++i) {
+        timers.due[i] = 1 + (i * 7919u) % 200000;
+        wheel.arm(i);
+    }
+    auto due = [&](uint64_t slot, uint32_t now, uint32_t* when) { return timers(slot, now, when); };
+    while (wheel.expire(due, 100))
+        ;
+    const uint32_t kStep = 997;
+    for (uint32_t t = 0; t < 200000 + kStep;) {
+        t += kStep;
+        wheel.advance(t);
+        while (wheel.expire(due, 100))
+            ;
+    }
+    // Each fires at the first step that reaches its tick.
+    for (uint32_t i = 0; i < n; ++i) {
+        uint32_t when = 1 + (i * 7919u) % 200000;
+        CHECK(timers.fired[i] != kNone && timers.fired[i] >= when && timers.fired[i] - when < kStep);
+    }
+    CHECK_EQ(wheel.armed(), 0);
+}
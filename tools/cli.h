@@ -0,0 +1,62 @@
+// Minimal command line handling shared by the host tools.
+
+#ifndef LR_TOOLS_CLI_H
+#define LR_TOOLS_CLI_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <stdexcept>
+#include <string>
+
+namespace enshost {
+
+class ArgReader {
+public:
+    ArgReader(int argc, char** argv)
+        : argc_(argc)
+        , argv_(argv)
+        , pos_(1)
+    {
+    }
+
+    bool done() const { return pos_ >= argc_; }
+    std::string next() { return argv_[pos_++]; }
+
+    // Value of the option just returned by next().
+    std::string value(const std::string& option)
+    {
+        if (done())
+            throw std::invalid_argument(option + " needs a value");
+        return next();
+    }
+
+    uint64_t u64(const std::string& option)
+    {
+        std::string v = value(option);
+        char* end = nullptr;
+        unsigned long long n = strtoull(v.c_str(), &end, 0);
+        if (v.empty() || *end != '\0')
+            throw std::invalid_argument(option + ": bad number '" + v + "'");
+        return n;
+    }
+
+    double real(const std::string& option)
+    {
+        std::string v = value(option);
+        char* end = nullptr;
+        double d = strtod(v.c_str(), &end);
+        if (v.empty() || *end != '\0')
+            throw std::invalid_argument(option + ": bad number '" + v + "'");
+        return d;
+    }
+
+private:
+    int argc_;
+    char** argv_;
+    int pos_;
+};
+
+}
+
+#endif
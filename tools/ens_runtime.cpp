@@ -0,0 +1,84 @@
+#include "ens_runtime.h"
+
+#include <string.h>
+
+#include <vector>
+
+#include "per_thread.h"
+
+namespace enshost {
+
+namespace {
+
+NotifyHook g_hook = nullptr;
+
+// Where segmented notifications are gathered for the hook, per thread.
+struct GatherBuffer {
+    std::vector<uint8_t> bytes;
+};
+
+inline void count_notify(NotifyCounters& c, uint32_t session_id, uint32_t sqn, ENSUserData* data)
+{
+    ++c.calls;
+    if (data)
+        c.bytes += data->length;
+    else
+        ++c.null_data;
+    if (g_hook)
+        g_hook(session_id, sqn, data);
+}
+
+}
+
+void set_notify_hook(NotifyHook hook)
+{
+    g_hook = hook;
+}
+
+NotifyCounters notify_totals()
+{
+    NotifyCounters total;
+    lr::PerThread<NotifyCounters>::for_each([&](const NotifyCounters& c) {
+        total.calls += c.calls;
+        total.bytes += c.bytes;
+        total.null_data += c.null_data;
+        total.batches += c.batches;
+        total.gathers += c.gathers;
+    });
+    return total;
+}
+
+}
+
+extern "C" void ENSSessionNotify(uint32_t session_id, uint32_t sqn, ENSUserData* data)
+{
+    enshost::count_notify(lr::PerThread<enshost::NotifyCounters>::local(), session_id, sqn, data);
+}
+
+extern "C" void ENSSessionNotifyBatch(const LRNotify* notifies, uint32_t count)
+{
+    enshost::NotifyCounters& c = lr::PerThread<enshost::NotifyCounters>::local();
+    ++c.batches;
+    for (uint32_t i = 0; i < count; ++i)
+        enshost::count_notify(c, notifies[i].session_id, notifies[i].sqn, notifies[i].data);
+}
+
+extern "C" void ENSSessionNotifyVec(uint32_t session_id, uint32_t sqn, const LRUserDataVec* data)
+{
+    enshost::NotifyCounters& c = lr::PerThread<enshost::NotifyCounters>::local();
+    ++c.gathers;
+    if (!enshost::g_hook) {
+        ++c.calls;
+        c.bytes += data->length;
+        return;
+    }
+    std::vector<uint8_t>& bytes = lr::PerThread<enshost::GatherBuffer>::local().bytes;
+    bytes.resize(data->length);
+    uint32_t at = 0;
+    for (uint32_t i = 0; i < data->count; ++i) {
+        memcpy(bytes.data() + at, data->segments[i].p, data->segments[i].length);
+        at += data->segments[i].length;
+    }
+    ENSUserData flat = {data->length, bytes.data()};
+    enshost::count_notify(c, session_id, sqn, &flat);
+}
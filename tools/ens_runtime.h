@@ -0,0 +1,39 @@
+// Host-side stand-in for the ENS runtime services the plugin links against.
+//
+// Tools that load latencyresponder.so link this in and export its
+// ENSSessionNotify so the plugin's undefined reference resolves to it.
+// It also provides the optional ENSSessionNotifyBatch and
+// ENSSessionNotifyVec extensions.
+
+#ifndef LR_TOOLS_ENS_RUNTIME_H
+#define LR_TOOLS_ENS_RUNTIME_H
+
+#include <stdint.h>
+
+#include "latencyresponder.h"
+
+namespace enshost {
+
+struct NotifyCounters {
+    uint64_t calls = 0;
+    uint64_t bytes = 0;
+    uint64_t null_data = 0;
+    // ENSSessionNotifyBatch calls; their notifications count in `calls`.
+    uint64_t batches = 0;
+    // ENSSessionNotifyVec calls, also counted in `calls`.
+    uint64_t gathers = 0;
+};
+
+// Optional callback run for every notification, batched or not, on the
+// notifying thread.  Must be installed before the plugin starts producing events.
+// Segmented notifications are gathered into one buffer for it first.
+typedef void (*NotifyHook)(uint32_t session_id, uint32_t sqn, ENSUserData* data);
+
+void set_notify_hook(NotifyHook hook);
+
+// Sum of the counters of every thread that has called ENSSessionNotify.
+NotifyCounters notify_totals();
+
+}
+
+#endif
@@ -0,0 +1,472 @@
+// enshost: local stand-in for the ENS runtime.
+//
+// Loads a latencyresponder.so, provides an instrumented ENSSessionNotify
+// and drives event_handler from one or more threads as fast as it can,
+// reporting throughput and per-call latency.
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cli.h"
+#include "ens_runtime.h"
+#include "event_stream.h"
+#include "histogram.h"
+#include "latencyresponder.h"
+#include "per_thread.h"
+#include "plugin.h"
+#include "report.h"
+#include "tsc.h"
+
+namespace {
+
+struct Options {
+    std::string plugin;
+    enshost::StreamSpec stream;
+    uint64_t events = 10000000;
+    double duration = 0;
+    uint64_t warmup = 100000;
+    unsigned threads = 1;
+    uint32_t batch = 0;
+    enshost::Plugin::Binding binding = enshost::Plugin::kNow;
+    enshost::Plugin::Registration registration = enshost::Plugin::kTable;
+    bool timing = true;
+    bool pin = false;
+    bool check_stamps = false;
+};
+
+struct ThreadResult {
+    lr::Histogram latency;
+    uint64_t events = 0;
+    uint64_t cycles = 0;
+};
+
+void usage(FILE* out)
+{
+    fprintf(out,
+            "usage: enshost [options] PLUGIN.so\n"
+            "  --sessions N     sessions to spread events over (default 1024)\n"
+            "  --mix SPEC       event_type weights, e.g. 1:90,2:10 (default 1)\n"
+            "  --payload SPEC   payload sizes: 64 | 64,512,1500 | 64-1500 (default 64)\n"
+            "  --events N       events per thread (default 10000000)\n"
+            "  --duration SEC   run for SEC seconds instead of a fixed event count\n"
+            "  --warmup N       untimed events per thread before measuring (default 100000)\n"
+            "  --threads N      driving threads, each with its own sessions (default 1)\n"
+            "  --pin            pin driving thread i to CPU i\n"
+            "  --batch N        hand events over N at a time through event_handler_batch\n"
+            "  --bind lazy|now  dlopen binding mode (default now)\n"
+            "  --symbols        use the exported symbols even if the plugin has lr_plugin_init\n"
+            "  --no-timing      skip per-call timestamps, measure throughput only\n"
+            "  --loss P         probability an event skips an sqn, as if one was lost\n"
+            "  --dup P          probability an event repeats its session's last sqn\n"
+            "  --stamp-trailer  reserve an LRStampTrailer at the end of each payload\n"
+            "  --check-stamps   report residence time from the stamps in responses\n"
+            "  --kv N           send LR_KV commands on N keys, values sized by --payload\n"
+            "  --kv-put P       share of those commands that are PUTs (default 0.1)\n"
+            "  --seed N         stream seed (default 1)\n");
+}
+
+Options parse(int argc, char** argv)
+{
+    Options o;
+    enshost::ArgReader args(argc, argv);
+    while (!args.done()) {
+        std::string a = args.next();
+        if (a == "--sessions")
+            o.stream.sessions = uint32_t(args.u64(a));
+        else if (a == "--mix")
+            o.stream.mix = enshost::parse_mix(args.value(a));
+        else if (a == "--payload")
+            enshost::parse_payload_sizes(args.value(a), o.stream);
+        else if (a == "--events")
+            o.events = args.u64(a);
+        else if (a == "--duration")
+            o.duration = args.real(a);
+        else if (a == "--warmup")
+            o.warmup = args.u64(a);
+        else if (a == "--threads")
+            o.threads = unsigned(args.u64(a));
+        else if (a == "--batch")
+            o.batch = uint32_t(args.u64(a));
+        else if (a == "--pin")
+            o.pin = true;
+        else if (a == "--bind") {
+            std::string b = args.value(a);
+            if (b != "lazy" && b != "now")
+                throw std::invalid_argument("--bind expects lazy or now");
+            o.binding = b == "lazy" ? enshost::Plugin::kLazy : enshost::Plugin::kNow;
+        } else if (a == "--symbols")
+            o.registration = enshost::Plugin::kSymbols;
+        else if (a == "--no-timing")
+            o.timing = false;
+        else if (a == "--loss")
+            o.stream.loss = args.real(a);
+        else if (a == "--dup")
+            o.stream.duplicate = args.real(a);
+        else if (a == "--stamp-trailer")
+            o.stream.stamp_trailer = true;
+        else if (a == "--check-stamps")
+            o.check_stamps = true;
+        else if (a == "--kv")
+            o.stream.kv_keys = args.u64(a);
+        else if (a == "--kv-put")
+            o.stream.kv_put = args.real(a);
+        else if (a == "--seed")
+            o.stream.seed = args.u64(a);
+        else if (a == "-h" || a == "--help") {
+            usage(stdout);
+            exit(0);
+        } else if (!a.empty() && a[0] == '-')
+            throw std::invalid_argument("unknown option " + a);
+        else
+            o.plugin = a;
+    }
+    if (o.plugin.empty())
+        throw std::invalid_argument("no plugin given");
+    if (o.threads == 0 || o.threads > o.stream.sessions)
+        throw std::invalid_argument("--threads must be between 1 and --sessions");
+    return o;
+}
+
+// Residence times read back from stamped responses, per notifying thread.
+struct StampCheck {
+    lr::Histogram residence_ns;
+    uint64_t missing = 0;
+};
+
+void check_stamp(uint32_t, uint32_t, ENSUserData* data)
+{
+    StampCheck& c = lr::PerThread<StampCheck>::local();
+    LRStampTrailer t;
+    if (!data || data->length < sizeof(t)) {
+        ++c.missing;
+        return;
+    }
+    memcpy(&t, data->p + data->length - sizeof(t), sizeof(t));
+    if (t.magic != LR_STAMP_MAGIC || t.tx_ns < t.rx_ns) {
+        ++c.missing;
+        return;
+    }
+    c.residence_ns.record(t.tx_ns - t.rx_ns);
+}
+
+void pin_to_cpu(unsigned cpu)
+{
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+typedef void (*DrainFn)();
+
+// A plugin running asynchronously has only queued the events when the
+// handler returns; the run ends once its workers have caught up.
+void finish(const enshost::Plugin& plugin, uint64_t start, uint64_t n, ThreadResult& result)
+{
+    DrainFn drain = reinterpret_cast<DrainFn>(plugin.symbol("lr_async_drain"));
+    if (drain)
+        drain();
+    result.cycles = lr::rdtsc() - start;
+    result.events = n;
+}
+
+// Same loop as drive() through event_handler_batch; latency is per batch.
+void drive_batches(const Options& o, const enshost::Plugin& plugin, enshost::EventStream& stream,
+                   uint64_t duration_cycles, ThreadResult& result)
+{
+    enshost::BatchHandler handler = plugin.batch_handler();
+    std::vector<LREvent> batch(o.batch);
+    for (uint64_t i = 0; i < o.warmup; i += o.batch) {
+        stream.next_batch(batch.data(), o.batch);
+        handler(batch.data(), o.batch);
+    }
+
+    uint64_t limit = duration_cycles ? UINT64_MAX : o.events;
+    uint64_t start = lr::rdtsc();
+    uint64_t deadline = start + duration_cycles;
+    uint64_t n = 0;
+    while (n < limit) {
+        for (unsigned j = 0; j < 4096 && n < limit; j += o.batch, n += o.batch) {
+            stream.next_batch(batch.data(), o.batch);
+            if (o.timing) {
+                uint64_t t0 = lr::rdtsc();
+                handler(batch.data(), o.batch);
+                result.latency.record(lr::rdtscp() - t0);
+            } else {
+                handler(batch.data(), o.batch);
+            }
+        }
+        if (duration_cycles && lr::rdtsc() >= deadline)
+            break;
+    }
+    finish(plugin, start, n, result);
+}
+
+void drive(const Options& o, const enshost::Plugin& plugin, unsigned shard, uint64_t duration_cycles,
+           ThreadResult& result)
+{
+    if (o.pin)
+        pin_to_cpu(shard);
+    enshost::EventStream stream(o.stream, shard, o.threads);
+    if (o.batch) {
+        drive_batches(o, plugin, stream, duration_cycles, result);
+        return;
+    }
+    enshost::EventHandler handler = plugin.event_handler();
+
+    for (uint64_t i = 0; i < o.warmup; ++i) {
+        const enshost::Event& e = stream.next();
+        handler(e.session_id, e.event_type, e.sqn, e.data);
+    }
+
+    uint64_t limit = duration_cycles ? UINT64_MAX : o.events;
+    uint64_t start = lr::rdtsc();
+    uint64_t deadline = start + duration_cycles;
+    uint64_t n = 0;
+    while (n < limit) {
+        // Check the clock once per chunk so the loop stays tight.
+        for (unsigned j = 0; j < 4096 && n < limit; ++j, ++n) {
+            const enshost::Event& e = stream.next();
+            if (o.timing) {
+                uint64_t t0 = lr::rdtsc();
+                handler(e.session_id, e.event_type, e.sqn, e.data);
+                result.latency.record(lr::rdtscp() - t0);
+            } else {
+                handler(e.session_id, e.event_type, e.sqn, e.data);
+            }
+        }
+        if (duration_cycles && lr::rdtsc() >= deadline)
+            break;
+    }
+    finish(plugin, start, n, result);
+}
+
+int run(const Options& o)
+{
+    enshost::Plugin plugin(o.plugin, o.binding, o.registration);
+    if (o.batch && !plugin.batch_handler())
+        throw std::runtime_error(o.plugin + ": no event_handler_batch, cannot use --batch");
+    if (o.check_stamps)
+        enshost::set_notify_hook(check_stamp);
+    double hz = lr::calibrate_tsc_hz();
+    uint64_t duration_cycles = uint64_t(o.duration * hz);
+
+    std::vector<ThreadResult> results(o.threads);
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < o.threads; ++t)
+        threads.emplace_back(drive, std::cref(o), std::cref(plugin), t, duration_cycles, std::ref(results[t]));
+    for (std::thread& t : threads)
+        t.join();
+
+    lr::Histogram latency;
+    uint64_t events = 0;
+    double rate = 0;
+    for (unsigned t = 0; t < o.threads; ++t) {
+        const ThreadResult& r = results[t];
+        double secs = double(r.cycles) / hz;
+        double thread_rate = secs > 0 ? double(r.events) / secs : 0;
+        if (o.threads > 1)
+            printf("thread %u: %" PRIu64 " events in %.3f s, %.2f Mevents/s\n", t, r.events, secs, thread_rate / 1e6);
+        latency.merge(r.latency);
+        events += r.events;
+        rate += thread_rate;
+    }
+
+    enshost::NotifyCounters notify = enshost::notify_totals();
+    printf("plugin: %s\n", plugin.path().c_str());
+    if (plugin.registered()) {
+        uint64_t c = plugin.capabilities();
+        printf("registered through lr_plugin_init, capabilities:%s%s%s%s\n", c & LR_PLUGIN_BATCH ? " batch" : "",
+               c & LR_PLUGIN_ASYNC ? " async" : "", c & LR_PLUGIN_STAMP_IN_PLACE ? " stamp-in-place" : "",
+               c & LR_PLUGIN_READONLY_RESPONSES ? " readonly-responses" : "");
+    }
+    printf("tsc: %.3f GHz\n", hz / 1e9);
+    printf("events: %" PRIu64 " (+%" PRIu64 " warmup)  notifies: %" PRIu64 " (%" PRIu64 " batched calls, %" PRIu64
+           " gathered)  notified bytes: %" PRIu64 "\n",
+           events, o.warmup * o.threads, notify.calls, notify.batches, notify.gathers, notify.bytes);
+    printf("throughput: %.2f Mevents/s (%.2f ns/event/thread)\n", rate / 1e6,
+           rate > 0 ? 1e9 * o.threads / rate : 0.0);
+    if (o.timing)
+        enshost::print_latency(stdout, o.batch ? "event_handler_batch latency" : "event_handler latency", latency, hz);
+    typedef int (*LatencySummaryFn)(LRLatencySummary*);
+    LatencySummaryFn summary = reinterpret_cast<LatencySummaryFn>(plugin.symbol("lr_latency_summary"));
+    LRLatencySummary s;
+    if (summary && summary(&s) == 0)
+        printf("responder latency (ns): n=%llu min=%.1f mean=%.1f p50=%.1f p90=%.1f p99=%.1f p99.9=%.1f "
+               "p99.99=%.1f max=%.1f\n",
+               (unsigned long long)s.count, s.min_ns, s.mean_ns, s.p50_ns, s.p90_ns, s.p99_ns, s.p999_ns,
+               s.p9999_ns, s.max_ns);
+    typedef int (*SequenceStatsFn)(LRSequenceStats*);
+    SequenceStatsFn sequence = reinterpret_cast<SequenceStatsFn>(plugin.symbol("lr_sequence_stats"));
+    LRSequenceStats seq;
+    if (sequence && sequence(&seq) == 0)
+        printf("sequence: data=%llu gaps=%llu reordered=%llu duplicates=%llu stale=%llu resyncs=%llu\n",
+               (unsigned long long)seq.data_events, (unsigned long long)seq.gaps, (unsigned long long)seq.reordered,
+               (unsigned long long)seq.duplicates, (unsigned long long)seq.stale, (unsigned long long)seq.resyncs);
+    typedef int (*AsyncStatsFn)(LRAsyncStats*);
+    AsyncStatsFn async_stats = reinterpret_cast<AsyncStatsFn>(plugin.symbol("lr_async_stats"));
+    LRAsyncStats as;
+    if (async_stats && async_stats(&as) == 0)
+        printf("async: workers=%u submitted=%llu handled=%llu ring full waits=%llu inline=%llu\n", as.workers,
+               (unsigned long long)as.submitted, (unsigned long long)as.handled,
+               (unsigned long long)as.ring_full_waits, (unsigned long long)as.inline_events);
+    typedef int (*EventTypeStatsFn)(LREventTypeStats*);
+    EventTypeStatsFn type_stats = reinterpret_cast<EventTypeStatsFn>(plugin.symbol("lr_event_type_stats"));
+    LREventTypeStats ts;
+    if (type_stats && type_stats(&ts) == 0) {
+        printf("event types: data=%llu open=%llu (reopen %llu) close=%llu (unknown %llu) keepalive=%llu "
+               "(unknown %llu) other=%llu",
+               (unsigned long long)ts.data, (unsigned long long)ts.opens, (unsigned long long)ts.reopens,
+               (unsigned long long)ts.closes, (unsigned long long)ts.closes_unknown,
+               (unsigned long long)ts.keepalives, (unsigned long long)ts.keepalives_unknown,
+               (unsigned long long)ts.unknown);
+        for (uint32_t i = 0; i < LR_UNKNOWN_TYPE_SLOTS; ++i)
+            if (ts.unknown_by_type[i])
+                printf(" [%u%s]=%llu", i, i == LR_UNKNOWN_TYPE_SLOTS - 1 ? "+" : "",
+                       (unsigned long long)ts.unknown_by_type[i]);
+        printf("\n");
+    }
+    typedef int (*StampStatsFn)(LRStampStats*);
+    StampStatsFn stamp_stats = reinterpret_cast<StampStatsFn>(plugin.symbol("lr_stamp_stats"));
+    LRStampStats st;
+    if (stamp_stats && stamp_stats(&st) == 0)
+        printf("stamps: in place=%llu copied=%llu gathered=%llu skipped=%llu\n", (unsigned long long)st.in_place,
+               (unsigned long long)st.copied, (unsigned long long)st.gathered, (unsigned long long)st.skipped);
+    typedef int (*ShapeStatsFn)(LRShapeStats*);
+    ShapeStatsFn shape_stats = reinterpret_cast<ShapeStatsFn>(plugin.symbol("lr_shape_stats"));
+    LRShapeStats sh;
+    if (shape_stats && shape_stats(&sh) == 0) {
+        static const char* const modes[] = {"echo", "truncate", "pad", "amplify"};
+        printf("shaping: %s, request bytes=%llu response bytes=%llu (x%.2f)\n", sh.mode < 4 ? modes[sh.mode] : "?",
+               (unsigned long long)sh.request_bytes, (unsigned long long)sh.response_bytes,
+               sh.request_bytes ? double(sh.response_bytes) / double(sh.request_bytes) : 0.0);
+    }
+    typedef int (*TraceStatsFn)(LRTraceStats*);
+    TraceStatsFn trace_stats = reinterpret_cast<TraceStatsFn>(plugin.symbol("lr_trace_stats"));
+    LRTraceStats tr;
+    if (trace_stats && trace_stats(&tr) == 0)
+        printf("trace: records=%llu overwritten=%llu unrecorded=%llu threads=%u\n", (unsigned long long)tr.records,
+               (unsigned long long)tr.overwritten, (unsigned long long)tr.unrecorded, tr.threads);
+    typedef int (*FlightStatsFn)(LRFlightStats*);
+    FlightStatsFn flight_stats = reinterpret_cast<FlightStatsFn>(plugin.symbol("lr_flight_stats"));
+    LRFlightStats fl;
+    if (flight_stats && flight_stats(&fl) == 0)
+        printf("flight recorder: slo %.0f ns, violations=%llu suppressed=%llu dumps=%llu dropped=%llu\n", fl.slo_ns,
+               (unsigned long long)fl.violations, (unsigned long long)fl.suppressed, (unsigned long long)fl.dumps,
+               (unsigned long long)fl.dropped);
+    typedef int (*RateStatsFn)(LRRateStats*);
+    RateStatsFn rate_stats = reinterpret_cast<RateStatsFn>(plugin.symbol("lr_rate_stats"));
+    LRRateStats rl;
+    if (rate_stats && rate_stats(&rl) == 0)
+        printf("rate limit: %llu/s burst %u defer %u us, dropped=%llu deferred=%llu released=%llu\n",
+               (unsigned long long)rl.rate, rl.burst, rl.defer_us, (unsigned long long)rl.dropped,
+               (unsigned long long)rl.deferred, (unsigned long long)rl.released);
+    typedef int (*IdleStatsFn)(LRIdleStats*);
+    IdleStatsFn idle_stats = reinterpret_cast<IdleStatsFn>(plugin.symbol("lr_idle_stats"));
+    LRIdleStats is;
+    if (idle_stats && idle_stats(&is) == 0)
+        printf("idle expiry: %llu ms from the %s, evicted=%llu checked=%llu armed=%llu backlog=%llu\n",
+               (unsigned long long)is.timeout_ms, is.threaded ? "housekeeping thread" : "event path",
+               (unsigned long long)is.evicted, (unsigned long long)is.checked, (unsigned long long)is.armed,
+               (unsigned long long)is.backlog);
+    typedef int (*DedupStatsFn)(LRDedupStats*);
+    DedupStatsFn dedup_stats = reinterpret_cast<DedupStatsFn>(plugin.symbol("lr_dedup_stats"));
+    LRDedupStats dd;
+    if (dedup_stats && dedup_stats(&dd) == 0)
+        printf("dedup: %s, %llu entries, lookups=%llu hits=%llu (%.1f%%) inserts=%llu evictions=%llu too large=%llu\n",
+               dd.mode == LR_DEDUP_REPLAY ? "replay" : "suppress", (unsigned long long)dd.entries,
+               (unsigned long long)dd.lookups, (unsigned long long)dd.hits,
+               dd.lookups ? 100.0 * double(dd.hits) / double(dd.lookups) : 0.0, (unsigned long long)dd.inserts,
+               (unsigned long long)dd.evictions, (unsigned long long)dd.too_large);
+    typedef int (*KvStatsFn)(LRKvStats*);
+    KvStatsFn kv_stats = reinterpret_cast<KvStatsFn>(plugin.symbol("lr_kv_stats"));
+    LRKvStats kv;
+    if (kv_stats && kv_stats(&kv) == 0) {
+        printf("kv: %llu of %llu keys, table %.1f MiB, nodes %.1f MiB, pending %.1f KiB\n",
+               (unsigned long long)kv.keys, (unsigned long long)kv.capacity, double(kv.table_bytes) / 1048576.0,
+               double(kv.node_bytes) / 1048576.0, double(kv.pending_bytes) / 1024.0);
+        printf("kv: gets=%llu hits=%llu (%.1f%%) puts=%llu deletes=%llu full=%llu bad=%llu dropped=%llu\n",
+               (unsigned long long)kv.gets, (unsigned long long)kv.hits,
+               kv.gets ? 100.0 * double(kv.hits) / double(kv.gets) : 0.0, (unsigned long long)kv.puts,
+               (unsigned long long)kv.deletes, (unsigned long long)kv.full, (unsigned long long)kv.bad,
+               (unsigned long long)kv.dropped);
+    }
+    typedef int (*ClockStatsFn)(LRClockStats*);
+    ClockStatsFn clock_stats = reinterpret_cast<ClockStatsFn>(plugin.symbol("lr_clock_stats"));
+    LRClockStats cs;
+    if (clock_stats && clock_stats(&cs) == 0 && (cs.probes || cs.bad || cs.syncs)) {
+        printf("clock: probes=%llu bad=%llu syncs=%llu steps=%llu last offset %lld ns, tsc %.6f GHz\n",
+               (unsigned long long)cs.probes, (unsigned long long)cs.bad, (unsigned long long)cs.syncs,
+               (unsigned long long)cs.steps, (long long)cs.last_offset_ns, cs.tsc_hz / 1e9);
+    }
+    typedef int (*JitterStatsFn)(LRJitterStats*);
+    JitterStatsFn jitter_stats = reinterpret_cast<JitterStatsFn>(plugin.symbol("lr_jitter_stats"));
+    LRJitterStats js;
+    if (jitter_stats && jitter_stats(&js) == 0) {
+        printf("jitter: %llu sessions, mean %.0f ns, p50 %.0f ns, p90 %.0f ns, p99 %.0f ns, max %.0f ns\n",
+               (unsigned long long)js.sessions, js.mean_ns, js.p50_ns, js.p90_ns, js.p99_ns, js.max_ns);
+        for (uint32_t i = 0; i < js.worst_count && i < 5; ++i)
+            printf("jitter: worst #%u session %u, %.0f ns over %.0f ns spacing, %llu events\n", i + 1,
+                   js.worst[i].session_id, js.worst[i].jitter_ns, js.worst[i].interval_ns,
+                   (unsigned long long)js.worst[i].events);
+    }
+    typedef int (*PoolStatsFn)(LRPoolStats*);
+    PoolStatsFn pool_stats = reinterpret_cast<PoolStatsFn>(plugin.symbol("lr_pool_stats"));
+    LRPoolStats ps;
+    if (pool_stats && pool_stats(&ps) == 0) {
+        uint64_t allocs = 0;
+        uint64_t overflows = 0;
+        for (unsigned i = 0; i < LR_POOL_CLASSES; ++i) {
+            allocs += ps.allocs[i];
+            overflows += ps.overflows[i];
+        }
+        if (allocs || ps.oversize)
+            printf("buffer pool: %llu KiB reserved, allocs=%llu overflows=%llu oversize=%llu\n",
+                   (unsigned long long)(ps.reserved_bytes >> 10), (unsigned long long)allocs,
+                   (unsigned long long)overflows, (unsigned long long)ps.oversize);
+    }
+    if (o.check_stamps) {
+        lr::Histogram residence;
+        uint64_t missing = 0;
+        lr::PerThread<StampCheck>::for_each([&](const StampCheck& c) {
+            residence.merge(c.residence_ns);
+            missing += c.missing;
+        });
+        // The histogram is already in ns; a 1 GHz "TSC" makes print_latency
+        // print it unchanged.
+        enshost::print_latency(stdout, "stamped residence", residence, 1e9);
+        printf("responses without a valid stamp: %llu\n", (unsigned long long)missing);
+    }
+    if (notify.null_data)
+        printf("warning: %" PRIu64 " notifies with null data\n", notify.null_data);
+    return 0;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    Options o;
+    try {
+        o = parse(argc, argv);
+    } catch (const std::exception& e) {
+        fprintf(stderr, "enshost: %s\n", e.what());
+        usage(stderr);
+        return 2;
+    }
+    try {
+        return run(o);
+    } catch (const std::exception& e) {
+        fprintf(stderr, "enshost: %s\n", e.what());
+        return 1;
+    }
+}
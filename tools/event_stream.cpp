@@ -0,0 +1,183 @@
+#include "event_stream.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+namespace enshost {
+
+namespace {
+
+uint32_t parse_u32(const std::string& s, const std::string& spec)
+{
+    char* end = nullptr;
+    unsigned long v = strtoul(s.c_str(), &end, 10);
+    if (s.empty() || *end != '\0' || v > UINT32_MAX)
+        throw std::invalid_argument("bad number '" + s + "' in '" + spec + "'");
+    return uint32_t(v);
+}
+
+std::vector<std::string> split(const std::string& s, char sep)
+{
+    std::vector<std::string> parts;
+    std::istringstream in(s);
+    std::string part;
+    while (std::getline(in, part, sep))
+        parts.push_back(part);
+    return parts;
+}
+
+}
+
+std::vector<TypeWeight> parse_mix(const std::string& spec)
+{
+    std::vector<TypeWeight> mix;
+    for (const std::string& item : split(spec, ',')) {
+        size_t colon = item.find(':');
+        TypeWeight tw;
+        tw.event_type = parse_u32(item.substr(0, colon), spec);
+        tw.weight = colon == std::string::npos ? 1 : parse_u32(item.substr(colon + 1), spec);
+        if (tw.weight)
+            mix.push_back(tw);
+    }
+    if (mix.empty())
+        throw std::invalid_argument("empty event type mix '" + spec + "'");
+    return mix;
+}
+
+void parse_payload_sizes(const std::string& spec, StreamSpec& out)
+{
+    std::vector<uint32_t> sizes;
+    size_t dash = spec.find('-');
+    if (dash != std::string::npos) {
+        sizes.push_back(parse_u32(spec.substr(0, dash), spec));
+        sizes.push_back(parse_u32(spec.substr(dash + 1), spec));
+        if (sizes[0] > sizes[1])
+            throw std::invalid_argument("empty payload range '" + spec + "'");
+    } else {
+        for (const std::string& item : split(spec, ','))
+            sizes.push_back(parse_u32(item, spec));
+        if (sizes.empty())
+            throw std::invalid_argument("no payload sizes in '" + spec + "'");
+    }
+    out.payload_sizes = sizes;
+    out.payload_range = dash != std::string::npos;
+}
+
+EventStream::EventStream(const StreamSpec& spec, uint32_t shard, uint32_t shards)
+    : ring_(kRingSize)
+    , pos_(0)
+    , stamp_trailer_(spec.stamp_trailer)
+    , kv_keys_(spec.kv_keys)
+    , kv_put_(uint64_t(spec.kv_put * 18446744073709551615.0))
+    , kv_rng_(spec.seed * 0x9e3779b97f4a7c15ull + shard + 1)
+{
+    for (uint32_t i = shard; i < spec.sessions; i += shards)
+        session_ids_.push_back(spec.first_session + i);
+    if (session_ids_.empty())
+        throw std::invalid_argument("stream shard has no sessions");
+    sqns_.assign(session_ids_.size(), 0);
+
+    uint32_t max_size = 0;
+    for (uint32_t size : spec.payload_sizes)
+        if (size > max_size)
+            max_size = size;
+    payload_.resize(max_size);
+    for (uint32_t i = 0; i < max_size; ++i)
+        payload_[i] = uint8_t(i);
+    if (kv_keys_) {
+        if (stamp_trailer_)
+            throw std::invalid_argument("key-value commands cannot end in a stamp trailer");
+        if (max_size > LR_KV_MAX_VALUE)
+            throw std::invalid_argument("key-value payloads are limited to " + std::to_string(LR_KV_MAX_VALUE) +
+                                        " bytes");
+        if (spec.kv_put < 0 || spec.kv_put > 1)
+            throw std::invalid_argument("the PUT share must be in [0, 1]");
+        kv_commands_.resize(kCommandBytes + max_size);
+        memcpy(kv_commands_.data() + kCommandBytes, payload_.data(), max_size);
+    }
+
+    std::vector<uint32_t> weights;
+    for (const TypeWeight& tw : spec.mix)
+        weights.push_back(tw.weight);
+
+    std::mt19937_64 rng(spec.seed * 0x9e3779b97f4a7c15ull + shard);
+    std::uniform_int_distribution<uint32_t> pick_session(0, uint32_t(session_ids_.size() - 1));
+    std::discrete_distribution<size_t> pick_type(weights.begin(), weights.end());
+    std::uniform_int_distribution<size_t> pick_size(0, spec.payload_sizes.size() - 1);
+    std::uniform_int_distribution<uint32_t> pick_range(spec.payload_sizes.front(), spec.payload_sizes.back());
+    std::uniform_real_distribution<double> chance(0, 1);
+
+    for (Slot& s : ring_) {
+        s.session = pick_session(rng);
+        s.event_type = spec.mix[pick_type(rng)].event_type;
+        s.length = spec.payload_range ? pick_range(rng) : spec.payload_sizes[pick_size(rng)];
+        double c = chance(rng);
+        s.sqn_step = c < spec.loss ? 2 : c < spec.loss + spec.duplicate ? 0 : 1;
+    }
+
+    current_.data = &data_;
+}
+
+void EventStream::next_batch(Event* out, uint32_t n)
+{
+    if (batch_data_.size() < n)
+        batch_data_.resize(n);
+    for (uint32_t i = 0; i < n; ++i) {
+        const Slot& s = ring_[pos_++ & kRingMask];
+        out[i].session_id = session_ids_[s.session];
+        out[i].event_type = s.event_type;
+        out[i].sqn = sqns_[s.session] += s.sqn_step;
+        batch_data_[i].length = s.length;
+        batch_data_[i].p = payload_.data();
+        out[i].data = &batch_data_[i];
+        if (stamp_trailer_)
+            reserve_trailer(batch_data_[i]);
+    }
+    if (!kv_keys_)
+        return;
+    size_t stride = kCommandBytes + payload_.size();
+    size_t had = kv_commands_.size() / stride;
+    if (had < n + 1) {
+        kv_commands_.resize((n + 1) * stride);
+        for (size_t i = had; i < n + 1; ++i)
+            memcpy(&kv_commands_[i * stride + kCommandBytes], payload_.data(), payload_.size());
+    }
+    for (uint32_t i = 0; i < n; ++i)
+        make_command(batch_data_[i], &kv_commands_[(i + 1) * stride]);
+}
+
+void EventStream::make_command(ENSUserData& data, uint8_t* buf)
+{
+    static const char kHex[] = "0123456789abcdef";
+    uint64_t r = kv_rng_;
+    r ^= r << 13;
+    r ^= r >> 7;
+    r ^= r << 17;
+    uint64_t key = r % kv_keys_;
+    r ^= r << 13;
+    r ^= r >> 7;
+    r ^= r << 17;
+    kv_rng_ = r;
+    bool put = r < kv_put_;
+    LRKvHeader h = {uint8_t(put ? LR_KV_PUT : LR_KV_GET), 0, uint16_t(kKeyLength), put ? data.length : 0};
+    memcpy(buf, &h, sizeof(h));
+    // "key:" and 12 hex digits.
+    memcpy(buf + kKeyOffset, "key:", 4);
+    for (uint32_t i = kKeyLength; i > 4; --i, key >>= 4)
+        buf[kKeyOffset + i - 1] = uint8_t(kHex[key & 15]);
+    data.length = kCommandBytes + h.value_length;
+    data.p = buf;
+}
+
+void EventStream::reserve_trailer(ENSUserData& data)
+{
+    LRStampTrailer t = {LR_STAMP_MAGIC, 0, 0, 0};
+    if (data.length >= sizeof(t))
+        memcpy(data.p + data.length - sizeof(t), &t, sizeof(t));
+}
+
+}
@@ -0,0 +1,127 @@
+// Synthetic event streams for driving event_handler.
+//
+// A stream is a precomputed ring of (session, event_type, payload size)
+// choices drawn from a StreamSpec, replayed with a per-session sqn that
+// keeps counting up, so producing the next event costs a few loads.
+
+#ifndef LR_TOOLS_EVENT_STREAM_H
+#define LR_TOOLS_EVENT_STREAM_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "latencyresponder.h"
+
+namespace enshost {
+
+struct TypeWeight {
+    uint32_t event_type;
+    uint32_t weight;
+};
+
+struct StreamSpec {
+    uint32_t sessions = 1024;
+    uint32_t first_session = 1;
+    std::vector<TypeWeight> mix = std::vector<TypeWeight>(1, TypeWeight{1, 1});
+    // Either a list of sizes to pick from uniformly, or, when payload_range
+    // is set, an inclusive [payload_sizes[0], payload_sizes[1]] range.
+    std::vector<uint32_t> payload_sizes = std::vector<uint32_t>(1, 64);
+    bool payload_range = false;
+    // Probability that an event skips one sqn (a lost event) or repeats the
+    // previous sqn of its session (a duplicate).
+    double loss = 0;
+    double duplicate = 0;
+    // End every payload of at least 24 bytes with an empty LRStampTrailer,
+    // reserving room for the responder's residence stamps.
+    bool stamp_trailer = false;
+    // When non-zero, payloads are LR_KV commands on keys drawn uniformly
+    // from kv_keys 16-byte keys: PUTs of a payload-sized value with
+    // probability kv_put, GETs otherwise.
+    uint64_t kv_keys = 0;
+    double kv_put = 0.1;
+    uint64_t seed = 1;
+};
+
+// "1:90,2:10" -> event_type 1 with weight 90, event_type 2 with weight 10.
+// A bare "1" means weight 1.  Throws std::invalid_argument on bad input.
+std::vector<TypeWeight> parse_mix(const std::string& spec);
+
+// "64", "64,512,1500" or "64-1500".  Throws std::invalid_argument.
+void parse_payload_sizes(const std::string& spec, StreamSpec& out);
+
+typedef LREvent Event;
+
+class EventStream {
+public:
+    // Events are drawn from the sessions whose index is congruent to
+    // `shard` modulo `shards`, so shards never share a session.
+    EventStream(const StreamSpec& spec, uint32_t shard = 0, uint32_t shards = 1);
+
+    EventStream(const EventStream&) = delete;
+    EventStream& operator=(const EventStream&) = delete;
+
+    // The returned event and its data stay valid until the next call.
+    const Event& next()
+    {
+        const Slot& s = ring_[pos_++ & kRingMask];
+        current_.session_id = session_ids_[s.session];
+        current_.event_type = s.event_type;
+        current_.sqn = sqns_[s.session] += s.sqn_step;
+        data_.length = s.length;
+        data_.p = payload_.data();
+        if (stamp_trailer_)
+            reserve_trailer(data_);
+        if (kv_keys_)
+            make_command(data_, kv_commands_.data());
+        return current_;
+    }
+
+    // Fills out[0, n) with the next n events, each with its own data,
+    // valid until the next call to next() or next_batch().
+    void next_batch(Event* out, uint32_t n);
+
+    uint32_t session_count() const { return uint32_t(session_ids_.size()); }
+    uint32_t max_payload() const { return uint32_t(payload_.size()); }
+
+private:
+    void reserve_trailer(ENSUserData& data);
+    // Writes a command into `buf`, which holds the value from kKeyOffset
+    // + kKeyLength on, and points data at it; data.length is the value
+    // length on entry.
+    void make_command(ENSUserData& data, uint8_t* buf);
+
+    static const uint32_t kKeyLength = 16;
+    static const uint32_t kKeyOffset = sizeof(LRKvHeader);
+    static const uint32_t kCommandBytes = kKeyOffset + kKeyLength;
+
+    static const uint32_t kRingSize = 1u << 16;
+    static const uint32_t kRingMask = kRingSize - 1;
+
+    struct Slot {
+        uint32_t session;
+        uint32_t event_type;
+        uint32_t length;
+        uint32_t sqn_step;
+    };
+
+    std::vector<Slot> ring_;
+    std::vector<uint32_t> session_ids_;
+    std::vector<uint32_t> sqns_;
+    std::vector<uint8_t> payload_;
+    uint64_t pos_;
+    bool stamp_trailer_;
+    Event current_;
+    ENSUserData data_;
+    std::vector<ENSUserData> batch_data_;
+    uint64_t kv_keys_;
+    uint64_t kv_put_;
+    uint64_t kv_rng_;
+    // One command buffer for next(), then one per next_batch() event.
+    std::vector<uint8_t> kv_commands_;
+};
+
+}
+
+#endif
@@ -0,0 +1,299 @@
+// loadgen: open-loop load generator for latencyresponder.so.
+//
+// Drives event_handler in-process at a fixed arrival rate, constant or
+// Poisson, instead of as fast as the plugin returns.  Every event has an
+// intended send time on the arrival schedule; when the plugin stalls,
+// the events that should have gone out meanwhile are sent late, back to
+// back, and their latency still counts from the intended time.  That is
+// the coordinated-omission correction: a closed-loop client would have
+// waited politely and reported only the one slow call.
+//
+// Latency is taken in the stub ENSSessionNotify, from a probe the
+// generator writes at the front of each payload, so it also covers
+// plugins that answer from worker threads (LR_WORKERS).  The rate is
+// stepped up from --rate by --step until the achieved rate falls short of
+// the target, and each step prints one row of the throughput-vs-latency
+// curve.
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <exception>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "cli.h"
+#include "ens_runtime.h"
+#include "event_stream.h"
+#include "histogram.h"
+#include "per_thread.h"
+#include "plugin.h"
+#include "tsc.h"
+
+namespace {
+
+const unsigned kMaxSteps = 64;
+// Exponential variates drawn at start-up, so a Poisson schedule costs a
+// table load per event instead of a log().
+const uint32_t kGapTableSize = 1u << 16;
+
+struct Options {
+    std::string plugin;
+    enshost::StreamSpec stream;
+    double rate = 100000;
+    double step = 1.25;
+    double max_rate = 0;
+    double duration = 1;
+    double warmup = 0.2;
+    // A step is saturated when it achieves less than this share of its
+    // target rate; the sweep stops after the first one.
+    double saturation = 0.95;
+    bool poisson = true;
+    bool csv = false;
+};
+
+// Written into the front of every payload.
+struct Probe {
+    uint64_t intended;
+    uint64_t sent;
+    uint32_t step;
+    uint32_t measured;
+};
+
+// Latency by step, on each notifying thread.
+struct StepLatency {
+    lr::Histogram corrected[kMaxSteps];
+    lr::Histogram uncorrected[kMaxSteps];
+};
+
+void record_probe(uint32_t, uint32_t, ENSUserData* data)
+{
+    uint64_t now = lr::rdtscp();
+    Probe p;
+    memcpy(&p, data->p, sizeof(p));
+    if (!p.measured)
+        return;
+    StepLatency& l = lr::PerThread<StepLatency>::local();
+    l.corrected[p.step].record(now > p.intended ? now - p.intended : 0);
+    l.uncorrected[p.step].record(now > p.sent ? now - p.sent : 0);
+}
+
+void usage(FILE* out)
+{
+    fprintf(out,
+            "usage: loadgen [options] PLUGIN.so\n"
+            "  --rate R          first target rate, events/s (default 100000)\n"
+            "  --step F          multiply the rate by F after each step; 1 runs one step (default 1.25)\n"
+            "  --max-rate R      stop the sweep after this rate\n"
+            "  --duration SEC    measured time per step (default 1)\n"
+            "  --warmup SEC      unmeasured time at the start of each step (default 0.2)\n"
+            "  --arrival poisson|constant  inter-arrival times (default poisson)\n"
+            "  --saturation F    achieved/target ratio below which the sweep stops (default 0.95)\n"
+            "  --sessions N      sessions to spread events over (default 1024)\n"
+            "  --mix SPEC        event_type weights, e.g. 1:90,2:10 (default 1)\n"
+            "  --payload SPEC    payload sizes, at least %u bytes (default 64)\n"
+            "  --seed N          stream and arrival seed (default 1)\n"
+            "  --csv             comma-separated output\n",
+            unsigned(sizeof(Probe)));
+}
+
+Options parse(int argc, char** argv)
+{
+    Options o;
+    enshost::ArgReader args(argc, argv);
+    while (!args.done()) {
+        std::string a = args.next();
+        if (a == "--rate")
+            o.rate = args.real(a);
+        else if (a == "--step")
+            o.step = args.real(a);
+        else if (a == "--max-rate")
+            o.max_rate = args.real(a);
+        else if (a == "--duration")
+            o.duration = args.real(a);
+        else if (a == "--warmup")
+            o.warmup = args.real(a);
+        else if (a == "--saturation")
+            o.saturation = args.real(a);
+        else if (a == "--arrival") {
+            std::string v = args.value(a);
+            if (v != "poisson" && v != "constant")
+                throw std::invalid_argument("--arrival expects poisson or constant");
+            o.poisson = v == "poisson";
+        } else if (a == "--sessions")
+            o.stream.sessions = uint32_t(args.u64(a));
+        else if (a == "--mix")
+            o.stream.mix = enshost::parse_mix(args.value(a));
+        else if (a == "--payload")
+            enshost::parse_payload_sizes(args.value(a), o.stream);
+        else if (a == "--seed")
+            o.stream.seed = args.u64(a);
+        else if (a == "--csv")
+            o.csv = true;
+        else if (a == "-h" || a == "--help") {
+            usage(stdout);
+            exit(0);
+        } else if (!a.empty() && a[0] == '-')
+            throw std::invalid_argument("unknown option " + a);
+        else
+            o.plugin = a;
+    }
+    if (o.plugin.empty())
+        throw std::invalid_argument("no plugin given");
+    if (o.rate <= 0 || o.step < 1 || o.duration <= 0 || o.warmup < 0)
+        throw std::invalid_argument("need --rate > 0, --step >= 1, --duration > 0, --warmup >= 0");
+    if (o.stream.payload_sizes.front() < sizeof(Probe))
+        throw std::invalid_argument("payloads must hold the " + std::to_string(sizeof(Probe)) + "-byte probe");
+    return o;
+}
+
+struct StepResult {
+    double target;
+    double achieved;
+    uint64_t sent;
+    // Furthest the generator fell behind its schedule.
+    uint64_t max_lag;
+    lr::Histogram corrected;
+    lr::Histogram uncorrected;
+};
+
+typedef void (*DrainFn)();
+
+class Generator {
+public:
+    Generator(const Options& o, const enshost::Plugin& plugin, double hz)
+        : o_(o)
+        , handler_(plugin.event_handler())
+        , drain_(reinterpret_cast<DrainFn>(plugin.symbol("lr_async_drain")))
+        , hz_(hz)
+        , stream_(o.stream)
+        , gaps_(kGapTableSize, 1.0)
+    {
+        if (o.poisson) {
+            std::mt19937_64 rng(o.stream.seed);
+            std::exponential_distribution<double> exp(1.0);
+            for (double& g : gaps_)
+                g = exp(rng);
+        }
+    }
+
+    StepResult run(unsigned step, double rate)
+    {
+        StepResult r;
+        r.target = rate;
+        r.sent = 0;
+        r.max_lag = 0;
+        double mean_gap = hz_ / rate;
+        uint64_t start = lr::rdtsc();
+        uint64_t measure_from = start + uint64_t(o_.warmup * hz_);
+        uint64_t end = measure_from + uint64_t(o_.duration * hz_);
+        // Fractional cycles carry over so the mean gap stays exact.
+        double intended = double(start);
+        uint64_t measured_start = 0;
+        uint64_t i = 0;
+        for (;;) {
+            intended += mean_gap * gaps_[i++ & (kGapTableSize - 1)];
+            uint64_t due = uint64_t(intended);
+            if (due >= end)
+                break;
+            uint64_t now = lr::rdtsc();
+            while (now < due)
+                now = lr::rdtsc();
+            const enshost::Event& e = stream_.next();
+            Probe p;
+            p.intended = due;
+            p.sent = now;
+            p.step = step;
+            p.measured = due >= measure_from;
+            memcpy(e.data->p, &p, sizeof(p));
+            handler_(e.session_id, e.event_type, e.sqn, e.data);
+            if (p.measured) {
+                if (!measured_start)
+                    measured_start = due;
+                ++r.sent;
+                if (now - due > r.max_lag)
+                    r.max_lag = now - due;
+            }
+        }
+        if (drain_)
+            drain_();
+        uint64_t finished = lr::rdtsc();
+        r.achieved = measured_start ? double(r.sent) * hz_ / double(finished - measured_start) : 0;
+        lr::PerThread<StepLatency>::for_each([&](const StepLatency& l) {
+            r.corrected.merge(l.corrected[step]);
+            r.uncorrected.merge(l.uncorrected[step]);
+        });
+        return r;
+    }
+
+private:
+    const Options& o_;
+    enshost::EventHandler handler_;
+    DrainFn drain_;
+    double hz_;
+    enshost::EventStream stream_;
+    std::vector<double> gaps_;
+};
+
+void print_header(const Options& o)
+{
+    if (o.csv)
+        printf("target_rate,achieved_rate,events,p50_ns,p90_ns,p99_ns,p999_ns,max_ns,uncorrected_p99_ns,max_lag_ns\n");
+    else
+        printf("%12s %12s %10s %10s %10s %10s %10s %12s %12s %12s\n", "target/s", "achieved/s", "events", "p50 ns",
+               "p90 ns", "p99 ns", "p99.9 ns", "max ns", "uncorr p99", "max lag ns");
+}
+
+void print_row(const Options& o, const StepResult& r, double hz)
+{
+    double ns = 1e9 / hz;
+    const lr::Histogram& h = r.corrected;
+    const char* fmt = o.csv ? "%.0f,%.0f,%" PRIu64 ",%.0f,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f\n"
+                            : "%12.0f %12.0f %10" PRIu64 " %10.0f %10.0f %10.0f %10.0f %12.0f %12.0f %12.0f\n";
+    printf(fmt, r.target, r.achieved, r.sent, double(h.percentile(50)) * ns, double(h.percentile(90)) * ns,
+           double(h.percentile(99)) * ns, double(h.percentile(99.9)) * ns, double(h.max()) * ns,
+           double(r.uncorrected.percentile(99)) * ns, double(r.max_lag) * ns);
+    fflush(stdout);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    Options o;
+    try {
+        o = parse(argc, argv);
+    } catch (const std::exception& e) {
+        fprintf(stderr, "loadgen: %s\n", e.what());
+        usage(stderr);
+        return 2;
+    }
+
+    try {
+        enshost::set_notify_hook(record_probe);
+        enshost::Plugin plugin(o.plugin);
+        double hz = lr::calibrate_tsc_hz();
+        Generator gen(o, plugin, hz);
+        if (!o.csv)
+            printf("plugin: %s  arrival: %s\n", plugin.path().c_str(), o.poisson ? "poisson" : "constant");
+        print_header(o);
+        double rate = o.rate;
+        for (unsigned step = 0; step < kMaxSteps; ++step) {
+            StepResult r = gen.run(step, rate);
+            print_row(o, r, hz);
+            if (r.achieved < o.saturation * r.target || o.step == 1)
+                break;
+            rate *= o.step;
+            if (o.max_rate > 0 && rate > o.max_rate)
+                break;
+        }
+    } catch (const std::exception& e) {
+        fprintf(stderr, "loadgen: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
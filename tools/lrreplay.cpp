@@ -0,0 +1,271 @@
+// lrreplay: replays an event trace recorded with LR_TRACE into one or
+// more latencyresponder.so builds.
+//
+// Events are fed to event_handler with their recorded session_id,
+// event_type, sqn and payload length, the payload holding whatever
+// prefix the trace kept and zeros after it.  By default they go out on
+// the recorded schedule: each event is due at its recorded offset from
+// the first one, times --warp, so --warp 0.5 replays twice as fast and
+// --warp 0 as fast as the plugin returns.  With --per-ring every
+// recorded thread is replayed by a thread of its own, on the shared
+// schedule; otherwise all events go out from one thread in TSC order.
+// --repeat plays the trace again with its recorded sqns, which the
+// responder's sequence tracking sees as a resync of every session.
+//
+// Each build runs in its own forked process with identical input, one
+// after the other.  Per build it reports the time spent in event_handler
+// and, on a schedule, the latency counted from when each event was due,
+// which also covers the time it waited behind a slow predecessor.  A
+// final table compares the builds against the first one.
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cli.h"
+#include "ens_runtime.h"
+#include "histogram.h"
+#include "plugin.h"
+#include "report.h"
+#include "trace_reader.h"
+#include "tsc.h"
+
+namespace {
+
+struct Options {
+    std::string trace;
+    std::vector<std::string> plugins;
+    double warp = 1;
+    uint64_t repeat = 1;
+    bool per_ring = false;
+};
+
+// One replaying thread's share of the trace and what it measured.
+struct Lane {
+    std::vector<const enshost::TraceEvent*> events;
+    uint32_t max_length = 0;
+    lr::Histogram call;
+    lr::Histogram from_due;
+    lr::Histogram lag;
+};
+
+// What a child reports back to the parent for the comparison table.
+struct Result {
+    double events_per_sec;
+    double call_p50_ns;
+    double call_p99_ns;
+    double call_p999_ns;
+    double call_max_ns;
+    double due_p99_ns;
+};
+
+// Sleeps through most of a long wait so idle stretches of the trace do
+// not keep a CPU spinning, then spins to the exact TSC.
+void wait_until(uint64_t due, double hz)
+{
+    const uint64_t spin = uint64_t(hz / 10000); // 100 us
+    uint64_t now = lr::rdtsc();
+    if (due > now + 2 * spin) {
+        uint64_t ns = uint64_t(double(due - now - spin) / hz * 1e9);
+        timespec ts = {time_t(ns / 1000000000u), long(ns % 1000000000u)};
+        nanosleep(&ts, nullptr);
+    }
+    while (lr::rdtsc() < due)
+        ;
+}
+
+void replay(Lane& lane, enshost::EventHandler handler, uint32_t prefix_bytes, uint64_t first_tsc, double scale,
+            uint64_t start, uint64_t period, uint64_t repeat, double hz)
+{
+    std::vector<uint8_t> payload(lane.max_length ? lane.max_length : 1);
+    for (uint64_t r = 0; r < repeat; ++r) {
+        for (const enshost::TraceEvent* e : lane.events) {
+            const LRTraceRecord& rec = e->record;
+            uint64_t due = 0;
+            if (scale > 0) {
+                due = start + r * period + uint64_t(double(rec.tsc - first_tsc) * scale);
+                wait_until(due, hz);
+            }
+            ENSUserData data = {rec.length, payload.data()};
+            uint32_t kept = rec.length < prefix_bytes ? rec.length : prefix_bytes;
+            memcpy(payload.data(), e->prefix, kept);
+            uint64_t t0 = lr::rdtsc();
+            handler(rec.session_id, rec.event_type, rec.sqn, rec.flags & LR_TRACE_NO_DATA ? nullptr : &data);
+            uint64_t t1 = lr::rdtscp();
+            lane.call.record(t1 - t0);
+            if (scale > 0) {
+                lane.from_due.record(t1 - due);
+                lane.lag.record(t0 > due ? t0 - due : 0);
+            }
+        }
+    }
+}
+
+typedef void (*DrainFn)();
+typedef int (*SummaryFn)(LRLatencySummary*);
+
+Result run(const Options& o, const enshost::TraceReader& trace, const std::vector<enshost::TraceEvent>& events,
+           const std::string& path)
+{
+    enshost::Plugin plugin(path);
+    enshost::EventHandler handler = plugin.event_handler();
+    DrainFn drain = reinterpret_cast<DrainFn>(plugin.symbol("lr_async_drain"));
+    SummaryFn summary = reinterpret_cast<SummaryFn>(plugin.symbol("lr_latency_summary"));
+    const LRTraceHeader& h = trace.header();
+
+    std::vector<Lane> lanes(o.per_ring ? h.regions : 1);
+    for (const enshost::TraceEvent& e : events) {
+        Lane& l = lanes[o.per_ring ? e.thread : 0];
+        l.events.push_back(&e);
+        if (e.record.length > l.max_length)
+            l.max_length = e.record.length;
+    }
+
+    double hz = lr::calibrate_tsc_hz();
+    // Recorded TSC ticks to local ones, warped.
+    double scale = o.warp * hz / h.tsc_hz;
+    uint64_t first = events.front().record.tsc;
+    // A repeat starts one mean gap after the previous one ended.
+    uint64_t span = uint64_t(double(events.back().record.tsc - first) * scale);
+    uint64_t period = span + (events.size() > 1 ? span / (events.size() - 1) : 0);
+    uint64_t start = lr::rdtsc() + uint64_t(hz / 1000);
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < lanes.size(); ++i)
+        if (!lanes[i].events.empty())
+            threads.emplace_back(replay, std::ref(lanes[i]), handler, h.prefix_bytes, first, scale, start, period,
+                                 o.repeat, hz);
+    replay(lanes[0], handler, h.prefix_bytes, first, scale, start, period, o.repeat, hz);
+    for (std::thread& t : threads)
+        t.join();
+    if (drain)
+        drain();
+    double secs = double(lr::rdtsc() - start) / hz;
+
+    lr::Histogram call;
+    lr::Histogram from_due;
+    lr::Histogram lag;
+    for (const Lane& l : lanes) {
+        call.merge(l.call);
+        from_due.merge(l.from_due);
+        lag.merge(l.lag);
+    }
+    double ns = 1e9 / hz;
+    Result r;
+    r.events_per_sec = double(call.count()) / secs;
+    r.call_p50_ns = double(call.percentile(50)) * ns;
+    r.call_p99_ns = double(call.percentile(99)) * ns;
+    r.call_p999_ns = double(call.percentile(99.9)) * ns;
+    r.call_max_ns = double(call.max()) * ns;
+    r.due_p99_ns = double(from_due.percentile(99)) * ns;
+
+    printf("%s: %" PRIu64 " events in %.3f s (%.0f/s), %zu notifies\n", path.c_str(), call.count(), secs,
+           r.events_per_sec, size_t(enshost::notify_totals().calls));
+    enshost::print_latency(stdout, "  event_handler", call, hz);
+    if (scale > 0) {
+        enshost::print_latency(stdout, "  from due time", from_due, hz);
+        enshost::print_latency(stdout, "  start lag", lag, hz);
+    }
+    LRLatencySummary s;
+    if (summary && summary(&s) == 0)
+        printf("  responder latency (ns): n=%" PRIu64 " p50=%.1f p99=%.1f p99.9=%.1f max=%.1f\n", s.count, s.p50_ns,
+               s.p99_ns, s.p999_ns, s.max_ns);
+    fflush(stdout);
+    return r;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    Options o;
+    try {
+        enshost::ArgReader args(argc, argv);
+        while (!args.done()) {
+            std::string a = args.next();
+            if (a == "--warp")
+                o.warp = args.real(a);
+            else if (a == "--repeat")
+                o.repeat = args.u64(a);
+            else if (a == "--per-ring")
+                o.per_ring = true;
+            else if (!a.empty() && a[0] == '-')
+                throw std::invalid_argument("unknown option " + a);
+            else if (o.trace.empty())
+                o.trace = a;
+            else
+                o.plugins.push_back(a);
+        }
+        if (o.plugins.empty() || o.warp < 0 || o.repeat == 0)
+            throw std::invalid_argument("need a trace and at least one plugin, --warp >= 0, --repeat > 0");
+    } catch (const std::exception& e) {
+        fprintf(stderr, "lrreplay: %s\n"
+                        "usage: lrreplay [--warp F] [--repeat N] [--per-ring] TRACE PLUGIN.so...\n", e.what());
+        return 2;
+    }
+
+    std::vector<Result> results;
+    int status = 0;
+    try {
+        enshost::TraceReader trace(o.trace);
+        std::vector<enshost::TraceEvent> events = trace.events();
+        if (events.empty())
+            throw std::runtime_error(o.trace + " holds no events");
+        printf("%zu events x %" PRIu64 ", %s, warp %g\n", events.size(), o.repeat,
+               o.per_ring ? "one thread per recorded thread" : "one thread", o.warp);
+        fflush(stdout);
+        for (const std::string& path : o.plugins) {
+            int fds[2];
+            if (pipe(fds) != 0)
+                throw std::runtime_error("pipe failed");
+            pid_t pid = fork();
+            if (pid < 0)
+                throw std::runtime_error("fork failed");
+            if (pid == 0) {
+                close(fds[0]);
+                try {
+                    Result r = run(o, trace, events, path);
+                    _exit(write(fds[1], &r, sizeof(r)) == ssize_t(sizeof(r)) ? 0 : 1);
+                } catch (const std::exception& e) {
+                    fprintf(stderr, "lrreplay: %s\n", e.what());
+                    _exit(1);
+                }
+            }
+            close(fds[1]);
+            Result r;
+            bool got = read(fds[0], &r, sizeof(r)) == ssize_t(sizeof(r));
+            close(fds[0]);
+            int child = 0;
+            waitpid(pid, &child, 0);
+            if (!got || !WIFEXITED(child) || WEXITSTATUS(child) != 0) {
+                status = 1;
+                continue;
+            }
+            results.push_back(r);
+        }
+    } catch (const std::exception& e) {
+        fprintf(stderr, "lrreplay: %s\n", e.what());
+        return 1;
+    }
+    if (results.size() < 2 || results.size() != o.plugins.size())
+        return status;
+
+    printf("\n%-48s %10s %9s %9s %9s %10s %10s %9s\n", "ns", "events/s", "p50", "p99", "p99.9", "max", "due p99",
+           "p99 vs #1");
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& r = results[i];
+        double base = results[0].call_p99_ns;
+        printf("%-48s %10.0f %9.1f %9.1f %9.1f %10.1f %10.1f %8.1f%%\n", o.plugins[i].c_str(), r.events_per_sec,
+               r.call_p50_ns, r.call_p99_ns, r.call_p999_ns, r.call_max_ns, r.due_p99_ns,
+               base > 0 ? (r.call_p99_ns - base) / base * 100.0 : 0.0);
+    }
+    return status;
+}
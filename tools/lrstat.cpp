@@ -0,0 +1,172 @@
+// lrstat: prints the statistics a running latencyresponder.so publishes
+// in shared memory, like vmstat: one line per interval with event rates
+// and the responder latency percentiles of that interval.
+//
+// Only maps the segment read-only and copies snapshots out of it under
+// its seqlock, so it never slows the responder down.
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "cli.h"
+#include "histogram.h"
+#include "stats_segment.h"
+
+namespace {
+
+struct Options {
+    std::string name;
+    double interval = 1;
+    uint64_t count = 0;
+    bool header_once = false;
+};
+
+// Maps the named segment, or the default one of a pid.
+const LRStatsSegment* open_segment(std::string name)
+{
+    if (!name.empty() && name.find_first_not_of("0123456789") == std::string::npos)
+        name = "/latencyresponder." + name;
+    if (name.empty() || name[0] != '/')
+        name = "/" + name;
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0)
+        throw std::runtime_error("cannot open shared memory " + name);
+    void* p = mmap(nullptr, sizeof(LRStatsSegment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        throw std::runtime_error("cannot map " + name);
+    const LRStatsSegment* seg = static_cast<const LRStatsSegment*>(p);
+    if (__atomic_load_n(&seg->magic, __ATOMIC_ACQUIRE) != LR_STATS_MAGIC || seg->version != LR_STATS_VERSION ||
+        seg->size != sizeof(LRStatsSegment))
+        throw std::runtime_error(name + " is not a version " + std::to_string(LR_STATS_VERSION) +
+                                 " latencyresponder stats segment");
+    return seg;
+}
+
+void snapshot(const LRStatsSegment* seg, LRStatsSnapshot& out)
+{
+    if (!lr::read_stats(seg, &out))
+        throw std::runtime_error("stats segment stayed busy");
+}
+
+// Latency recorded between two snapshots.
+lr::Histogram interval_latency(const LRStatsSnapshot& a, const LRStatsSnapshot& b)
+{
+    std::vector<uint64_t> counts(LR_STATS_BUCKETS);
+    unsigned top = 0;
+    for (unsigned i = 0; i < LR_STATS_BUCKETS; ++i) {
+        counts[i] = b.latency_buckets[i] - a.latency_buckets[i];
+        if (counts[i])
+            top = i;
+    }
+    lr::Histogram h;
+    uint64_t max = lr::Histogram::highest_value(top);
+    h.merge_buckets(counts.data(), b.latency_sum - a.latency_sum, max < b.latency_max ? max : b.latency_max);
+    return h;
+}
+
+void print_header()
+{
+    printf("%10s %10s %8s %8s %8s %8s %9s %8s %8s %8s %8s %8s %8s %9s %9s %9s %9s %9s %9s %9s\n", "data/s",
+           "notify/s", "open/s", "close/s", "other/s", "gaps/s", "sessions", "full", "drops", "kvfull", "nostamp",
+           "poolovf", "ringwait", "p50 ns", "p99 ns", "p99.9 ns", "max ns", "jit mean", "jit p99", "jit max");
+}
+
+void print_row(const LRStatsSnapshot& a, const LRStatsSnapshot& b)
+{
+    double secs = double(b.publish_ns - a.publish_ns) / 1e9;
+    if (secs <= 0)
+        secs = 1e-9;
+    double ns = b.tsc_hz > 0 ? 1e9 / b.tsc_hz : 0;
+    lr::Histogram h = interval_latency(a, b);
+    uint64_t drops = (b.rate_dropped - a.rate_dropped) + (b.dedup_suppressed - a.dedup_suppressed) +
+                     (b.kv_dropped - a.kv_dropped);
+    printf("%10.0f %10.0f %8.0f %8.0f %8.0f %8.0f %9" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64 " %8" PRIu64
+           " %8" PRIu64 " %8" PRIu64 " %9.0f %9.0f %9.0f %9.0f %9.0f %9.0f %9.0f\n",
+           double(b.data_events - a.data_events) / secs, double(b.notifies - a.notifies) / secs,
+           double(b.opens - a.opens) / secs, double(b.closes - a.closes) / secs,
+           double((b.keepalives - a.keepalives) + (b.unknown_events - a.unknown_events)) / secs,
+           double(b.seq_gaps - a.seq_gaps) / secs, b.sessions, b.table_full - a.table_full, drops,
+           b.kv_full - a.kv_full, b.stamp_skipped - a.stamp_skipped, b.pool_overflows - a.pool_overflows,
+           b.ring_full_waits - a.ring_full_waits, double(h.percentile(50)) * ns, double(h.percentile(99)) * ns,
+           double(h.percentile(99.9)) * ns, double(h.max()) * ns, b.jitter_mean_ns, b.jitter_p99_ns, b.jitter_max_ns);
+    fflush(stdout);
+}
+
+void sleep_for(double secs)
+{
+    timespec ts;
+    ts.tv_sec = time_t(secs);
+    ts.tv_nsec = long((secs - double(ts.tv_sec)) * 1e9);
+    nanosleep(&ts, nullptr);
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    Options o;
+    try {
+        enshost::ArgReader args(argc, argv);
+        while (!args.done()) {
+            std::string a = args.next();
+            if (a == "--interval")
+                o.interval = args.real(a);
+            else if (a == "--count")
+                o.count = args.u64(a);
+            else if (a == "--header-once")
+                o.header_once = true;
+            else if (!a.empty() && a[0] == '-')
+                throw std::invalid_argument("unknown option " + a);
+            else
+                o.name = a;
+        }
+        if (o.name.empty() || o.interval <= 0)
+            throw std::invalid_argument("need a segment name or pid and --interval > 0");
+    } catch (const std::exception& e) {
+        fprintf(stderr, "lrstat: %s\n"
+                        "usage: lrstat [--interval SEC] [--count N] [--header-once] NAME|PID\n"
+                        "full counts events the session table had no room for; drops, data events left\n"
+                        "unanswered by the rate limiter, dedup suppression or a key-value reply with no\n"
+                        "buffer; kvfull, PUTs refused; nostamp, responses sent unstamped; poolovf,\n"
+                        "response buffers taken from malloc; ringwait, waits on full worker rings.\n"
+                        "jit columns summarize the sessions' interarrival jitter (LR_JITTER) in ns,\n"
+                        "refreshed by the plugin about once a second.\n",
+                e.what());
+        return 2;
+    }
+
+    try {
+        const LRStatsSegment* seg = open_segment(o.name);
+        // Snapshots are 18 KiB each; keep them off the stack.
+        std::vector<LRStatsSnapshot> snaps(2);
+        LRStatsSnapshot* prev = &snaps[0];
+        LRStatsSnapshot* cur = &snaps[1];
+        snapshot(seg, *prev);
+        printf("pid %u, up %.0f s, tsc %.3f GHz\n", seg->pid, double(prev->publish_ns - prev->load_ns) / 1e9,
+               prev->tsc_hz / 1e9);
+        for (uint64_t n = 0; o.count == 0 || n < o.count; ++n) {
+            if (n == 0 || (!o.header_once && n % 20 == 0))
+                print_header();
+            sleep_for(o.interval);
+            snapshot(seg, *cur);
+            print_row(*prev, *cur);
+            std::swap(prev, cur);
+        }
+    } catch (const std::exception& e) {
+        fprintf(stderr, "lrstat: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,143 @@
+// lrtrace: prints an event trace latencyresponder.so recorded with
+// LR_TRACE, merged across threads in TSC order, or a summary of it.
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include <exception>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "cli.h"
+#include "histogram.h"
+#include "trace_reader.h"
+
+namespace {
+
+struct Options {
+    std::string path;
+    bool summary = false;
+    bool csv = false;
+    bool prefix = false;
+    uint64_t limit = 0;
+};
+
+void print_summary(const enshost::TraceReader& trace, const std::vector<enshost::TraceEvent>& events)
+{
+    const LRTraceHeader& h = trace.header();
+    double ns = 1e9 / h.tsc_hz;
+    printf("pid %u, tsc %.3f GHz, %u rings of %" PRIu64 " records, %u payload bytes per record\n", h.pid,
+           h.tsc_hz / 1e9, h.regions, h.region_records, h.prefix_bytes);
+    for (uint32_t i = 0; i < h.regions; ++i) {
+        const LRTraceRegion& r = trace.region(i);
+        if (r.tid)
+            printf("ring %u: tid %u, %" PRIu64 " events recorded\n", i, r.tid, r.head);
+    }
+    if (events.empty()) {
+        printf("no events\n");
+        return;
+    }
+    std::map<uint32_t, uint64_t> types;
+    std::unordered_set<uint32_t> sessions;
+    lr::Histogram lengths;
+    lr::Histogram gaps;
+    for (size_t i = 0; i < events.size(); ++i) {
+        const LRTraceRecord& r = events[i].record;
+        ++types[r.event_type];
+        sessions.insert(r.session_id);
+        lengths.record(r.length);
+        if (i)
+            gaps.record(r.tsc - events[i - 1].record.tsc);
+    }
+    double span = double(events.back().record.tsc - events.front().record.tsc) * ns / 1e9;
+    printf("%zu events over %.3f s (%.0f/s), %zu sessions\n", events.size(), span,
+           span > 0 ? double(events.size()) / span : 0.0, sessions.size());
+    printf("event types:");
+    for (const auto& t : types)
+        printf(" %u=%" PRIu64, t.first, t.second);
+    printf("\npayload bytes: min=%" PRIu64 " mean=%.1f p50=%" PRIu64 " p99=%" PRIu64 " max=%" PRIu64 "\n",
+           lengths.min(), lengths.mean(), lengths.percentile(50), lengths.percentile(99), lengths.max());
+    if (gaps.count())
+        printf("interarrival ns: p50=%.1f p99=%.1f p99.9=%.1f max=%.1f\n", double(gaps.percentile(50)) * ns,
+               double(gaps.percentile(99)) * ns, double(gaps.percentile(99.9)) * ns, double(gaps.max()) * ns);
+}
+
+void print_events(const enshost::TraceReader& trace, const std::vector<enshost::TraceEvent>& events, const Options& o)
+{
+    const LRTraceHeader& h = trace.header();
+    double ns = 1e9 / h.tsc_hz;
+    const char* sep = o.csv ? "," : " ";
+    if (o.csv)
+        printf("ns,thread,session,type,sqn,length,flags%s\n", o.prefix ? ",prefix" : "");
+    else
+        printf("%14s %6s %10s %5s %10s %7s %5s%s\n", "ns", "thread", "session", "type", "sqn", "length", "flags",
+               o.prefix ? " prefix" : "");
+    uint64_t n = 0;
+    for (const enshost::TraceEvent& e : events) {
+        if (o.limit && n++ == o.limit)
+            break;
+        const LRTraceRecord& r = e.record;
+        // Relative to the plugin load; events never precede it.
+        double t = double(int64_t(r.tsc - h.load_tsc)) * ns;
+        if (o.csv)
+            printf("%.0f,%u,%u,%u,%u,%u,%u", t, e.thread, r.session_id, r.event_type, r.sqn, r.length, r.flags);
+        else
+            printf("%14.0f %6u %10u %5u %10u %7u %5u", t, e.thread, r.session_id, r.event_type, r.sqn, r.length,
+                   r.flags);
+        if (o.prefix) {
+            printf("%s", sep);
+            uint32_t bytes = r.length < h.prefix_bytes ? r.length : h.prefix_bytes;
+            for (uint32_t i = 0; i < bytes; ++i)
+                printf("%02x", e.prefix[i]);
+        }
+        printf("\n");
+    }
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    Options o;
+    try {
+        enshost::ArgReader args(argc, argv);
+        while (!args.done()) {
+            std::string a = args.next();
+            if (a == "--summary")
+                o.summary = true;
+            else if (a == "--csv")
+                o.csv = true;
+            else if (a == "--prefix")
+                o.prefix = true;
+            else if (a == "--limit")
+                o.limit = args.u64(a);
+            else if (!a.empty() && a[0] == '-')
+                throw std::invalid_argument("unknown option " + a);
+            else
+                o.path = a;
+        }
+        if (o.path.empty())
+            throw std::invalid_argument("need a trace file");
+    } catch (const std::exception& e) {
+        fprintf(stderr, "lrtrace: %s\n"
+                        "usage: lrtrace [--summary] [--csv] [--prefix] [--limit N] FILE\n",
+                e.what());
+        return 2;
+    }
+
+    try {
+        enshost::TraceReader trace(o.path);
+        std::vector<enshost::TraceEvent> events = trace.events();
+        if (o.summary)
+            print_summary(trace, events);
+        else
+            print_events(trace, events, o);
+    } catch (const std::exception& e) {
+        fprintf(stderr, "lrtrace: %s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
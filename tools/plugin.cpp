@@ -0,0 +1,59 @@
+#include "plugin.h"
+
+#include <dlfcn.h>
+
+#include <stdexcept>
+
+namespace enshost {
+
+typedef int (*InitFn)(const LRHostApi*, LRPluginApi*);
+
+Plugin::Plugin(const std::string& path, Binding binding, Registration registration)
+    : path_(path)
+    , handle_(nullptr)
+    , event_handler_(nullptr)
+    , batch_handler_(nullptr)
+    , registered_(false)
+    , capabilities_(0)
+{
+    // dlopen only searches the library path for names without a slash.
+    std::string file = path.find('/') == std::string::npos ? "./" + path : path;
+    handle_ = dlopen(file.c_str(), (binding == kNow ? RTLD_NOW : RTLD_LAZY) | RTLD_LOCAL);
+    if (!handle_)
+        throw std::runtime_error(std::string("cannot load plugin: ") + dlerror());
+    InitFn init = registration == kTable ? reinterpret_cast<InitFn>(symbol("lr_plugin_init")) : nullptr;
+    if (init) {
+        // This runtime notifies from any thread, batches and gathers.
+        LRHostApi host = {LR_API_VERSION, sizeof(LRHostApi), LR_HOST_NOTIFY_ANY_THREAD, ENSSessionNotify,
+                          ENSSessionNotifyBatch, ENSSessionNotifyVec};
+        LRPluginApi api = LRPluginApi();
+        api.size = sizeof(api);
+        if (init(&host, &api) == 0 && api.event_handler) {
+            registered_ = true;
+            capabilities_ = api.capabilities;
+            event_handler_ = api.event_handler;
+            if (api.capabilities & LR_PLUGIN_BATCH)
+                batch_handler_ = api.event_handler_batch;
+        }
+    }
+    if (!event_handler_)
+        event_handler_ = reinterpret_cast<EventHandler>(symbol("event_handler"));
+    if (!event_handler_) {
+        dlclose(handle_);
+        throw std::runtime_error(path + ": no event_handler symbol");
+    }
+    if (!batch_handler_)
+        batch_handler_ = reinterpret_cast<BatchHandler>(symbol("event_handler_batch"));
+}
+
+Plugin::~Plugin()
+{
+    dlclose(handle_);
+}
+
+void* Plugin::symbol(const char* name) const
+{
+    return dlsym(handle_, name);
+}
+
+}
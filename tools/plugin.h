@@ -0,0 +1,54 @@
+// Loads a latencyresponder.so build the way the ENS runtime does.
+
+#ifndef LR_TOOLS_PLUGIN_H
+#define LR_TOOLS_PLUGIN_H
+
+#include <string>
+
+#include "latencyresponder.h"
+
+namespace enshost {
+
+typedef void (*EventHandler)(uint32_t session_id, uint32_t event_type, uint32_t sqn, ENSUserData* data);
+typedef void (*BatchHandler)(const LREvent* events, uint32_t count);
+
+class Plugin {
+public:
+    enum Binding { kLazy, kNow };
+    // kTable registers through lr_plugin_init when the plugin has it and
+    // uses the symbols otherwise; kSymbols always uses the symbols.
+    enum Registration { kTable, kSymbols };
+
+    // Throws std::runtime_error if the library cannot be loaded or does
+    // not export event_handler.
+    explicit Plugin(const std::string& path, Binding binding = kNow, Registration registration = kTable);
+    ~Plugin();
+
+    Plugin(const Plugin&) = delete;
+    Plugin& operator=(const Plugin&) = delete;
+
+    const std::string& path() const { return path_; }
+    EventHandler event_handler() const { return event_handler_; }
+    // The batch entry point from the plugin's table, or the exported
+    // event_handler_batch; nullptr if it has neither.
+    BatchHandler batch_handler() const { return batch_handler_; }
+    // Whether lr_plugin_init accepted the host's table, and the
+    // LR_PLUGIN_* capabilities it reported.
+    bool registered() const { return registered_; }
+    uint64_t capabilities() const { return capabilities_; }
+
+    // Returns nullptr when the plugin does not export `name`.
+    void* symbol(const char* name) const;
+
+private:
+    std::string path_;
+    void* handle_;
+    EventHandler event_handler_;
+    BatchHandler batch_handler_;
+    bool registered_;
+    uint64_t capabilities_;
+};
+
+}
+
+#endif
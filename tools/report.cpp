@@ -0,0 +1,22 @@
+#include "report.h"
+
+#include <inttypes.h>
+
+namespace enshost {
+
+void print_latency(FILE* out, const char* label, const lr::Histogram& cycles, double tsc_hz)
+{
+    double ns = 1e9 / tsc_hz;
+    fprintf(out,
+            "%s (ns): n=%" PRIu64 " min=%.1f mean=%.1f p50=%.1f p90=%.1f p99=%.1f p99.9=%.1f max=%.1f\n",
+            label, cycles.count(),
+            double(cycles.min()) * ns,
+            cycles.mean() * ns,
+            double(cycles.percentile(50)) * ns,
+            double(cycles.percentile(90)) * ns,
+            double(cycles.percentile(99)) * ns,
+            double(cycles.percentile(99.9)) * ns,
+            double(cycles.max()) * ns);
+}
+
+}
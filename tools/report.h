@@ -0,0 +1,18 @@
+// Text output shared by the host tools.
+
+#ifndef LR_TOOLS_REPORT_H
+#define LR_TOOLS_REPORT_H
+
+#include <stdio.h>
+
+#include "histogram.h"
+
+namespace enshost {
+
+// Prints count, min, mean, p50/p90/p99/p99.9 and max of a histogram of
+// TSC cycles, converted to nanoseconds.
+void print_latency(FILE* out, const char* label, const lr::Histogram& cycles, double tsc_hz);
+
+}
+
+#endif
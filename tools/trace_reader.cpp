@@ -0,0 +1,78 @@
+#include "trace_reader.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace enshost {
+
+TraceReader::TraceReader(const std::string& path)
+    : base_(nullptr)
+    , bytes_(0)
+    , header_(nullptr)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw std::runtime_error("cannot open " + path);
+    struct stat st;
+    void* p = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && uint64_t(st.st_size) >= LR_TRACE_HEADER_BYTES)
+        p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        throw std::runtime_error("cannot map " + path);
+    base_ = static_cast<const uint8_t*>(p);
+    bytes_ = uint64_t(st.st_size);
+    header_ = reinterpret_cast<const LRTraceHeader*>(base_);
+    const LRTraceHeader& h = *header_;
+    bool valid = __atomic_load_n(&h.magic, __ATOMIC_ACQUIRE) == LR_TRACE_MAGIC && h.version == LR_TRACE_VERSION &&
+                 h.header_bytes == LR_TRACE_HEADER_BYTES && h.record_bytes == sizeof(LRTraceRecord) + h.prefix_bytes &&
+                 h.regions >= 1 && h.regions <= LR_TRACE_MAX_REGIONS && h.region_records >= 2 &&
+                 (h.region_records & (h.region_records - 1)) == 0 &&
+                 h.header_bytes + uint64_t(h.regions) * h.region_records * h.record_bytes <= bytes_;
+    if (!valid) {
+        munmap(const_cast<uint8_t*>(base_), bytes_);
+        throw std::runtime_error(path + " is not a version " + std::to_string(LR_TRACE_VERSION) +
+                                 " latencyresponder trace");
+    }
+}
+
+TraceReader::~TraceReader()
+{
+    munmap(const_cast<uint8_t*>(base_), bytes_);
+}
+
+const LRTraceRegion& TraceReader::region(uint32_t i) const
+{
+    return reinterpret_cast<const LRTraceRegion*>(base_ + 64)[i];
+}
+
+std::vector<TraceEvent> TraceReader::events() const
+{
+    const LRTraceHeader& h = *header_;
+    std::vector<TraceEvent> out;
+    for (uint32_t i = 0; i < h.regions; ++i) {
+        uint64_t head = __atomic_load_n(&region(i).head, __ATOMIC_ACQUIRE);
+        // The slot at head may be torn; see trace_file.h.
+        uint64_t n = head < h.region_records ? head : h.region_records - 1;
+        const uint8_t* ring = base_ + h.header_bytes + uint64_t(i) * h.region_records * h.record_bytes;
+        for (uint64_t k = head - n; k < head; ++k) {
+            const uint8_t* at = ring + (k & (h.region_records - 1)) * h.record_bytes;
+            TraceEvent e;
+            memcpy(&e.record, at, sizeof(e.record));
+            e.thread = i;
+            e.prefix = at + sizeof(LRTraceRecord);
+            out.push_back(e);
+        }
+    }
+    // Each ring is in order already; merge them by time.
+    std::stable_sort(out.begin(), out.end(),
+                     [](const TraceEvent& a, const TraceEvent& b) { return a.record.tsc < b.record.tsc; });
+    return out;
+}
+
+}
@@ -0,0 +1,49 @@
+// Reads an event trace file written by latencyresponder.so (LR_TRACE),
+// see trace_file.h for the layout.
+
+#ifndef LR_TOOLS_TRACE_READER_H
+#define LR_TOOLS_TRACE_READER_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "trace_file.h"
+
+namespace enshost {
+
+struct TraceEvent {
+    LRTraceRecord record;
+    // Ring the event was recorded in, one per recording thread.
+    uint32_t thread;
+    // The first min(record.length, prefix_bytes) payload bytes.
+    const uint8_t* prefix;
+};
+
+class TraceReader {
+public:
+    // Maps the file read-only.  Throws std::runtime_error if it cannot, or
+    // if it is not a trace of this version.
+    explicit TraceReader(const std::string& path);
+    ~TraceReader();
+
+    TraceReader(const TraceReader&) = delete;
+    TraceReader& operator=(const TraceReader&) = delete;
+
+    const LRTraceHeader& header() const { return *header_; }
+    const LRTraceRegion& region(uint32_t i) const;
+
+    // Every readable event of every ring, ordered by TSC.  The prefixes
+    // point into the mapping, which lives as long as the reader.
+    std::vector<TraceEvent> events() const;
+
+private:
+    const uint8_t* base_;
+    uint64_t bytes_;
+    const LRTraceHeader* header_;
+};
+
+}
+
+#endif